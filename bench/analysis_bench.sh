@@ -0,0 +1,56 @@
+#!/bin/sh
+# Dependency analysis of bin/cook by --threads, on a layered cookbook wide
+# enough for the parallel analysis to split its levels among the threads.
+#
+# usage: bench/analysis_bench.sh [layers [width [threads...]]]
+#
+# Every recipe depends on three of the layer below & runs `false`.  A
+# fail-fast run of "top" at -c 1 is loading the cookbook (compiled into an
+# image to keep it short), the analysis & the one failed recipe that stops
+# the run.  The same run of "one", a recipe of its own, is the loading &
+# the failure alone, which is subtracted.
+
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-10}
+LAYERS=${1:-100}
+WIDTH=${2:-10000}
+[ $# -gt 2 ] && shift 2 || set -- 1 2 4 8 16
+
+CKB=${TMPDIR:-/tmp}/analysis_bench_${LAYERS}x${WIDTH}_false.ckb
+if [ ! -f "${CKB}c" ]; then
+    python3 - "$CKB" "$LAYERS" "$WIDTH" <<'PYEOF' || exit 1
+import random, sys
+path, layers, width = sys.argv[1], int(sys.argv[2]), int(sys.argv[3])
+random.seed(1)
+with open(path, 'w') as out:
+    out.write('top: ' + ' '.join('l{}_{}'.format(layers - 1, j) for j in range(width)) + '\n\n')
+    out.write('one:\n  false\n\n')
+    for l in range(layers):
+        for j in range(width):
+            deps = ['l{}_{}'.format(l - 1, random.randrange(width)) for _ in range(3)] if l else []
+            out.write('l{}_{}: {}\n  false\n\n'.format(l, j, ' '.join(deps)))
+PYEOF
+    "$COOK" --compile "$CKB" || exit 1
+fi
+
+python3 - "$COOK" "${CKB}c" "$RUNS" "$@" <<'PYEOF'
+import subprocess, sys, time
+cook, image, runs, threads = sys.argv[1], sys.argv[2], int(sys.argv[3]), sys.argv[4:]
+def timed(args):
+    times = []
+    for _ in range(runs):
+        t = time.perf_counter()
+        if subprocess.run(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode == 0:
+            sys.exit(' '.join(args) + ': did not fail')
+        times.append(time.perf_counter() - t)
+    times.sort()
+    return times[len(times) // 2] * 1e3
+failed = [cook, '-f', image, '-c', '1', '--on-failure=fail-fast']
+base = timed(failed + ['one'])
+print('{:>8s} {:>10s} {:>14s} {:>8s}'.format('threads', 'run(ms)', 'over load(ms)', 'speedup'))
+serial = None
+for t in threads:
+    ms = timed(failed + ['--threads=' + t, 'top']) - base
+    serial = serial or ms
+    print('{:>8s} {:>10.1f} {:>14.1f} {:>8.2f}'.format(t, ms + base, ms, serial / ms))
+PYEOF
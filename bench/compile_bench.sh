@@ -0,0 +1,39 @@
+#!/bin/sh
+# Startup of bin/cook on a compiled cookbook image against parsing the same
+# cookbook, on synthetic cookbooks of increasing size.
+#
+# usage: bench/compile_bench.sh [recipes...]
+#
+# Runs the recipe "noop" (no tasks), so the times are parsing or mapping the
+# cookbook, the name index and the (empty) analysis.  The compile time is
+# reported once per size.
+
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-10}
+
+[ $# -gt 0 ] || set -- 10000 1000000
+printf '%10s %12s %12s %12s %12s\n' recipes 'compile(ms)' 'parse(ms)' 'image(ms)' 'image(MB)'
+for N in "$@"; do
+    CKB=${TMPDIR:-/tmp}/compile_bench_$N.ckb
+    if [ ! -f "$CKB" ]; then
+        python3 "$(dirname "$0")/gen_cookbook.py" -n "$N" -o "$CKB" || exit 1
+        printf 'noop:\n\n' >> "$CKB"
+    fi
+    python3 - "$COOK" "$CKB" "$RUNS" "$N" <<'PYEOF'
+import os, subprocess, sys, time
+cook, ckb, runs, n = sys.argv[1], sys.argv[2], int(sys.argv[3]), sys.argv[4]
+image = ckb + 'c'
+def timed(args, runs):
+    times = []
+    for _ in range(runs):
+        t = time.perf_counter()
+        subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+        times.append(time.perf_counter() - t)
+    times.sort()
+    return times[len(times) // 2] * 1e3
+compile_ms = timed([cook, '--compile', ckb, '-o', image], 1)
+parse_ms = timed([cook, '-f', ckb, 'noop'], runs)
+image_ms = timed([cook, '-f', image, 'noop'], runs)
+print('{:>10s} {:>12.1f} {:>12.1f} {:>12.2f} {:>12.1f}'.format(n, compile_ms, parse_ms, image_ms, os.path.getsize(image) / 1e6))
+PYEOF
+done
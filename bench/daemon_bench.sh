@@ -0,0 +1,44 @@
+#!/bin/sh
+# Latency of a run through the cook daemon against a fresh bin/cook on a large
+# synthetic cookbook.
+#
+# usage: bench/daemon_bench.sh [recipes]
+#
+# Runs the recipe "noop" (no tasks) and the generated "main" (a single
+# `true`), each directly and through --connect to a daemon started on the
+# same cookbook.  Times include starting the client, so `true` is reported
+# as the floor.
+
+N=${1:-50000}
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-100}
+
+CKB=${TMPDIR:-/tmp}/daemon_bench_$N.ckb
+if [ ! -f "$CKB" ]; then
+    python3 "$(dirname "$0")/gen_cookbook.py" -n "$N" -o "$CKB" || exit 1
+    printf 'noop:\n\n' >> "$CKB"
+fi
+SOCK=${TMPDIR:-/tmp}/daemon_bench_$$.sock
+
+"$COOK" --daemon="$SOCK" -f "$CKB" &
+DAEMON=$!
+trap 'kill $DAEMON; rm -f "$SOCK"' EXIT
+while [ ! -S "$SOCK" ]; do sleep 0.1; done
+
+python3 - "$COOK" "$CKB" "$SOCK" "$RUNS" <<'PYEOF'
+import subprocess, sys, time
+cook, ckb, sock, runs = sys.argv[1], sys.argv[2], sys.argv[3], int(sys.argv[4])
+def timed(args, n):
+    times = []
+    for _ in range(n):
+        t = time.perf_counter()
+        subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+        times.append(time.perf_counter() - t)
+    times.sort()
+    return times[0] * 1e3, times[len(times) // 2] * 1e3
+print('{:>14s} {:>10s} {:>10s}'.format('run', 'best(ms)', 'median(ms)'))
+print('{:>14s} {:>10.3f} {:>10.3f}'.format('true', *timed(['true'], runs)))
+for recipe in ('noop', 'main'):
+    print('{:>14s} {:>10.3f} {:>10.3f}'.format(recipe + ' direct', *timed([cook, '-f', ckb, recipe], max(1, runs // 20))))
+    print('{:>14s} {:>10.3f} {:>10.3f}'.format(recipe + ' daemon', *timed([cook, '--connect=' + sock, '-f', ckb, recipe], runs)))
+PYEOF
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Compare the signal and epoll engines, and the epoll engine with
+# --exec=direct, on a wide DAG of no-op recipes.
+#
+# usage: bench/engine_bench.sh [recipes] [cooks ...]
+#
+# Reports the best makespan of each configuration and the mean time per
+# recipe (makespan / recipes).  The recipes do no work, so the latter is the
+# per-recipe dispatch + fork + reap cost of the engine.  One more run with
+# --latency-report gives the mean ready->dispatch time of a recipe; it is
+# kept out of the makespans.  Every leaf is ready at once, so at small -c this
+# is mostly the wait for a free cook, i.e. how fast the engine turns cooks
+# over.  PAD unreferenced recipes make the scheduler process bigger, and with
+# it every cook fork.
+
+N=${1:-2000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- 1 4 16 64
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-3}
+PAD=${PAD:-0}
+
+CKB=${TMPDIR:-/tmp}/engine_bench_${N}_$PAD.ckb
+if [ ! -f "$CKB" ]; then
+    python3 "$(dirname "$0")/gen_cookbook.py" --shape wide -n "$N" -o "$CKB" || exit 1
+    python3 "$(dirname "$0")/gen_cookbook.py" --shape steps -n 0 --pad "$PAD" | tail -n +3 >> "$CKB" || exit 1
+fi
+
+python3 - "$COOK" "$CKB" "$N" "$RUNS" "$@" <<'PYEOF'
+import subprocess, sys, time
+cook, ckb, n, runs = sys.argv[1], sys.argv[2], int(sys.argv[3]), int(sys.argv[4])
+print('{:>13s} {:>5s} {:>12s} {:>16s} {:>16s}'.format('engine', '-c', 'makespan(s)', 'us/recipe', 'dispatch(us)'))
+for c in sys.argv[5:]:
+    for name, args in (('signal', ['--engine=signal']), ('epoll', ['--engine=epoll']),
+                       ('epoll+direct', ['--engine=epoll', '--exec=direct'])):
+        best = None
+        for _ in range(runs):
+            t = time.perf_counter()
+            subprocess.run([cook] + args + ['-c', c, '-f', ckb, 'main'], check=True)
+            t = time.perf_counter() - t
+            best = t if best is None else min(best, t)
+        report = subprocess.run([cook] + args + ['-c', c, '-f', ckb, '--latency-report', 'main'],
+                                stderr=subprocess.PIPE, universal_newlines=True, check=True).stderr
+        dispatch = next(float(l.split()[2]) for l in report.splitlines() if l.startswith('ready->dispatch'))
+        print('{:>13s} {:>5s} {:>12.3f} {:>16.1f} {:>16.1f}'.format(name, c, best, best / (n + 1) * 1e6, dispatch))
+PYEOF
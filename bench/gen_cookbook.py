@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""Generate a large synthetic cookbook for benchmarking bin/cook.
+
+Shapes:
+  random  The first recipe is a trivial main recipe with no dependencies, so
+          running `bin/cook -f <file>` on the output cooks a single recipe and
+          the run time is dominated by parsing and linking the rest of the
+          cookbook.  Every other recipe depends on a few randomly chosen
+          recipes defined after it, so the cookbook forms a DAG.
+  wide    A main recipe that depends on N independent leaf recipes.  Every
+          recipe runs the single no-op step given by --step.
+  deep    A main recipe over one chain of N/2 recipes plus N/2 independent
+          leaves.  Every recipe runs --step, so with few cooks the makespan
+          depends on whether the chain is started before the leaves.  The
+          leaves are listed first, so FIFO starts them ahead of the chain.
+  steps   A single main recipe with N tasks, each a pipeline of --width
+          copies of --step, followed by --pad unreferenced recipes that only
+          make the cookbook (and so the cook process) bigger.
+
+The scaling shapes below give every recipe --tasks tasks, each a pipeline of
+--width copies of --step (--tasks 0 leaves only the dependency structure):
+  chain    A main recipe over one chain of N recipes.
+  fan      One source recipe fanned out to N recipes, all of which the main
+           recipe depends on.
+  diamond  A chain of diamonds: every third recipe depends on the two below
+           it, which both depend on the next third recipe down.
+  layered  N recipes in layers of --layer-width.  Every recipe depends on up
+           to -d random recipes of the layer below, & the main recipe on the
+           whole top layer.
+
+--util DIR writes no-op & sleep-like commands for the steps to DIR: `nop` &
+`nap SECONDS`.  cook looks commands up in util/ of its working directory.
+--meta FILE writes the size of a scaling shape as JSON: its recipes, the ones
+the main recipe needs & its depth, the recipes on the longest chain to the
+main recipe.  With a step time those give the lower bound of the makespan.
+--noop adds a recipe `noop` without dependencies or steps, for timing a run
+that only loads the cookbook.
+"""
+import argparse
+import json
+import os
+import random
+import shutil
+import sys
+
+
+def parse_args():
+	parser = argparse.ArgumentParser(description='Generate a synthetic cookbook')
+	parser.add_argument('-n', type=int, default=50000, help='number of recipes (default 50000)')
+	parser.add_argument('-d', type=int, default=4, help='max dependencies per recipe (default 4)')
+	parser.add_argument('-s', type=int, default=1, help='random seed (default 1)')
+	parser.add_argument('--shape', choices=['random', 'wide', 'deep', 'steps'] + list(SCALING), default='random', help='DAG shape (default random)')
+	parser.add_argument('--step', default='true', help='step run by every recipe of the wide shape (default "true")')
+	parser.add_argument('--width', type=int, help='steps per task (default 4 for the steps shape, 1 otherwise)')
+	parser.add_argument('--tasks', type=int, default=1, help='tasks per recipe of the scaling shapes (default 1)')
+	parser.add_argument('--layer-width', type=int, default=100, help='recipes per layer of the layered shape (default 100)')
+	parser.add_argument('--pad', type=int, default=0, help='unreferenced recipes added by the steps shape (default 0)')
+	parser.add_argument('--util', metavar='DIR', help='write the nop & nap commands to DIR')
+	parser.add_argument('--meta', metavar='FILE', help='write the size & depth of a scaling shape to FILE')
+	parser.add_argument('--noop', action='store_true', help='add a recipe noop without dependencies or steps')
+	parser.add_argument('-o', help='output file (default stdout)')
+	args = parser.parse_args()
+	if args.width is None:
+		args.width = 4 if args.shape == 'steps' else 1
+	return args
+
+
+def gen_random(args, rng, out):
+	out.write('main:\n  true\n\n')
+	for i in range(args.n):
+		later = range(i + 1, args.n)
+		deps = rng.sample(later, min(len(later), rng.randint(0, args.d)))
+		out.write('r{:d}: {:s}\n'.format(i, ' '.join('r{:d}'.format(d) for d in deps)))
+		out.write('  echo recipe {:d} | cat > /dev/null\n\n'.format(i))
+
+
+def gen_wide(args, rng, out):
+	out.write('main: {:s}\n  {:s}\n\n'.format(' '.join('r{:d}'.format(i) for i in range(args.n)), args.step))
+	for i in range(args.n):
+		out.write('r{:d}:\n  {:s}\n\n'.format(i, args.step))
+
+
+def gen_deep(args, rng, out):
+	chain = args.n // 2
+	leaves = args.n - chain
+	deps = ['w{:d}'.format(i) for i in range(leaves)] + (['c0'] if chain else [])
+	out.write('main: {:s}\n  {:s}\n\n'.format(' '.join(deps), args.step))
+	for i in range(leaves):
+		out.write('w{:d}:\n  {:s}\n\n'.format(i, args.step))
+	for i in range(chain):
+		dep = 'c{:d}'.format(i + 1) if i + 1 < chain else ''
+		out.write('c{:d}: {:s}\n  {:s}\n\n'.format(i, dep, args.step))
+
+
+def gen_steps(args, rng, out):
+	out.write('main:\n')
+	for i in range(args.n):
+		out.write('  {:s}\n'.format(' | '.join([args.step] * args.width)))
+	out.write('\n')
+	for i in range(args.pad):
+		out.write('p{:d}:\n  echo pad {:d}\n\n'.format(i, i))
+
+
+# The scaling shapes list each recipe after its sub-recipes as (name, [sub-recipe indices]).
+# The last recipe listed is the main recipe.
+
+def chain_graph(args, rng):
+	return [('c{:d}'.format(i), [i - 1] if i else []) for i in range(args.n)] + [('main', [args.n - 1] if args.n else [])]
+
+
+def fan_graph(args, rng):
+	return [('src', [])] + [('f{:d}'.format(i), [0]) for i in range(args.n)] + [('main', list(range(1, args.n + 1)))]
+
+
+def diamond_graph(args, rng):
+	graph = []
+	for i in range(args.n):
+		if i % 3 == 0:
+			deps = [i - 2, i - 1] if i else []
+		else:
+			deps = [i - i % 3]
+		graph.append(('d{:d}'.format(i), deps))
+	return graph + [('main', [args.n - 1] if args.n else [])]
+
+
+def layered_graph(args, rng):
+	graph = []
+	width = max(1, args.layer_width)
+	for i in range(args.n):
+		layer, below = i // width, i // width * width - width
+		deps = sorted(set(below + rng.randrange(width) for _ in range(rng.randint(1, max(1, args.d))))) if layer else []
+		graph.append(('l{:d}_{:d}'.format(layer, i % width), deps))
+	top = (args.n - 1) // width * width if args.n else 0
+	return graph + [('main', list(range(top, args.n)))]
+
+
+SCALING = {'chain': chain_graph, 'fan': fan_graph, 'diamond': diamond_graph, 'layered': layered_graph}
+
+
+def write_graph(args, graph, out):
+	tasks = ''.join('  {:s}\n'.format(' | '.join([args.step] * args.width)) for _ in range(args.tasks))
+	# the main recipe goes first, so it is the default one
+	for index in [len(graph) - 1] + list(range(len(graph) - 1)):
+		name, deps = graph[index]
+		out.write('{:s}: {:s}\n{:s}\n'.format(name, ' '.join(graph[d][0] for d in deps), tasks))
+
+
+# # of recipes on the longest chain to the main recipe
+def graph_depth(graph):
+	depth = []
+	for name, deps in graph:
+		depth.append(1 + max((depth[d] for d in deps), default=0))
+	return depth[-1]
+
+
+# # of recipes the main recipe depends on, itself included
+def graph_required(graph):
+	required = [False] * len(graph)
+	required[-1] = True
+	for index in range(len(graph) - 1, -1, -1):
+		if required[index]:
+			for d in graph[index][1]:
+				required[d] = True
+	return sum(required)
+
+
+# nop & nap in dir: links to true & sleep where those are programs of their own, else scripts
+def write_util(dir):
+	os.makedirs(dir, exist_ok=True)
+	for name, tool in (('nop', 'true'), ('nap', 'sleep')):
+		path = os.path.join(dir, name)
+		if os.path.lexists(path):
+			os.remove(path)
+		target = shutil.which(tool)
+		if target is not None and os.path.basename(os.path.realpath(target)) == tool:
+			os.symlink(os.path.realpath(target), path)
+		else:
+			with open(path, 'w') as script:
+				script.write('#!/bin/sh\nexec {:s} "$@"\n'.format(tool))
+			os.chmod(path, 0o755)
+
+
+def main():
+	args = parse_args()
+	rng = random.Random(args.s)
+	if args.util:
+		write_util(args.util)
+	out = open(args.o, 'w') if args.o else sys.stdout
+	if args.shape in SCALING:
+		graph = SCALING[args.shape](args, rng)
+		write_graph(args, graph, out)
+		if args.meta:
+			with open(args.meta, 'w') as meta:
+				json.dump({'shape': args.shape, 'recipes': len(graph), 'required': graph_required(graph),
+				           'depth': graph_depth(graph), 'tasks': args.tasks}, meta)
+	else:
+		{'random': gen_random, 'wide': gen_wide, 'deep': gen_deep, 'steps': gen_steps}[args.shape](args, rng, out)
+	if args.noop:
+		out.write('noop:\n\n')
+	if out is not sys.stdout:
+		out.close()
+
+
+if __name__ == '__main__':
+	main()
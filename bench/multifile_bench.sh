@@ -0,0 +1,50 @@
+#!/bin/sh
+# Startup of bin/cook on a cookbook split across many files, by the # of
+# threads parsing them, against the same cookbook in one file.
+#
+# usage: bench/multifile_bench.sh [recipes [files [threads...]]]
+#
+# Runs the recipe "noop" (no tasks), so the times are loading, linking &
+# indexing the cookbook and the (empty) analysis.  The recipes are dealt out
+# to the files in order, so most dependencies cross from one file to another.
+
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-10}
+N=${1:-1000000}
+FILES=${2:-200}
+[ $# -gt 2 ] && shift 2 || set -- 1 2 4 8
+
+DIR=${TMPDIR:-/tmp}/multifile_bench_${N}_$FILES
+if [ ! -d "$DIR" ]; then
+    mkdir -p "$DIR" || exit 1
+    python3 "$(dirname "$0")/gen_cookbook.py" -n "$N" -o "$DIR/all.ckb" || exit 1
+    printf 'noop:\n\n' >> "$DIR/all.ckb"
+    python3 - "$DIR" "$FILES" <<'PYEOF' || exit 1
+import sys
+dir, files = sys.argv[1], int(sys.argv[2])
+recipes = [r for r in open(dir + '/all.ckb').read().split('\n\n') if r.strip()]
+per = -(-len(recipes) // files)
+for i in range(files):
+    with open('{}/part{:04d}.ckb'.format(dir, i), 'w') as out:
+        out.write(''.join(r + '\n\n' for r in recipes[i * per:(i + 1) * per]))
+PYEOF
+fi
+
+python3 - "$COOK" "$DIR" "$RUNS" "$@" <<'PYEOF'
+import glob, subprocess, sys, time
+cook, dir, runs, threads = sys.argv[1], sys.argv[2], int(sys.argv[3]), sys.argv[4:]
+parts = sorted(glob.glob(dir + '/part*.ckb'))
+def timed(args):
+    times = []
+    for _ in range(runs):
+        t = time.perf_counter()
+        subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+        times.append(time.perf_counter() - t)
+    times.sort()
+    return times[len(times) // 2] * 1e3
+print('{:>10s} {:>10s}'.format('threads', 'load(ms)'))
+print('{:>10s} {:>10.1f}'.format('one file', timed([cook, '-f', dir + '/all.ckb', 'noop'])))
+files = [a for p in parts for a in ('-f', p)]
+for t in threads:
+    print('{:>10s} {:>10.1f}'.format(t, timed([cook] + files + ['--threads=' + t, 'noop'])))
+PYEOF
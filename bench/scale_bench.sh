@@ -0,0 +1,96 @@
+#!/bin/sh
+# Scheduler benchmark suite over synthetic cookbooks (run by `make bench`).
+#
+# usage: bench/scale_bench.sh [shape ...]
+#
+# For each shape of gen_cookbook.py (chain, fan, diamond & layered by
+# default) reports:
+#   parse      loading SIZE recipes of one step: a run naming a recipe the
+#              cookbook lacks, which exits once the name is looked up, less
+#              the same run on a cookbook of one recipe
+#   analysis   the dependency analysis of their main recipe: a fail-fast run
+#              at -c 1 whose every step is `false`, which stops once the first
+#              recipe dispatched fails, less the load run & less the same
+#              failed run of the one-recipe cookbook
+#   dispatch   per recipe of a DISPATCH_N cookbook whose every recipe runs one
+#              no-op step (util/nop), less the failed run of the same shape
+#   makespan   of a MAKESPAN_N cookbook whose every recipe sleeps STEP_TIME
+#              seconds (util/nap), less its load run, against the lower
+#              bound max(depth, recipes / cooks) * STEP_TIME
+# at each -c of COOKS.  Every time is the median of RUNS runs.  SIZE goes up
+# to 1000000, but generating that many recipes takes a while; the cookbooks
+# are kept in $TMPDIR/cook_bench for the next run.
+
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-3}
+SIZE=${SIZE:-100000}
+DISPATCH_N=${DISPATCH_N:-2000}
+MAKESPAN_N=${MAKESPAN_N:-60}
+STEP_TIME=${STEP_TIME:-0.02}
+COOKS=${COOKS:-1 4 16}
+[ $# -eq 0 ] && set -- chain fan diamond layered
+
+DIR=${TMPDIR:-/tmp}/cook_bench
+mkdir -p "$DIR" || exit 1
+
+python3 - "$(cd "$(dirname "$COOK")" && pwd)/$(basename "$COOK")" "$(dirname "$0")/gen_cookbook.py" "$DIR" \
+        "$RUNS" "$SIZE" "$DISPATCH_N" "$MAKESPAN_N" "$STEP_TIME" "$COOKS" "$@" <<'PYEOF'
+import json, os, subprocess, sys, time
+cook, gen, dir = sys.argv[1], sys.argv[2], sys.argv[3]
+runs, size, dispatch_n, makespan_n = (int(a) for a in sys.argv[4:8])
+step_time, cooks, shapes = sys.argv[8], sys.argv[9].split(), sys.argv[10:]
+
+def generate(name, *args):
+    path = os.path.join(dir, name + '.ckb')
+    if not os.path.exists(path) or not os.path.exists(path + '.json'):
+        subprocess.run(['python3', gen, '--util', os.path.join(dir, 'util'), '--meta', path + '.json', '-o', path]
+                       + list(args), check=True)
+    with open(path + '.json') as meta:
+        return path, json.load(meta)
+
+def timed(*args, fails=False):
+    times = []
+    for _ in range(runs):
+        t = time.perf_counter()
+        status = subprocess.run([cook] + list(args), cwd=dir, stdin=subprocess.DEVNULL,
+                                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode
+        times.append(time.perf_counter() - t)
+        if (status != 0) != fails:
+            sys.exit('cook {:s}: exit status {:d}'.format(' '.join(args), status))
+    times.sort()
+    return times[len(times) // 2]
+
+# the cookbook is parsed & the name looked up, nothing is analyzed or forked
+def loaded(path):
+    return timed('-f', path, 'no-such-recipe', fails=True)
+
+# the whole graph is analyzed, then the first recipe dispatched fails & stops the run
+def failed(path):
+    return timed('-c', '1', '--on-failure=fail-fast', '-f', path, fails=True)
+
+one = os.path.join(dir, 'one.ckb')
+with open(one, 'w') as out:
+    out.write('main:\n  false\n\n')
+base, base_failed = loaded(one), failed(one)
+
+print('{:>8s} {:>8s} {:>10s} {:>13s} {:>4s} {:>20s} {:>12s} {:>9s} {:>6s}'.format(
+    'shape', 'recipes', 'parse(ms)', 'analysis(ms)', '-c', 'dispatch(us/recipe)', 'makespan(s)', 'bound(s)', 'ratio'))
+for shape in shapes:
+    structure, meta = generate('{}_{}_f'.format(shape, size), '--shape', shape, '-n', str(size), '--step', 'false')
+    load = loaded(structure)
+    analysis = (failed(structure) - load) - (base_failed - base)
+    dispatch, dispatch_meta = generate('{}_{}_d'.format(shape, dispatch_n), '--shape', shape, '-n', str(dispatch_n), '--step', 'nop')
+    dispatch_failed, _ = generate('{}_{}_df'.format(shape, dispatch_n), '--shape', shape, '-n', str(dispatch_n), '--step', 'false')
+    no_dispatch = failed(dispatch_failed)
+    makespan, makespan_meta = generate('{}_{}_{}_m'.format(shape, makespan_n, step_time), '--shape', shape,
+                                       '-n', str(makespan_n), '--step', 'nap ' + step_time)
+    makespan_load = loaded(makespan)
+    for i, c in enumerate(cooks):
+        per_recipe = (timed('-c', c, '-f', dispatch) - no_dispatch) / dispatch_meta['required']
+        span = timed('-c', c, '-f', makespan) - makespan_load
+        bound = max(makespan_meta['depth'], makespan_meta['required'] / int(c)) * float(step_time)
+        print('{:>8s} {:>8s} {:>10s} {:>13s} {:>4s} {:>20.1f} {:>12.3f} {:>9.3f} {:>6.2f}'.format(
+            shape if i == 0 else '', str(meta['required']) if i == 0 else '',
+            '{:.1f}'.format((load - base) * 1e3) if i == 0 else '', '{:.1f}'.format(analysis * 1e3) if i == 0 else '',
+            c, per_recipe * 1e6, span, bound, span / bound))
+PYEOF
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compare the fifo and critical-path schedules on a deep-plus-wide DAG.
+#
+# usage: bench/schedule_bench.sh [recipes] [cooks ...]
+#
+# Half of the recipes form one chain to the main recipe, the other half are
+# independent leaves listed ahead of it (gen_cookbook.py --shape deep).  Every
+# recipe sleeps for STEP_TIME seconds, so the makespan is set by the schedule
+# rather than by fork + exec.  Reports the best makespan of each configuration.
+
+N=${1:-40}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- 1 2 4 8
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-3}
+STEP_TIME=${STEP_TIME:-0.05}
+
+CKB=${TMPDIR:-/tmp}/schedule_bench_${N}_$STEP_TIME.ckb
+[ -f "$CKB" ] || python3 "$(dirname "$0")/gen_cookbook.py" --shape deep -n "$N" --step "sleep $STEP_TIME" -o "$CKB" || exit 1
+
+python3 - "$COOK" "$CKB" "$RUNS" "$@" <<'PYEOF'
+import subprocess, sys, time
+cook, ckb, runs = sys.argv[1], sys.argv[2], int(sys.argv[3])
+print('{:>14s} {:>5s} {:>12s}'.format('schedule', '-c', 'makespan(s)'))
+for c in sys.argv[4:]:
+    for schedule in ('fifo', 'critical-path'):
+        best = None
+        for _ in range(runs):
+            t = time.perf_counter()
+            subprocess.run([cook, '--schedule=' + schedule, '-c', c, '-f', ckb], check=True)
+            t = time.perf_counter() - t
+            best = t if best is None else min(best, t)
+        print('{:>14s} {:>5s} {:>12.3f}'.format(schedule, c, best))
+PYEOF
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Time bin/cook startup (parse + link + analysis) on a large synthetic cookbook.
+#
+# usage: bench/startup_bench.sh [recipes] [cook binary ...]
+#
+# The generated main recipe has no dependencies, so each run cooks a single
+# recipe and the wall time is dominated by loading the cookbook.
+
+N=${1:-50000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- bin/cook
+RUNS=${RUNS:-5}
+
+CKB=${TMPDIR:-/tmp}/startup_bench_$N.ckb
+[ -f "$CKB" ] || python3 "$(dirname "$0")/gen_cookbook.py" -n "$N" -o "$CKB" || exit 1
+
+for COOK in "$@"; do
+    python3 - "$COOK" "$CKB" "$RUNS" <<'EOF'
+import subprocess, sys, time
+cook, ckb, runs = sys.argv[1], sys.argv[2], int(sys.argv[3])
+times = []
+for _ in range(runs):
+    t = time.perf_counter()
+    subprocess.run([cook, '-f', ckb, 'main'], check=True, stdout=subprocess.DEVNULL)
+    times.append(time.perf_counter() - t)
+times.sort()
+print('{:s}: {:s} best {:.3f}s median {:.3f}s'.format(cook, ckb, times[0], times[len(times) // 2]))
+EOF
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Measure how fast a cook launches the steps of its tasks.
+#
+# usage: bench/step_bench.sh [tasks] [cook binary ...]
+#
+# Runs one recipe of `tasks` tasks, each a pipeline of WIDTH no-op steps
+# (gen_cookbook.py --shape steps).  PAD unreferenced recipes make the cook
+# process bigger, which is what makes fork() per step expensive.  Reports the
+# best steps/second over RUNS runs.
+
+N=${1:-500}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- bin/cook
+RUNS=${RUNS:-3}
+WIDTH=${WIDTH:-4}
+PAD=${PAD:-50000}
+
+CKB=${TMPDIR:-/tmp}/step_bench_${N}_${WIDTH}_$PAD.ckb
+[ -f "$CKB" ] || python3 "$(dirname "$0")/gen_cookbook.py" --shape steps -n "$N" --width "$WIDTH" --pad "$PAD" -o "$CKB" || exit 1
+
+for COOK in "$@"; do
+    python3 - "$COOK" "$CKB" "$RUNS" "$((N * WIDTH))" <<'PYEOF'
+import subprocess, sys, time
+cook, ckb, runs, steps = sys.argv[1], sys.argv[2], int(sys.argv[3]), int(sys.argv[4])
+best = None
+for _ in range(runs):
+    t = time.perf_counter()
+    subprocess.run([cook, '-f', ckb, 'main'], check=True)
+    t = time.perf_counter() - t
+    best = t if best is None else min(best, t)
+print('{:s}: {:d} steps in {:.3f}s, {:.0f} steps/s'.format(cook, steps, best, steps / best))
+PYEOF
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Throughput of --workers with 1, 2 and 4 local workers against a local run
+# with the same total number of cooks.
+#
+# usage: bench/worker_bench.sh [recipes] [workers ...]
+#
+# Every worker gets CAP recipes at once, so N workers run with -c N*CAP.
+# Each recipe runs STEP (default "sleep 0.01"), so the numbers show how
+# dispatch over the sockets keeps up as workers are added.  Reports the best
+# makespan and recipes per second of each configuration.
+
+N=${1:-2000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- 1 2 4
+COOK=${COOK:-bin/cook}
+RUNS=${RUNS:-3}
+CAP=${CAP:-4}
+STEP=${STEP:-sleep 0.01}
+
+CKB=${TMPDIR:-/tmp}/worker_bench_$N.ckb
+python3 "$(dirname "$0")/gen_cookbook.py" --shape wide -n "$N" --step "$STEP" -o "$CKB" || exit 1
+
+python3 - "$COOK" "$CKB" "$N" "$RUNS" "$CAP" "$@" <<'PYEOF'
+import subprocess, sys, time
+cook, ckb, n, runs, cap = sys.argv[1], sys.argv[2], int(sys.argv[3]), int(sys.argv[4]), int(sys.argv[5])
+print('{:>10s} {:>5s} {:>12s} {:>12s}'.format('mode', '-c', 'makespan(s)', 'recipes/s'))
+for w in sys.argv[6:]:
+    c = str(int(w) * cap)
+    for name, args in (('local', ['--engine=epoll']), (w + ' worker', ['--workers=' + w])):
+        best = None
+        for _ in range(runs):
+            t = time.perf_counter()
+            subprocess.run([cook] + args + ['-c', c, '-f', ckb, 'main'], check=True)
+            t = time.perf_counter() - t
+            best = t if best is None else min(best, t)
+        print('{:>10s} {:>5s} {:>12.3f} {:>12.0f}'.format(name, c, best, (n + 1) / best))
+PYEOF
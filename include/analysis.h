@@ -0,0 +1,21 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "cookbook.h"
+
+/*
+ * parallel dependency analysis, used by perform_dependency_analysis when
+ * --threads is above 1. it computes what mark_required_recipes does: the
+ * required flag & pending_deps of every required recipe, required_order &
+ * num_required_recipes. the required set is found by a breadth-first search
+ * over this_depends_on, & required_order by peeling the required recipes off
+ * in topological levels (leaves first) over depend_on_this. each level is
+ * split among the threads once it is large enough to be worth it.
+ * required_order is topological either way, but it is in level order here &
+ * in depth-first postorder there. nothing after the analysis depends on which.
+ * a cycle or a missing sub-recipe is left to mark_required_recipes to report.
+ */
+
+int mark_required_parallel(RECIPE *main_recipe, int num_threads);
+
+#endif
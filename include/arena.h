@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator.  Memory is carved out of large chunks in allocation
+ * order and is never freed individually: arena_free releases everything
+ * allocated from an arena at once, along with any file mappings the arena
+ * has been given.  arena_reset does the same but keeps the chunks, which
+ * later allocations reuse before asking malloc for more.
+ * Allocations are zero-filled and aligned for any type.
+ */
+typedef struct arena_chunk {
+    struct arena_chunk *next;   // Chunk allocated before this one.
+    size_t size;                // Bytes of data.
+    char data[];
+} ARENA_CHUNK;
+
+typedef struct arena_mapping {
+    void *addr;
+    size_t len;
+    struct arena_mapping *next;
+} ARENA_MAPPING;
+
+typedef struct arena {
+    ARENA_CHUNK *chunks;        // Chunks in use, the current one first.
+    ARENA_CHUNK *spare;         // Chunks kept by arena_reset for reuse.
+    char *ptr;                  // Free space in the current chunk.
+    char *limit;
+    ARENA_MAPPING *mappings;    // To be unmapped by arena_free.
+} ARENA;
+
+void arena_init(ARENA *a);
+void *arena_alloc(ARENA *a, size_t size);
+char *arena_strndup(ARENA *a, const char *s, size_t n);
+int arena_adopt_mapping(ARENA *a, void *addr, size_t len);
+void arena_absorb(ARENA *a, ARENA *from);
+void arena_reset(ARENA *a);
+void arena_free(ARENA *a);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+/*
+ * words[0] -> executable path for every distinct command of the required recipes.
+ * filled once after dependency analysis, so steps are started without looking
+ * in util/ or walking PATH again. a command that was not found then is looked
+ * up again when a step needs it (see command_table_path), since an earlier
+ * recipe may install it. open addressing with linear probing, sized up front
+ * for the # of steps. the util/ directory is opened once (or when it first
+ * exists) & probed with faccessat. steps are started with posix_spawn, which has no execveat, so a
+ * command found there is executed by its util/ path.
+ */
+typedef struct command_entry
+{
+   const char *name;   // words[0] of a step (owned by the cookbook), NULL marks an empty slot
+   char *path;         // what to execute, or NULL if the command could not be found
+} COMMAND_ENTRY;
+
+typedef struct command_table
+{
+   COMMAND_ENTRY *slots;
+   unsigned int capacity;  // a power of two
+   int count;
+   int util_fd;            // util/ directory, or -1 if there is none
+} COMMAND_TABLE;
+
+int command_table_init(COMMAND_TABLE *table, int max_commands);
+int command_table_resolve(COMMAND_TABLE *table, const char *name, const char **path);
+COMMAND_ENTRY *command_table_lookup(COMMAND_TABLE *table, const char *name);
+const char *command_table_path(COMMAND_TABLE *table, const char *name);
+void command_table_free(COMMAND_TABLE *table);
+
+#endif
@@ -3,17 +3,84 @@
 
 #include <sys/types.h>
 #include "cookbook.h"
+#include "arena.h"
+
+
+// scheduler engine used by process_recipes
+typedef enum cook_engine {
+   ENGINE_SIGNAL,      // SIGCHLD handler + sigsuspend main loop
+   ENGINE_EPOLL        // pidfd + epoll event loop
+} COOK_ENGINE;
+
+// how a dispatched recipe's tasks are run
+typedef enum cook_exec {
+   EXEC_COOK,          // a forked cook process runs the tasks
+   EXEC_DIRECT         // the scheduler starts the steps itself (epoll engine only)
+} COOK_EXEC;
+
+// what to do once a failure has made the main recipe unreachable
+typedef enum cook_on_failure {
+   FAILURE_CONTINUE,       // keep dispatching every ready recipe & wait for all cooks
+   FAILURE_KEEP_GOING,     // dispatch nothing more & let the cooks in flight finish
+   FAILURE_FAIL_FAST       // dispatch nothing more & kill the cooks in flight
+} COOK_ON_FAILURE;
+
+// order in which ready recipes are dispatched
+typedef enum cook_schedule {
+   SCHEDULE_FIFO,          // leaf-discovery / completion order
+   SCHEDULE_CRITICAL_PATH, // longest remaining path to the main recipe first
+   SCHEDULE_HISTORY        // same, weighted by recorded wall times (--history)
+} COOK_SCHEDULE;
+
+// settings taken from the command line
+typedef struct cook_options {
+   char *cookbook_filename;
+   char **cookbook_files;  // every -f, when there are several, or NULL
+   int num_cookbook_files;
+   int threads;            // # of threads loading the cookbook files
+   int max_cooks;
+   char *main_recipe_name;
+   COOK_ENGINE engine;
+   COOK_EXEC exec;
+   COOK_ON_FAILURE on_failure;
+   COOK_SCHEDULE schedule;
+   char *history_filename; // per-recipe duration history, or NULL
+   char *cache_dir;        // result cache directory, or NULL
+   char *trace_filename;   // trace event output, or NULL
+   int stats;              // report per-recipe resource usage at exit
+   char *stats_filename;   // also write it to this CSV file, or NULL
+   int latency_report;     // print dispatch-latency percentiles at exit
+   int workers;            // # of worker processes to run recipes on, or 0 to run them here
+   char *daemon_socket;    // serve requests on this Unix socket, or NULL
+   char *connect_socket;   // forward the run to the daemon on this Unix socket, or NULL
+   char *compile_source;   // cookbook to compile into an image instead of running, or NULL
+   char *compile_output;   // the image to write, or NULL for compile_source + "c"
+} COOK_OPTIONS;
 
 
 void debug_print(COOKBOOK *cbp);
 
-void init_work_queue();
+void init_work_queue(COOK_SCHEDULE schedule);
+
+int load_history(const char *path);
 
-void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *max_cooks, char **main_recipe_name);
+void parse_command_line(int argc, char *argv[], COOK_OPTIONS *options);
+
+void free_options(COOK_OPTIONS *options);
+
+RECIPE *find_recipe_by_name(COOKBOOK *cbp, const char *name);
 
 int perform_dependency_analysis(COOKBOOK *cbp, const char *main_recipe_name);
 
-void process_recipes(COOKBOOK *cbp, int max_cooks);
+void process_recipes(COOKBOOK *cbp, COOK_OPTIONS *options);
+
+COOKBOOK *load_cookbook(const char *filename, ARENA *arena);
+
+COOKBOOK *load_cookbooks(COOK_OPTIONS *options, ARENA *arena);
+
+void run_cookbook(COOKBOOK *cbp, COOK_OPTIONS *options);
+
+int reset_recipe_states(COOKBOOK *cbp);
 
 void cleanup(COOKBOOK *cbp);
 
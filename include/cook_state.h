@@ -0,0 +1,85 @@
+#ifndef COOK_STATE_H
+#define COOK_STATE_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include "cookbook.h"
+#include "cook.h"
+
+/*
+ * scheduler state shared between cook.c & the alternative engines.
+ */
+
+// structure to hold the state of each recipe
+typedef struct recipe_state {
+   int required;       // indicates if the recipe is required for the main recipe
+   int processing;     // indicates if processing has started for this recipe
+   int completed;      // indicates if the recipe has been completed successfully
+   int failed;         // indicates if the recipe has failed
+   int blocked;        // indicates that a sub-recipe failed, so this recipe can never run
+   int pending_deps;   // # of dependency links whose sub-recipe has not completed yet
+   int unsorted_deps;  // # of dependency links whose sub-recipe is not in required_order yet (mark_required_parallel only)
+   long weight;        // estimated cost of the recipe, used to compute priority
+   long priority;      // dispatch priority under --schedule=critical-path|history (longest path to the main recipe)
+   long start_us;      // monotonic time the cook was started
+   long duration_us;   // wall time of the cook, set when it completes successfully
+   pid_t pid;          // process ID of the cook process handling this recipe
+   pid_t pgid;         // process group of the cook, or of the current task's steps (fail-fast only)
+   int pidfd;          // pidfd of the cook process (epoll engine only)
+   struct recipe *next_blocked; // link in the worklist used by block_dependents
+   int visiting;       // on the path being explored by mark_required_recipes
+   struct task *task;  // next task to start (direct exec only)
+   int live_steps;     // # of steps of the current task not reaped yet (direct exec only)
+   int task_failed;    // a step of the current task failed (direct exec only)
+   uint64_t fingerprint[2]; // result cache key, taken when the recipe is dequeued (--cache only)
+   int cached;         // completed from the result cache without running
+   int job;            // id of the recipe in RUN & DONE messages (--workers only)
+   int worker;         // worker running the recipe, or -1 (--workers only)
+   int lane;           // cook lane of the recipe while it runs (--trace only)
+   struct recipe_usage *usage; // resource usage totals, shared with the cook (--stats only)
+   long ready_ns;      // when the recipe was last enqueued (--latency-report only)
+   long dispatch_ns;   // when it was dispatched (--latency-report only)
+   long reaped_ns;     // when its completion was taken up (--latency-report only)
+   long *exit_ns;      // where its cook stores its exit time, shared with the cook (--latency-report only)
+} RECIPE_STATE;
+
+extern COOKBOOK *cookbook_global;
+extern const char *main_recipe_name_global;
+extern int active_cooks;     // # of active cook processes
+extern int max_cooks_global; // max cooks allowed
+extern COOK_ON_FAILURE on_failure_global;
+extern RECIPE **required_recipes; // every required recipe, in cookbook order
+extern RECIPE **required_order;   // every required recipe, sub-recipes first
+extern int num_required_recipes;
+extern int analysis_threads_global; // threads of the dependency analysis, 1 for the serial one
+
+void enqueue_recipe(RECIPE *recipe);
+RECIPE *dequeue_recipe();
+RECIPE *dequeue_recipe_to_run();
+int is_work_queue_empty();
+
+void begin_recipe(RECIPE *recipe, pid_t pid);
+pid_t start_cook(RECIPE *recipe, const sigset_t *child_mask);
+void process_recipe(RECIPE *recipe);
+void complete_recipe(RECIPE *recipe, int failed);
+int main_recipe_status(COOKBOOK *cbp);
+int may_dispatch();
+int cancel_in_flight();
+int fail_fast_cancelled();
+
+int count_steps(TASK *task);
+int execute_task(TASK *task);
+int start_task(TASK *task, int num_steps, pid_t *child_pids, int *pipe_fds, pid_t *pgid);
+
+// event_loop.c
+void run_event_loop(COOKBOOK *cbp, int direct);
+int watch_process(int epfd, pid_t pid, void *ptr);
+int reap_process(int epfd, pid_t pid, int pidfd, struct rusage *usage);
+int process_failed(int status);
+
+// coordinator.c
+void run_coordinator(COOKBOOK *cbp, int num_workers, int capacity);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef COOKBOOK_IMAGE_H
+#define COOKBOOK_IMAGE_H
+
+#include <stdint.h>
+#include "cookbook.h"
+#include "arena.h"
+
+/*
+ * Compiled cookbook images (cook --compile in.ckb -o out.ckbc).
+ *
+ * An image holds a parsed & linked cookbook as the RECIPE, TASK, STEP and
+ * RECIPE_LINK structures of cookbook.h, laid out in arrays, with every pointer
+ * field stored as an offset from the start of the image (0 for NULL).  It is
+ * position-independent: loading maps it privately and adds the mapping's
+ * address to each pointer field, in one pass over the arrays and without
+ * allocating anything per recipe.  The string table, the CSR dependency edges
+ * and the topological order are never written to, so their pages stay shared
+ * with the page cache.
+ *
+ * A dependency cycle is only an error once a run needs the recipes on it, so
+ * a cookbook with one still compiles; the recipes on or behind the cycle are
+ * left out of the topological order.  If the order holds every recipe and
+ * exactly one recipe has no dependents, that recipe is the image's root: it
+ * needs every other recipe, and a run of it takes its required set and order
+ * from the image (see cookbook_image_closure).
+ *
+ * The image remembers the size and modification time of the source it was
+ * compiled from.  An image whose source has changed since is refused.
+ * Images are specific to the word size and structure layout of the compiler.
+ */
+
+#define COOKBOOK_IMAGE_MAGIC "CKBC"
+#define COOKBOOK_IMAGE_VERSION 3
+
+typedef struct cookbook_image_header {
+    char magic[4];              // COOKBOOK_IMAGE_MAGIC
+    uint32_t version;           // COOKBOOK_IMAGE_VERSION
+    uint32_t layout;            // sizes of the structures, to reject foreign images
+    uint32_t pad;
+    uint64_t image_size;
+    uint64_t source_size;       // the .ckb compiled into this image
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_path;       // offset of its absolute path
+    uint64_t num_recipes, num_tasks, num_steps, num_words, num_links;
+    uint64_t recipes, tasks, steps, words, links;   // offsets of the structure arrays
+    uint64_t index, index_capacity, index_count;    // name index slots, as in recipe_index.h
+    uint64_t num_deps;          // dependency edges, one per this_depends_on link
+    uint64_t dep_start, deps;   // recipe i depends on deps[dep_start[i] .. dep_start[i + 1])
+    uint64_t rdep_start, rdeps; // the recipes that depend on recipe i, likewise
+    uint64_t topo, num_topo;    // recipes, each after the ones it depends on
+    uint64_t root;              // 1 + the recipe that needs all others, or 0
+    uint64_t strings, strings_size;
+} COOKBOOK_IMAGE_HEADER;
+
+int cookbook_image_write(COOKBOOK *cbp, const char *source_path, const char *image_path);
+int cookbook_image_is_image(const char *path);
+COOKBOOK *cookbook_image_load(const char *path, ARENA *arena, int *errp);
+uint64_t cookbook_image_closure(COOKBOOK *cbp, RECIPE *recipe, const uint32_t **topo, const uint32_t **dep_start);
+
+#endif
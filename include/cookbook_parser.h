@@ -0,0 +1,59 @@
+#ifndef COOKBOOK_PARSER_H
+#define COOKBOOK_PARSER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "cookbook.h"
+#include "arena.h"
+
+/*
+ * State of a parse.  The input is either a stream, from which tokens are
+ * read into malloc'ed strings, or a writable buffer, in which case tokens
+ * are used in place and everything is allocated from an arena.
+ *
+ * The parser keeps nothing outside of this structure, so any number of
+ * cookbooks can be parsed at once, on as many threads, provided that each
+ * parse has its own COOKBOOK_PARSER and, for a buffer, its own arena.
+ * Set one up with cookbook_parser_init_stream or cookbook_parser_init_buffer,
+ * then optionally set name & errors, then call cookbook_parser_parse.
+ */
+typedef struct cookbook_parser {
+    FILE *in;                   // Stream being parsed, or NULL.
+    char *pos;                  // Unread part of the buffer being parsed.
+    char *end;
+    int held;                   // Character pushed back into the buffer, or EOF.
+    int eof;                    // Whether the end of the buffer has been read.
+    ARENA *arena;               // Arena for a buffer parse, NULL for a stream.
+    char **words;               // Words of the step being parsed.
+    size_t words_size;
+    char *text;                 // Characters of the escaped token being scanned.
+    size_t text_size;
+    char *peek_token;
+    int lineno;
+    const char *name;           // Prefix for diagnostics, e.g. a filename, or NULL.
+    FILE *errors;               // Stream diagnostics go to, stderr if NULL.
+    int defer_links;            // Leave the dependencies unresolved, to link several at once.
+    int *lines;                 // With defer_links, the line of each recipe header,
+    size_t lines_size;          // malloc'ed & left to the caller to free.
+    int num_recipes;
+} COOKBOOK_PARSER;
+
+void cookbook_parser_init_stream(COOKBOOK_PARSER *p, FILE *in);
+void cookbook_parser_init_buffer(COOKBOOK_PARSER *p, char *buf, size_t len, ARENA *arena);
+COOKBOOK *cookbook_parser_parse(COOKBOOK_PARSER *p, int *errp);
+
+/*
+ * Parsing entry points besides parse_cookbook, which leave the cookbook in
+ * an arena instead of allocating each part of it separately.
+ */
+COOKBOOK *parse_cookbook_buffer(char *buf, size_t len, ARENA *arena, int *errp);
+COOKBOOK *parse_cookbook_file(const char *path, ARENA *arena, int *errp);
+COOKBOOK *parse_cookbook_files(char *const paths[], int n, int nthreads, ARENA *arena, int *errp);
+
+/*
+ * Free a cookbook returned by any of the parsers or by cookbook_image_load.
+ * Recipe states & anything else hung off the recipes must be freed first.
+ */
+void free_cookbook(COOKBOOK *cbp);
+
+#endif
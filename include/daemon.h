@@ -0,0 +1,23 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "cookbook.h"
+#include "cook.h"
+
+/*
+ * cook daemon (--daemon=socket) & its client (--connect=socket).
+ * requests are frames as in worker.h on a Unix stream socket:
+ *
+ *   REQUEST  client -> daemon   argc & envc (4 bytes each, network order), then
+ *                               the working directory, argv & the environment
+ *                               as NUL-terminated strings. the client's stdin,
+ *                               stdout & stderr are passed along as SCM_RIGHTS
+ *   STATUS   daemon -> client   exit status of the run (4 bytes)
+ */
+#define MSG_REQUEST 4
+#define MSG_STATUS  5
+
+int daemon_main(COOKBOOK *cbp, COOK_OPTIONS *options);
+int client_main(const char *socket_path, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include "cookbook.h"
+
+/*
+ * per-recipe wall time history, persisted between runs (--history=FILE).
+ * records are keyed by a hash of the recipe name & validated by a hash of its
+ * tasks, so editing a recipe's tasks invalidates its old duration.
+ * the file is a small header followed by fixed-size records sorted by name hash.
+ * it is read once before dependency analysis & written once after the last
+ * cook has been reaped, so recording adds nothing to the dispatch path.
+ */
+typedef struct history_record
+{
+   uint64_t name_hash;
+   uint64_t tasks_hash;
+   uint64_t duration_us;   // smoothed wall time of a successful cook
+} HISTORY_RECORD;
+
+typedef struct history
+{
+   HISTORY_RECORD *records;
+   int count;
+   int sorted;             // records[0 .. sorted) are ordered by name_hash
+   int capacity;
+} HISTORY;
+
+int history_load(HISTORY *history, const char *path);
+long history_lookup(HISTORY *history, RECIPE *recipe);
+int history_record(HISTORY *history, RECIPE *recipe, long duration_us);
+int history_save(HISTORY *history, const char *path);
+void history_free(HISTORY *history);
+
+#endif
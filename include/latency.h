@@ -0,0 +1,42 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include "cookbook.h"
+
+/*
+ * dispatch-latency histograms (--latency-report).
+ * four latencies of the scheduler are recorded, in nanoseconds:
+ *   ready->dispatch   a recipe entered the work queue .. its cook is forked
+ *   fork->exec        its cook was forked .. the first step was exec'd
+ *   exit->reap        the cook exited .. the scheduler took up its completion
+ *   reap->enqueue     .. & enqueued a dependent, once per dependent
+ * with --exec=direct "fork" is the dispatch, & there is no exit->reap.
+ * --workers only has ready->dispatch & reap->enqueue.
+ * the histograms are log-linear like HDR histograms: 16 buckets per power of
+ * two, so a percentile is off by at most 1/16. they are in memory shared with
+ * the cooks, which record fork->exec & store their exit time in a per-recipe
+ * slot. recording is a clock read & a few atomic adds, with no allocation, so
+ * it is safe in the SIGCHLD handler & from several cooks at once.
+ */
+
+typedef enum latency_kind {
+   LATENCY_READY_DISPATCH,
+   LATENCY_FORK_EXEC,
+   LATENCY_EXIT_REAP,
+   LATENCY_REAP_ENQUEUE,
+   NUM_LATENCIES
+} LATENCY_KIND;
+
+int latency_open();
+int latency_track(RECIPE **recipes, int count);
+long latency_now();
+void latency_record(LATENCY_KIND kind, long since_ns);
+void latency_dispatch(RECIPE *recipe);
+void latency_expect_exec(RECIPE *recipe);
+void latency_exec();
+void latency_cook_exit(RECIPE *recipe);
+void latency_reaped(RECIPE *recipe);
+void latency_report(FILE *out);
+
+#endif
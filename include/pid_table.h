@@ -0,0 +1,34 @@
+#ifndef PID_TABLE_H
+#define PID_TABLE_H
+
+#include <sys/types.h>
+#include "cookbook.h"
+
+/*
+ * fixed-capacity pid -> recipe table for the reaping path.
+ * open addressing with linear probing & backward-shift deletion (no tombstones),
+ * so lookups of live & stray pids both finish in a short probe run.
+ * all storage is allocated up front by pid_table_init. insert/remove/lookup
+ * never allocate & are async-signal-safe.
+ */
+typedef struct pid_entry
+{
+   pid_t pid;          // 0 marks an empty slot
+   RECIPE *recipe;
+} PID_ENTRY;
+
+typedef struct pid_table
+{
+   PID_ENTRY *slots;
+   unsigned int bits;  // capacity is 1 << bits
+   int count;
+   int max_entries;    // number of entries the table was sized for
+} PID_TABLE;
+
+int pid_table_init(PID_TABLE *table, int max_entries);
+int pid_table_insert(PID_TABLE *table, pid_t pid, RECIPE *recipe);
+RECIPE *pid_table_lookup(PID_TABLE *table, pid_t pid);
+RECIPE *pid_table_remove(PID_TABLE *table, pid_t pid);
+void pid_table_free(PID_TABLE *table);
+
+#endif
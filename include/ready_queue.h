@@ -0,0 +1,42 @@
+#ifndef READY_QUEUE_H
+#define READY_QUEUE_H
+
+#include "cookbook.h"
+
+/*
+ * ordering hook for the ready queue.
+ * returns < 0 if a should be dispatched before b, > 0 if after, 0 if they tie.
+ * ties are dispatched in enqueue order.
+ */
+typedef int (*READY_QUEUE_ORDER)(RECIPE *a, RECIPE *b);
+
+typedef struct ready_entry
+{
+   RECIPE *recipe;
+   unsigned long seq;  // enqueue sequence number, breaks ties between equal recipes
+} READY_ENTRY;
+
+/*
+ * bounded queue of recipes that are ready to be dispatched.
+ * all storage is allocated by ready_queue_init, so push & pop never allocate
+ * (they are called from the SIGCHLD handler).
+ * with a NULL ordering hook the queue is a FIFO ring buffer.
+ * with a hook it is a binary min-heap over the same slots.
+ */
+typedef struct ready_queue
+{
+   READY_ENTRY *slots;
+   int capacity;
+   int head;           // index of the oldest entry (FIFO mode only)
+   int count;
+   unsigned long next_seq;
+   READY_QUEUE_ORDER order;
+} READY_QUEUE;
+
+int ready_queue_init(READY_QUEUE *queue, int capacity, READY_QUEUE_ORDER order);
+int ready_queue_push(READY_QUEUE *queue, RECIPE *recipe);
+RECIPE *ready_queue_pop(READY_QUEUE *queue);
+RECIPE *ready_queue_at(READY_QUEUE *queue, int i);
+void ready_queue_free(READY_QUEUE *queue);
+
+#endif
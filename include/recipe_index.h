@@ -0,0 +1,42 @@
+#ifndef RECIPE_INDEX_H
+#define RECIPE_INDEX_H
+
+#include <stddef.h>
+#include "cookbook.h"
+#include "arena.h"
+
+/*
+ * A name -> recipe index for a cookbook, implemented as an open-addressing
+ * hash table with linear probing.  The capacity is always a power of two and
+ * at least twice the number of recipes, so probe sequences stay short.
+ * If a cookbook contains several recipes with the same name, the index
+ * resolves the name to the first one, just like a linear search would.
+ */
+typedef struct recipe_index {
+    RECIPE **slots;             // Hash table slots (NULL means empty).
+    size_t capacity;            // Number of slots (a power of two).
+    size_t count;               // Number of distinct names in the index.
+} RECIPE_INDEX;
+
+/*
+ * Cookbook-wide state, hung off the "state" field of a COOKBOOK.
+ */
+typedef struct cookbook_state {
+    RECIPE_INDEX index;         // Name -> recipe lookup table.
+    const struct cookbook_image_header *image;  // Image the cookbook is mapped from, or NULL.
+    ARENA *arena;               // Arena holding the whole cookbook, or NULL if malloc'ed.
+} COOKBOOK_STATE;
+
+unsigned long hash_name(const char *name);
+
+int recipe_index_build(RECIPE_INDEX *idx, RECIPE *recipes, ARENA *arena);
+RECIPE *recipe_index_lookup(RECIPE_INDEX *idx, const char *name);
+void recipe_index_free(RECIPE_INDEX *idx);
+
+/*
+ * Look up a recipe by name, building the cookbook's index on first use.
+ * Returns NULL if there is no such recipe.
+ */
+RECIPE *cookbook_find_recipe(COOKBOOK *cbp, const char *name);
+
+#endif
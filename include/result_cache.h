@@ -0,0 +1,24 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "cookbook.h"
+
+/*
+ * content-addressed result cache for incremental runs (--cache=DIR).
+ * a recipe's fingerprint covers its task words & redirections, the contents of
+ * its input files & the fingerprints of the recipes it depends on. it is taken
+ * when the recipe is dequeued, after all of its sub-recipes have completed.
+ *
+ * DIR/entries/<fingerprint> lists the content hash & path of every output file
+ * of a successful run. DIR/objects/<content hash> holds the contents.
+ * a recipe whose entry exists & whose outputs are present & unchanged, or can
+ * be restored from the objects, is completed without being run. a recipe
+ * without output files gets no entry, as its side effects can't be restored.
+ */
+
+int result_cache_open(const char *dir);
+int result_cache_restore(RECIPE *recipe);
+int result_cache_store(RECIPE *recipe);
+void result_cache_report(FILE *out);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "cookbook.h"
+#include "history.h"
+
+/*
+ * dispatch priorities for --schedule=critical-path|history.
+ * during dependency analysis every required recipe first gets a weight, either
+ * structural (its step count) or its recorded wall time. compute_critical_path
+ * then stores each required recipe's longest weighted path to the main recipe
+ * in its state. critical_path_order is the ready queue hook that dispatches by
+ * that value.
+ */
+
+long recipe_weight(RECIPE *recipe);
+void assign_structural_weights(RECIPE **order, int num_required);
+void assign_history_weights(RECIPE **order, int num_required, HISTORY *history);
+void compute_critical_path(RECIPE **order, int num_required);
+int critical_path_order(RECIPE *a, RECIPE *b);
+
+#endif
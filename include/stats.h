@@ -0,0 +1,43 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include "cookbook.h"
+
+/*
+ * per-recipe resource usage (--stats[=file.csv]).
+ * every reap of a step goes through wait4, & its rusage is added to the
+ * recipe's totals: user & system CPU, the largest max RSS, page faults &
+ * context switches. the totals of all required recipes are in one shared
+ * anonymous mapping made before the first cook is forked, so a cook adds its
+ * steps' usage in place & the scheduler reads it once the cook is reaped.
+ * the scheduler reaps the cook itself with wait4 too. the kernel folds the
+ * steps the cook waited for into that, so the rest is the cook's own CPU.
+ * at exit the recipes are listed by the CPU time of their steps, along with
+ * how much of their wall time that was, to tell CPU-bound recipes from those
+ * waiting on I/O or on their steps' children.
+ */
+
+typedef struct recipe_usage {
+   long user_us;       // user CPU time of the steps
+   long sys_us;        // system CPU time of the steps
+   long maxrss_kb;     // largest max RSS of any step
+   long minflt;        // page faults of the steps not needing I/O
+   long majflt;        // ... & needing I/O
+   long nvcsw;         // voluntary context switches of the steps (waiting)
+   long nivcsw;        // involuntary context switches of the steps (preempted)
+   int steps;          // # of steps reaped
+   long cook_us;       // CPU time of the cook process itself (cook exec only)
+   long wall_us;       // dispatch to completion
+   int ran;            // the recipe was dispatched & has completed
+} RECIPE_USAGE;
+
+int stats_init(RECIPE **recipes, int count, const char *path);
+void stats_step_reaped(RECIPE *recipe, const struct rusage *ru);
+void stats_cook_reaped(RECIPE *recipe, const struct rusage *ru);
+void stats_complete(RECIPE *recipe, long wall_us);
+void stats_enter_cook(RECIPE *recipe);
+int stats_report(FILE *out);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+#include "cookbook.h"
+
+/*
+ * event trace of a run (--trace=file), in the JSON array format of the Chrome
+ * trace viewer & Perfetto. the scheduler is lane 0. every dispatched recipe
+ * gets the lowest free cook lane for as long as it runs, & everything about it
+ * (dispatch to completion, its tasks, the exec & exit of each step) goes on
+ * that lane, so the trace opens as one swimlane per cook slot.
+ *
+ * events are kept in a fixed buffer & only formatted when it is written out:
+ * when it fills, when a cook exits & at the end of the run. recording one is
+ * a clock read & a few stores. the file is opened O_APPEND & every write holds
+ * whole events, so the scheduler & its cooks share it without locking.
+ */
+
+typedef enum trace_kind {
+   TRACE_QUEUE,        // a recipe entered the work queue
+   TRACE_DISPATCH,     // a recipe was dispatched to a cook lane
+   TRACE_COMPLETE,     // ... & is done
+   TRACE_TASK_BEGIN,   // a task started its steps
+   TRACE_TASK_END,     // ... & all of them have been reaped
+   TRACE_STEP_EXEC,    // a step was started
+   TRACE_STEP_EXIT     // ... & reaped
+} TRACE_KIND;
+
+#define TRACE_SCHEDULER 0   // lane of the scheduler's own events
+#define TRACE_THIS_COOK -1  // lane of the recipe this cook process runs
+
+int trace_open(const char *path);
+void trace_close();
+void trace_event(TRACE_KIND kind, int lane, const char *name, long id, long arg);
+void trace_dispatch(RECIPE *recipe);
+void trace_complete(RECIPE *recipe, int failed);
+void trace_steps_started(TASK *task, pid_t *pids, int lane);
+void trace_step_exit(STEP *step, pid_t pid, int status, int lane);
+void trace_enter_cook(RECIPE *recipe);
+void trace_detach();
+void trace_flush();
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cookbook.h"
+
+/*
+ * coordinator <-> worker protocol (--workers=N).
+ * the coordinator keeps the cookbook & all scheduling state. a worker only
+ * ever sees the tasks of the recipes it is asked to run, so it can live on
+ * any machine that shares the working directory. messages are frames on a
+ * stream socket: a 4-byte length (network order) of the rest of the frame,
+ * a 1-byte type & the body.
+ *
+ *   HELLO  worker -> coordinator   capacity (4 bytes): # of recipes it runs at once
+ *   RUN    coordinator -> worker   job (4 bytes), then the recipe's tasks
+ *   DONE   worker -> coordinator   job (4 bytes), failed (1 byte)
+ *
+ * the tasks of a RUN are a sequence of tagged, NUL-terminated strings:
+ * 'T' starts a task, 'S' starts a step of the current task, 'W' is a word of
+ * the current step & '<' / '>' are the task's redirections.
+ */
+#define MSG_HELLO 1
+#define MSG_RUN   2
+#define MSG_DONE  3
+
+#define MSG_MAX_LEN (64 * 1024 * 1024) // frames claiming more are treated as a broken peer
+
+// receive side of a connection. frames are read into buf & handed out in place
+typedef struct conn
+{
+   int fd;
+   char *buf;
+   size_t len;         // bytes in buf
+   size_t off;         // bytes of buf already handed out by conn_next
+   size_t cap;
+} CONN;
+
+int conn_init(CONN *conn, int fd);
+int conn_fill(CONN *conn);
+int conn_next(CONN *conn, int *type, char **body, size_t *len);
+void conn_free(CONN *conn);
+int send_message(int fd, int type, const void *body, size_t len);
+
+int encode_recipe(RECIPE *recipe, uint32_t job, char **body, size_t *len);
+int decode_job(const char *body, size_t len, uint32_t *job);
+int decode_tasks(char *body, size_t len, TASK **tasks);
+
+int worker_main(int fd, int capacity);
+
+#endif
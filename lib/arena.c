@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define ARENA_ALIGN 16
+
+void arena_init(ARENA *a) {
+    memset(a, 0, sizeof(*a));
+}
+
+/*
+ * Allocate size zero-filled bytes from an arena.
+ * Returns NULL if memory could not be allocated.
+ */
+void *arena_alloc(ARENA *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if(size > (size_t)(a->limit - a->ptr)) {
+	// Start a new chunk.  Oversized requests get a chunk to themselves,
+	// which goes behind the current one so its free space is not lost.
+	size_t data = size > ARENA_CHUNK_SIZE / 4 ? size : ARENA_CHUNK_SIZE;
+	ARENA_CHUNK *chunk = a->spare;
+	if(data == ARENA_CHUNK_SIZE && chunk != NULL) {
+	    a->spare = chunk->next;
+	    memset(chunk->data, 0, data);
+	} else {
+	    chunk = calloc(1, sizeof(ARENA_CHUNK) + data);
+	    if(chunk == NULL)
+		return NULL;
+	    chunk->size = data;
+	}
+	if(data != ARENA_CHUNK_SIZE && a->chunks != NULL) {
+	    chunk->next = a->chunks->next;
+	    a->chunks->next = chunk;
+	    return chunk->data;
+	}
+	chunk->next = a->chunks;
+	a->chunks = chunk;
+	a->ptr = chunk->data;
+	a->limit = chunk->data + data;
+    }
+    void *p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+/*
+ * Copy n bytes of s into an arena as a NUL-terminated string.
+ */
+char *arena_strndup(ARENA *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    if(p != NULL)
+	memcpy(p, s, n);
+    return p;
+}
+
+/*
+ * Make a file mapping part of an arena, so that it is unmapped by arena_free.
+ * Returns 0 on success, -1 if memory could not be allocated.
+ */
+int arena_adopt_mapping(ARENA *a, void *addr, size_t len) {
+    ARENA_MAPPING *m = arena_alloc(a, sizeof(ARENA_MAPPING));
+    if(m == NULL)
+	return -1;
+    m->addr = addr;
+    m->len = len;
+    m->next = a->mappings;
+    a->mappings = m;
+    return 0;
+}
+
+/*
+ * Move everything allocated from, or given to, the arena from into a, so
+ * that it lives as long as a does.  from is left empty.  The chunks of from
+ * go behind the current chunk of a, which is the one allocation goes on in.
+ */
+void arena_absorb(ARENA *a, ARENA *from) {
+    if(a->chunks == NULL) {
+	a->chunks = from->chunks;
+	a->ptr = from->ptr;
+	a->limit = from->limit;
+    } else if(from->chunks != NULL) {
+	ARENA_CHUNK *last = from->chunks;
+	while(last->next != NULL)
+	    last = last->next;
+	last->next = a->chunks->next;
+	a->chunks->next = from->chunks;
+    }
+    ARENA_CHUNK **spare = &a->spare;
+    while(*spare != NULL)
+	spare = &(*spare)->next;
+    *spare = from->spare;
+    ARENA_MAPPING **mapping = &a->mappings;
+    while(*mapping != NULL)
+	mapping = &(*mapping)->next;
+    *mapping = from->mappings;
+    arena_init(from);
+}
+
+/*
+ * Release everything allocated from an arena, but keep its chunks of the
+ * standard size for the allocations that follow.
+ */
+void arena_reset(ARENA *a) {
+    // The mapping records live in the chunks, so unmap first.
+    for(ARENA_MAPPING *m = a->mappings; m != NULL; m = m->next)
+	munmap(m->addr, m->len);
+    a->mappings = NULL;
+    ARENA_CHUNK *chunk = a->chunks;
+    while(chunk != NULL) {
+	ARENA_CHUNK *next = chunk->next;
+	if(chunk->size == ARENA_CHUNK_SIZE) {
+	    chunk->next = a->spare;
+	    a->spare = chunk;
+	} else {
+	    free(chunk);
+	}
+	chunk = next;
+    }
+    a->chunks = NULL;
+    a->ptr = a->limit = NULL;
+}
+
+/*
+ * Release everything allocated from an arena, and its memory.  The arena
+ * is left empty and can be used again.
+ */
+void arena_free(ARENA *a) {
+    arena_reset(a);
+    ARENA_CHUNK *chunk = a->spare;
+    while(chunk != NULL) {
+	ARENA_CHUNK *next = chunk->next;
+	free(chunk);
+	chunk = next;
+    }
+    arena_init(a);
+}
@@ -0,0 +1,543 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cookbook.h"
+#include "cookbook_image.h"
+#include "recipe_index.h"
+#include "debug.h"
+
+#define IMAGE_LAYOUT ((uint32_t)(sizeof(void *) << 24 | sizeof(RECIPE) << 16 | sizeof(TASK) << 8 | sizeof(RECIPE_LINK)))
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+/*
+ * A recipe pointer and its position in the cookbook, sorted by pointer so the
+ * position of a linked recipe can be found by binary search.
+ */
+typedef struct recipe_pos {
+    RECIPE *recipe;
+    uint32_t pos;
+} RECIPE_POS;
+
+static int compare_recipe_pos(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)((const RECIPE_POS *)a)->recipe;
+    uintptr_t pb = (uintptr_t)((const RECIPE_POS *)b)->recipe;
+    return (pa > pb) - (pa < pb);
+}
+
+static uint32_t recipe_pos(RECIPE_POS *sorted, size_t n, RECIPE *rp) {
+    RECIPE_POS key = { rp, 0 };
+    RECIPE_POS *found = bsearch(&key, sorted, n, sizeof(RECIPE_POS), compare_recipe_pos);
+    return found->pos;
+}
+
+/*
+ * The string table under construction.  Strings are appended with their
+ * terminating NUL and referred to by their offset in the table.
+ */
+typedef struct strtab {
+    char *buf;
+    size_t len, cap;
+    int failed;                 // Set once memory could not be allocated.
+} STRTAB;
+
+static uint64_t strtab_add(STRTAB *st, const char *s) {
+    size_t n = strlen(s) + 1;
+    if(st->len + n > st->cap) {
+	size_t cap = st->cap ? st->cap : 4096;
+	while(cap < st->len + n)
+	    cap *= 2;
+	char *buf = realloc(st->buf, cap);
+	if(buf == NULL) {
+	    st->failed = 1;
+	    return 0;
+	}
+	st->buf = buf;
+	st->cap = cap;
+    }
+    memcpy(st->buf + st->len, s, n);
+    st->len += n;
+    return st->len - n;
+}
+
+/*
+ * Compute a topological order of the recipes from their dependency edges in
+ * CSR form: recipe i depends on deps[dep_start[i] .. dep_start[i + 1]), & the
+ * recipes depending on recipe i are rdeps[rdep_start[i] .. rdep_start[i + 1]).
+ * Every recipe comes after the ones it depends on, ties in cookbook order.
+ * The recipes on a cycle, & those depending on one, never become ready & are
+ * left out.
+ * Returns the # of recipes in topo, or -1 if memory could not be allocated.
+ */
+static int64_t topological_order(uint64_t n, const uint32_t *dep_start, const uint32_t *rdep_start,
+				 const uint32_t *rdeps, uint32_t *topo) {
+    uint32_t *pending = malloc((n + 1) * sizeof(uint32_t));
+    if(pending == NULL)
+	return -1;
+    uint64_t tail = 0;
+    for(uint64_t i = 0; i < n; i++) {
+	pending[i] = dep_start[i + 1] - dep_start[i];
+	if(pending[i] == 0)
+	    topo[tail++] = i;
+    }
+    for(uint64_t head = 0; head < tail; head++) {
+	uint32_t r = topo[head];
+	for(uint32_t e = rdep_start[r]; e < rdep_start[r + 1]; e++) {
+	    if(--pending[rdeps[e]] == 0)
+		topo[tail++] = rdeps[e];
+	}
+    }
+    free(pending);
+    return tail;
+}
+
+/*
+ * Compile a parsed & linked cookbook into an image at image_path.
+ * The image is written to a temporary file that is renamed into place.
+ * Returns 0 on success, -1 on error (reported on stderr).
+ */
+int cookbook_image_write(COOKBOOK *cbp, const char *source_path, const char *image_path) {
+    struct stat st;
+    char source_real[PATH_MAX];
+    if(stat(source_path, &st) == -1 || realpath(source_path, source_real) == NULL) {
+	perror(source_path);
+	return -1;
+    }
+
+    // Count everything, so each section can be laid out at a fixed offset.
+    uint64_t n = 0, num_tasks = 0, num_steps = 0, num_words = 0, num_links = 0, num_deps = 0;
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next) {
+	n++;
+	for(RECIPE_LINK *link = rp->this_depends_on; link != NULL; link = link->next) {
+	    num_links++;
+	    num_deps++;
+	}
+	for(RECIPE_LINK *link = rp->depend_on_this; link != NULL; link = link->next)
+	    num_links++;
+	for(TASK *task = rp->tasks; task != NULL; task = task->next) {
+	    num_tasks++;
+	    for(STEP *step = task->steps; step != NULL; step = step->next) {
+		num_steps++;
+		for(char **word = step->words; *word != NULL; word++)
+		    num_words++;
+		num_words++;    // The NULL that ends the step's words.
+	    }
+	}
+    }
+    uint64_t cap = 16;
+    while(cap < 2 * n)
+	cap *= 2;
+
+    COOKBOOK_IMAGE_HEADER h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, COOKBOOK_IMAGE_MAGIC, sizeof(h.magic));
+    h.version = COOKBOOK_IMAGE_VERSION;
+    h.layout = IMAGE_LAYOUT;
+    h.source_size = st.st_size;
+    h.source_mtime_sec = st.st_mtim.tv_sec;
+    h.source_mtime_nsec = st.st_mtim.tv_nsec;
+    h.num_recipes = n;
+    h.num_tasks = num_tasks;
+    h.num_steps = num_steps;
+    h.num_words = num_words;
+    h.num_links = num_links;
+    h.index_capacity = cap;
+
+    uint64_t off = ALIGN8(sizeof(h));
+    h.recipes = off;     off = ALIGN8(off + n * sizeof(RECIPE));
+    h.tasks = off;       off = ALIGN8(off + num_tasks * sizeof(TASK));
+    h.steps = off;       off = ALIGN8(off + num_steps * sizeof(STEP));
+    h.links = off;       off = ALIGN8(off + num_links * sizeof(RECIPE_LINK));
+    h.words = off;       off = ALIGN8(off + num_words * sizeof(char *));
+    h.index = off;       off = ALIGN8(off + cap * sizeof(RECIPE *));
+    h.num_deps = num_deps;
+    h.dep_start = off;   off = ALIGN8(off + (n + 1) * sizeof(uint32_t));
+    h.deps = off;        off = ALIGN8(off + num_deps * sizeof(uint32_t));
+    h.rdep_start = off;  off = ALIGN8(off + (n + 1) * sizeof(uint32_t));
+    h.rdeps = off;       off = ALIGN8(off + num_deps * sizeof(uint32_t));
+    h.topo = off;        off = ALIGN8(off + n * sizeof(uint32_t));
+    h.strings = off;
+
+    char *image = calloc(1, off);
+    RECIPE_POS *sorted = malloc((n + 1) * sizeof(RECIPE_POS));
+    uint64_t *name_off = malloc((n + 1) * sizeof(uint64_t));
+    STRTAB st_tab = { NULL, 0, 0, 0 };
+    if(image == NULL || sorted == NULL || name_off == NULL) {
+	perror("malloc");
+	free(image);
+	free(sorted);
+	free(name_off);
+	return -1;
+    }
+    uint32_t *dep_start = (uint32_t *)(image + h.dep_start);
+    uint32_t *deps = (uint32_t *)(image + h.deps);
+    uint32_t *rdep_start = (uint32_t *)(image + h.rdep_start);
+    uint32_t *rdeps = (uint32_t *)(image + h.rdeps);
+    uint32_t *topo = (uint32_t *)(image + h.topo);
+
+    // Positions of the recipes, for resolving links to indices.
+    uint32_t pos = 0;
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next, pos++) {
+	sorted[pos].recipe = rp;
+	sorted[pos].pos = pos;
+	name_off[pos] = strtab_add(&st_tab, rp->name);
+    }
+    qsort(sorted, n, sizeof(RECIPE_POS), compare_recipe_pos);
+
+    // Pointer fields hold offsets into the image until it is loaded.
+#define OFFSET(o) ((void *)(uintptr_t)(o))
+#define STRING(s) ((char *)(uintptr_t)(h.strings + strtab_add(&st_tab, (s))))
+    RECIPE *recipes = (RECIPE *)(image + h.recipes);
+    TASK *tasks = (TASK *)(image + h.tasks);
+    STEP *steps = (STEP *)(image + h.steps);
+    RECIPE_LINK *links = (RECIPE_LINK *)(image + h.links);
+    char **words = (char **)(image + h.words);
+    uint64_t t = 0, s = 0, l = 0, w = 0, d = 0;
+
+    pos = 0;
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next, pos++) {
+	RECIPE *ir = &recipes[pos];
+	ir->name = OFFSET(h.strings + name_off[pos]);
+	if(rp->next != NULL)
+	    ir->next = OFFSET(h.recipes + (pos + 1) * sizeof(RECIPE));
+
+	// Links keep the order of the parsed lists.  A link's name is its recipe's.
+	dep_start[pos] = d;
+	RECIPE_LINK **last = &ir->this_depends_on;
+	for(RECIPE_LINK *link = rp->this_depends_on; link != NULL; link = link->next, l++) {
+	    uint32_t sub = recipe_pos(sorted, n, link->recipe);
+	    *last = OFFSET(h.links + l * sizeof(RECIPE_LINK));
+	    links[l].name = OFFSET(h.strings + name_off[sub]);
+	    links[l].recipe = OFFSET(h.recipes + sub * sizeof(RECIPE));
+	    last = &links[l].next;
+	    deps[d++] = sub;
+	}
+	last = &ir->depend_on_this;
+	for(RECIPE_LINK *link = rp->depend_on_this; link != NULL; link = link->next, l++) {
+	    uint32_t dependent = recipe_pos(sorted, n, link->recipe);
+	    *last = OFFSET(h.links + l * sizeof(RECIPE_LINK));
+	    links[l].name = OFFSET(h.strings + name_off[dependent]);
+	    links[l].recipe = OFFSET(h.recipes + dependent * sizeof(RECIPE));
+	    last = &links[l].next;
+	}
+
+	TASK **last_task = &ir->tasks;
+	for(TASK *task = rp->tasks; task != NULL; task = task->next, t++) {
+	    *last_task = OFFSET(h.tasks + t * sizeof(TASK));
+	    last_task = &tasks[t].next;
+	    if(task->input_file != NULL)
+		tasks[t].input_file = STRING(task->input_file);
+	    if(task->output_file != NULL)
+		tasks[t].output_file = STRING(task->output_file);
+	    STEP **last_step = &tasks[t].steps;
+	    for(STEP *step = task->steps; step != NULL; step = step->next, s++) {
+		*last_step = OFFSET(h.steps + s * sizeof(STEP));
+		last_step = &steps[s].next;
+		steps[s].words = OFFSET(h.words + w * sizeof(char *));
+		for(char **word = step->words; *word != NULL; word++)
+		    words[w++] = STRING(*word);
+		w++;    // Left NULL.
+	    }
+	}
+    }
+    dep_start[n] = d;
+
+    // The reverse edges, grouped by sub-recipe.
+    for(uint64_t e = 0; e < d; e++)
+	rdep_start[deps[e] + 1]++;
+    for(uint64_t i = 0; i < n; i++)
+	rdep_start[i + 1] += rdep_start[i];
+    uint32_t *fill = malloc((n + 1) * sizeof(uint32_t));
+    if(fill != NULL) {
+	memcpy(fill, rdep_start, (n + 1) * sizeof(uint32_t));
+	for(uint64_t i = 0; i < n; i++) {
+	    for(uint32_t e = dep_start[i]; e < dep_start[i + 1]; e++)
+		rdeps[fill[deps[e]]++] = i;
+	}
+    }
+
+    // The name index, built exactly like recipe_index_build would.
+    RECIPE **slots = (RECIPE **)(image + h.index);
+    for(pos = 0; pos < n; pos++) {
+	const char *name = st_tab.buf + name_off[pos];
+	size_t i = hash_name(name) & (cap - 1);
+	while(slots[i] != NULL &&
+	      strcmp(st_tab.buf + ((uintptr_t)((RECIPE *)(image + (uintptr_t)slots[i]))->name - h.strings), name))
+	    i = (i + 1) & (cap - 1);
+	if(slots[i] == NULL) {
+	    slots[i] = OFFSET(h.recipes + pos * sizeof(RECIPE));
+	    h.index_count++;
+	}
+    }
+    h.source_path = h.strings + strtab_add(&st_tab, source_real);
+#undef OFFSET
+#undef STRING
+
+    int err = 0;
+    int64_t num_topo = -1;
+    if(fill == NULL || st_tab.failed || (num_topo = topological_order(n, dep_start, rdep_start, rdeps, topo)) < 0) {
+	perror("malloc");
+	err = -1;
+    }
+    h.num_topo = num_topo < 0 ? 0 : num_topo;
+
+    // In a DAG every recipe leads to one without dependents.  If there is just
+    // one of those, it needs all the others.
+    if(h.num_topo == n) {
+	for(uint64_t i = 0; i < n; i++) {
+	    if(rdep_start[i] == rdep_start[i + 1]) {
+		if(h.root != 0) {
+		    h.root = 0;
+		    break;
+		}
+		h.root = i + 1;
+	    }
+	}
+    }
+    h.strings_size = st_tab.len;
+    h.image_size = h.strings + st_tab.len;
+    memcpy(image, &h, sizeof(h));
+
+    // Write header & arrays, then the strings, to a temporary file.
+    if(err == 0) {
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", image_path);
+	FILE *out = fopen(tmp_path, "w");
+	if(out == NULL ||
+	   fwrite(image, 1, h.strings, out) != h.strings ||
+	   fwrite(st_tab.buf, 1, st_tab.len, out) != st_tab.len ||
+	   fclose(out) != 0 ||
+	   rename(tmp_path, image_path) != 0) {
+	    perror(image_path);
+	    unlink(tmp_path);
+	    err = -1;
+	}
+    }
+    debug("Compiled %lu recipes into %lu bytes", (unsigned long)n, (unsigned long)h.image_size);
+
+    free(fill);
+    free(image);
+    free(sorted);
+    free(name_off);
+    free(st_tab.buf);
+    return err;
+}
+
+/*
+ * Whether the file at path starts with the image magic.
+ */
+int cookbook_image_is_image(const char *path) {
+    char magic[4];
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+	return 0;
+    // Only a regular file can be sniffed without eating into what a
+    // parser would read, and only a regular file can be mapped anyway.
+    struct stat st;
+    int is_image = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+		   read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+		   !memcmp(magic, COOKBOOK_IMAGE_MAGIC, sizeof(magic));
+    close(fd);
+    return is_image;
+}
+
+/*
+ * Turn the offset in a pointer field into a pointer into the mapping.  The
+ * field points to target_size bytes (1 for a string, which the NUL at the end
+ * of the image terminates).
+ * Returns 0, or -1 if the target does not lie entirely in the image.
+ */
+static int relocate(void *field, char *base, uint64_t size, uint64_t target_size) {
+    uintptr_t off = (uintptr_t)*(void **)field;
+    if(off == 0)
+	return 0;
+    if(off >= size || target_size > size - off)
+	return -1;
+    *(void **)field = base + off;
+    return 0;
+}
+
+/*
+ * Check that a section of count elements of the given size lies in the image.
+ */
+static int section_ok(const COOKBOOK_IMAGE_HEADER *h, uint64_t off, uint64_t count, uint64_t size) {
+    return off <= h->image_size && count <= (h->image_size - off) / (size ? size : 1);
+}
+
+/*
+ * Check that the CSR edges & the topological order only name recipes of the
+ * image, & that each recipe's edges lie in its section.
+ */
+static int edges_ok(const COOKBOOK_IMAGE_HEADER *h, const char *base) {
+    uint64_t n = h->num_recipes;
+    const uint32_t *starts[2] = { (const uint32_t *)(base + h->dep_start), (const uint32_t *)(base + h->rdep_start) };
+    const uint32_t *edges[2] = { (const uint32_t *)(base + h->deps), (const uint32_t *)(base + h->rdeps) };
+    for(int k = 0; k < 2; k++) {
+	if(starts[k][0] != 0 || starts[k][n] != h->num_deps)
+	    return 0;
+	for(uint64_t i = 0; i < n; i++) {
+	    if(starts[k][i] > starts[k][i + 1])
+		return 0;
+	}
+	for(uint64_t e = 0; e < h->num_deps; e++) {
+	    if(edges[k][e] >= n)
+		return 0;
+	}
+    }
+    const uint32_t *topo = (const uint32_t *)(base + h->topo);
+    for(uint64_t i = 0; i < h->num_topo; i++) {
+	if(topo[i] >= n)
+	    return 0;
+    }
+    return h->num_topo <= n && h->root <= n && (h->root == 0 || h->num_topo == n);
+}
+
+/*
+ * Map a compiled cookbook image.  The mapping and the few structures that
+ * are not in the image belong to the arena, as with parse_cookbook_file.
+ * Returns the cookbook, or NULL with *errp set (and the reason on stderr)
+ * if the image is unusable or stale.
+ */
+COOKBOOK *cookbook_image_load(const char *path, ARENA *arena, int *errp) {
+    *errp = 1;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd == -1 || fstat(fd, &st) == -1) {
+	perror(path);
+	if(fd != -1)
+	    close(fd);
+	return NULL;
+    }
+    if((size_t)st.st_size < sizeof(COOKBOOK_IMAGE_HEADER)) {
+	fprintf(stderr, "Error: '%s' is not a cookbook image\n", path);
+	close(fd);
+	return NULL;
+    }
+    char *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+	perror("mmap");
+	return NULL;
+    }
+
+    COOKBOOK_IMAGE_HEADER *h = (COOKBOOK_IMAGE_HEADER *)base;
+    if(memcmp(h->magic, COOKBOOK_IMAGE_MAGIC, sizeof(h->magic)) || h->version != COOKBOOK_IMAGE_VERSION ||
+       h->layout != IMAGE_LAYOUT || h->image_size != (uint64_t)st.st_size ||
+       !section_ok(h, h->recipes, h->num_recipes, sizeof(RECIPE)) ||
+       !section_ok(h, h->tasks, h->num_tasks, sizeof(TASK)) ||
+       !section_ok(h, h->steps, h->num_steps, sizeof(STEP)) ||
+       !section_ok(h, h->links, h->num_links, sizeof(RECIPE_LINK)) ||
+       !section_ok(h, h->words, h->num_words, sizeof(char *)) ||
+       !section_ok(h, h->index, h->index_capacity, sizeof(RECIPE *)) ||
+       h->num_recipes >= UINT32_MAX ||
+       !section_ok(h, h->dep_start, h->num_recipes + 1, sizeof(uint32_t)) ||
+       !section_ok(h, h->deps, h->num_deps, sizeof(uint32_t)) ||
+       !section_ok(h, h->rdep_start, h->num_recipes + 1, sizeof(uint32_t)) ||
+       !section_ok(h, h->rdeps, h->num_deps, sizeof(uint32_t)) ||
+       !section_ok(h, h->topo, h->num_topo, sizeof(uint32_t)) ||
+       !section_ok(h, h->strings, h->strings_size, 1) ||
+       h->strings_size == 0 || base[h->image_size - 1] != '\0' ||
+       h->source_path < h->strings || h->source_path >= h->image_size ||
+       !edges_ok(h, base)) {
+	fprintf(stderr, "Error: '%s' is not a usable cookbook image (recompile it)\n", path);
+	munmap(base, st.st_size);
+	return NULL;
+    }
+
+    // Refuse an image whose source has changed since it was compiled.
+    const char *source = base + h->source_path;
+    struct stat src;
+    if(stat(source, &src) == -1 || (uint64_t)src.st_size != h->source_size ||
+       src.st_mtim.tv_sec != h->source_mtime_sec || src.st_mtim.tv_nsec != h->source_mtime_nsec) {
+	fprintf(stderr, "Error: cookbook image '%s' is stale: '%s' has changed since it was compiled\n", path, source);
+	munmap(base, st.st_size);
+	return NULL;
+    }
+
+    // One pass over the arrays turns the offsets into pointers.
+    int bad = 0;
+    RECIPE *recipes = (RECIPE *)(base + h->recipes);
+    for(uint64_t i = 0; i < h->num_recipes; i++) {
+	bad |= relocate(&recipes[i].name, base, h->image_size, 1);
+	bad |= relocate(&recipes[i].this_depends_on, base, h->image_size, sizeof(RECIPE_LINK));
+	bad |= relocate(&recipes[i].depend_on_this, base, h->image_size, sizeof(RECIPE_LINK));
+	bad |= relocate(&recipes[i].tasks, base, h->image_size, sizeof(TASK));
+	bad |= relocate(&recipes[i].next, base, h->image_size, sizeof(RECIPE));
+	recipes[i].state = NULL;
+    }
+    TASK *tasks = (TASK *)(base + h->tasks);
+    for(uint64_t i = 0; i < h->num_tasks; i++) {
+	bad |= relocate(&tasks[i].steps, base, h->image_size, sizeof(STEP));
+	bad |= relocate(&tasks[i].input_file, base, h->image_size, 1);
+	bad |= relocate(&tasks[i].output_file, base, h->image_size, 1);
+	bad |= relocate(&tasks[i].next, base, h->image_size, sizeof(TASK));
+    }
+    STEP *steps = (STEP *)(base + h->steps);
+    for(uint64_t i = 0; i < h->num_steps; i++) {
+	bad |= relocate(&steps[i].words, base, h->image_size, sizeof(char *));
+	bad |= relocate(&steps[i].next, base, h->image_size, sizeof(STEP));
+    }
+    RECIPE_LINK *links = (RECIPE_LINK *)(base + h->links);
+    for(uint64_t i = 0; i < h->num_links; i++) {
+	bad |= relocate(&links[i].name, base, h->image_size, 1);
+	bad |= relocate(&links[i].recipe, base, h->image_size, sizeof(RECIPE));
+	bad |= relocate(&links[i].next, base, h->image_size, sizeof(RECIPE_LINK));
+    }
+    char **words = (char **)(base + h->words);
+    for(uint64_t i = 0; i < h->num_words; i++)
+	bad |= relocate(&words[i], base, h->image_size, 1);
+    RECIPE **slots = (RECIPE **)(base + h->index);
+    for(uint64_t i = 0; i < h->index_capacity; i++)
+	bad |= relocate(&slots[i], base, h->image_size, sizeof(RECIPE));
+
+    if(bad) {
+	fprintf(stderr, "Error: '%s' is not a usable cookbook image (recompile it)\n", path);
+	munmap(base, st.st_size);
+	return NULL;
+    }
+    COOKBOOK *cbp = arena_alloc(arena, sizeof(COOKBOOK));
+    COOKBOOK_STATE *cs = arena_alloc(arena, sizeof(COOKBOOK_STATE));
+    if(cbp == NULL || cs == NULL || arena_adopt_mapping(arena, base, st.st_size)) {
+	fprintf(stderr, "%s: out of memory\n", path);
+	munmap(base, st.st_size);
+	return NULL;
+    }
+
+    // The name index lives in the image, so it is not rebuilt.
+    cbp->recipes = h->num_recipes ? recipes : NULL;
+    cs->index.slots = slots;
+    cs->index.capacity = h->index_capacity;
+    cs->index.count = h->index_count;
+    cs->image = h;
+    cs->arena = arena;
+    cbp->state = cs;
+    *errp = 0;
+    debug("Mapped %lu recipes from %s", (unsigned long)h->num_recipes, path);
+    return cbp;
+}
+
+
+/*
+ * If cbp is mapped from an image whose root is recipe, so that recipe needs
+ * every recipe of the cookbook, point *topo at the image's topological order
+ * of all of them & *dep_start at their CSR dependency offsets, & return the
+ * # of recipes.  Returns 0 otherwise: the cookbook was parsed, or a run of
+ * recipe has to find its required recipes itself.
+ */
+uint64_t cookbook_image_closure(COOKBOOK *cbp, RECIPE *recipe, const uint32_t **topo, const uint32_t **dep_start) {
+    COOKBOOK_STATE *cs = cbp->state;
+    const COOKBOOK_IMAGE_HEADER *h = cs != NULL ? cs->image : NULL;
+    if(h == NULL || h->root == 0 || recipe != &cbp->recipes[h->root - 1])
+	return 0;
+    *topo = (const uint32_t *)((const char *)h + h->topo);
+    *dep_start = (const uint32_t *)((const char *)h + h->dep_start);
+    return h->num_recipes;
+}
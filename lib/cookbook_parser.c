@@ -3,8 +3,16 @@
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cookbook.h"
+#include "cookbook_parser.h"
+#include "recipe_index.h"
 #include "debug.h"
 
 static void unparse_recipe(RECIPE *rp, FILE *out);
@@ -12,20 +20,23 @@ static void unparse_task(TASK *tp, FILE *out);
 static void unparse_step(STEP *sp, FILE *out);
 static void unparse_token(char *tok, FILE *out);
 
-static RECIPE *parse_recipe(FILE *in, int *err);
-static RECIPE *parse_recipe_header(FILE *in, int *err);
-static TASK *parse_task(FILE *in, int *err);
-static STEP *parse_step(FILE *in, int *err);
-static char *parse_token(FILE *in, int *err);
+static COOKBOOK *parse(COOKBOOK_PARSER *p, int *err);
+static RECIPE *parse_recipe(COOKBOOK_PARSER *p, int *err);
+static RECIPE *parse_recipe_header(COOKBOOK_PARSER *p, int *err);
+static TASK *parse_task(COOKBOOK_PARSER *p, int *err);
+static STEP *parse_step(COOKBOOK_PARSER *p, int *err);
+static char *parse_token(COOKBOOK_PARSER *p, int *err);
+static char *read_token(FILE *in, int *lineno);
+static char *scan_token(COOKBOOK_PARSER *p);
+static char *scan_escaped_token(COOKBOOK_PARSER *p, int c);
 static int is_delim(int c);
+static int grow(void *bufp, size_t *sizep, size_t size);
+static void report(COOKBOOK_PARSER *p, int lineno, const char *fmt, ...);
 
-static int set_dependencies(COOKBOOK *cbp);
+static int set_dependencies(COOKBOOK_PARSER *p, COOKBOOK *cbp);
 
 static RECIPE *get_recipe(COOKBOOK *cbp, char *name);
 
-static char *peek_token;
-static int lineno;
-
 /*
  * Print a cookbook, in a format from which it can be parsed.
  */
@@ -119,44 +130,510 @@ static void unparse_token(char *tok, FILE *out) {
  * It is the caller's responsibility to free the data structure returned.
  */
 COOKBOOK *parse_cookbook(FILE *in, int *errp) {
+    COOKBOOK_PARSER p;
+    cookbook_parser_init_stream(&p, in);
+    return cookbook_parser_parse(&p, errp);
+}
+
+/*
+ * Set up a parser to read a cookbook from a stream.
+ */
+void cookbook_parser_init_stream(COOKBOOK_PARSER *p, FILE *in) {
+    memset(p, 0, sizeof(*p));
+    p->in = in;
+}
+
+/*
+ * Set up a parser to parse a cookbook in place in a writable buffer,
+ * allocating from the arena, as described for parse_cookbook_buffer.
+ */
+void cookbook_parser_init_buffer(COOKBOOK_PARSER *p, char *buf, size_t len, ARENA *arena) {
+    memset(p, 0, sizeof(*p));
+    p->pos = buf;
+    p->end = buf + len;
+    p->held = EOF;
+    p->arena = arena;
+}
+
+/*
+ * Run a parser that has been set up, with the same results as parse_cookbook
+ * or parse_cookbook_buffer.  The parser may be discarded afterwards.
+ */
+COOKBOOK *cookbook_parser_parse(COOKBOOK_PARSER *p, int *errp) {
+    COOKBOOK *cbp = parse(p, errp);
+    if(p->in != NULL && ferror(p->in)) {
+	report(p, p->lineno, "I/O error reading cookbook\n");
+	(*errp)++;
+    }
+    return cbp;
+}
+
+/*
+ * Parse a cookbook held in a writable buffer of len bytes.
+ *
+ * The cookbook is the same as parse_cookbook would produce from the same
+ * text, but nothing in it is allocated individually.  Tokens without
+ * backslashes are used in place, NUL-terminated by overwriting the character
+ * that ends them, so the buffer is modified and must outlive the cookbook.
+ * Everything else, the cookbook included, is allocated from the arena and
+ * is freed with it.  The arena should hold nothing but this cookbook, so
+ * that free_cookbook can release it.
+ *
+ * Returns the cookbook, or NULL if memory could not be allocated.
+ * As with parse_cookbook, errors are counted in the variable pointed at by errp.
+ */
+COOKBOOK *parse_cookbook_buffer(char *buf, size_t len, ARENA *arena, int *errp) {
+    COOKBOOK_PARSER p;
+    cookbook_parser_init_buffer(&p, buf, len, arena);
+    return cookbook_parser_parse(&p, errp);
+}
+
+/*
+ * Map the file at path privately & hand the mapping to the arena, which
+ * unmaps it.  Returns 0 with the contents in *bufp & *lenp, or -1 with errno
+ * set if the file could not be opened or mapped, to ENODEV if it is not a
+ * regular file and has to be read as a stream.
+ */
+static int map_file(const char *path, ARENA *arena, char **bufp, size_t *lenp) {
+    static char empty[1];
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+	return -1;
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+	close(fd);
+	return -1;
+    }
+    if(!S_ISREG(st.st_mode)) {
+	close(fd);
+	errno = ENODEV;
+	return -1;
+    }
+    char *buf = empty;
+    size_t len = st.st_size;
+    if(len > 0) {
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if(buf == MAP_FAILED) {
+	    close(fd);
+	    return -1;
+	}
+	madvise(buf, len, MADV_SEQUENTIAL);
+	if(arena_adopt_mapping(arena, buf, len)) {
+	    munmap(buf, len);
+	    close(fd);
+	    errno = ENOMEM;
+	    return -1;
+	}
+    }
+    close(fd);
+    *bufp = buf;
+    *lenp = len;
+    return 0;
+}
+
+/*
+ * Read what cannot be mapped, a pipe for instance, into the arena.
+ * Returns 0 with the contents in *bufp & *lenp, or -1 with errno set.
+ */
+static int read_file(const char *path, ARENA *arena, char **bufp, size_t *lenp) {
+    FILE *in = fopen(path, "r");
+    if(in == NULL)
+	return -1;
+    char *text = NULL;
+    size_t size = 0, len = 0, n;
+    do {
+	if(grow(&text, &size, len + 4096)) {
+	    free(text);
+	    fclose(in);
+	    errno = ENOMEM;
+	    return -1;
+	}
+	len += n = fread(text + len, 1, size - len, in);
+    } while(n > 0);
+    int error = ferror(in) ? EIO : 0;
+    fclose(in);
+    char *buf = error ? NULL : arena_alloc(arena, len + 1);
+    if(buf != NULL)
+	memcpy(buf, text, len);
+    free(text);
+    if(buf == NULL) {
+	errno = error ? error : ENOMEM;
+	return -1;
+    }
+    *bufp = buf;
+    *lenp = len;
+    return 0;
+}
+
+/*
+ * Parse the cookbook in the file at path, which is mapped privately rather
+ * than read.  The mapping is handed to the arena and unmapped with it.
+ *
+ * Returns NULL with errno set if the file could not be opened or mapped,
+ * to ENODEV if it is not a regular file and has to be read as a stream.
+ */
+COOKBOOK *parse_cookbook_file(const char *path, ARENA *arena, int *errp) {
+    char *buf;
+    size_t len;
+    if(map_file(path, arena, &buf, &len))
+	return NULL;
+    COOKBOOK *cbp = parse_cookbook_buffer(buf, len, arena, errp);
+    if(cbp == NULL)
+	errno = ENOMEM;
+    return cbp;
+}
+
+/*
+ * One of the files of a parse_cookbook_files, parsed on its own into an
+ * arena of its own, with its recipes left unlinked.
+ */
+typedef struct cookbook_file {
+    const char *path;
+    ARENA arena;
+    COOKBOOK *cbp;              // NULL if the file could not be read.
+    int error;                  // Then, the errno saying why.
+    int err;                    // # of errors in parsing it.
+    int *lines;                 // Line of the header of each of its recipes.
+    int num_recipes;
+} COOKBOOK_FILE;
+
+/*
+ * The files of a parse_cookbook_files, handed out to the threads parsing
+ * them one at a time, so that a thread that draws small files takes more.
+ */
+typedef struct file_queue {
+    COOKBOOK_FILE *files;
+    int num_files;
+    int next;                   // Next file to be parsed.
+    pthread_mutex_t lock;
+} FILE_QUEUE;
+
+static void load_file(COOKBOOK_FILE *f) {
+    char *buf;
+    size_t len;
+    arena_init(&f->arena);
+    if(map_file(f->path, &f->arena, &buf, &len) && (errno != ENODEV || read_file(f->path, &f->arena, &buf, &len))) {
+	f->error = errno;
+	return;
+    }
+    COOKBOOK_PARSER p;
+    cookbook_parser_init_buffer(&p, buf, len, &f->arena);
+    p.name = f->path;
+    p.defer_links = 1;
+    if((f->cbp = cookbook_parser_parse(&p, &f->err)) == NULL)
+	f->error = ENOMEM;
+    f->lines = p.lines;
+    f->num_recipes = p.num_recipes;
+}
+
+static void *load_files(void *arg) {
+    FILE_QUEUE *q = arg;
+    for(;;) {
+	pthread_mutex_lock(&q->lock);
+	int i = q->next++;
+	pthread_mutex_unlock(&q->lock);
+	if(i >= q->num_files)
+	    return NULL;
+	load_file(&q->files[i]);
+    }
+}
+
+/*
+ * Where a recipe of a parse_cookbook_files came from.
+ */
+typedef struct recipe_location {
+    const char *path;
+    int line;
+} RECIPE_LOCATION;
+
+/*
+ * Report every recipe of a parse_cookbook_files that is defined in some
+ * other file as well.  Recipe states are not set up yet, so until the
+ * duplicates have been found each recipe's state says where it came from.
+ */
+static void find_duplicates(COOKBOOK *cbp, COOKBOOK_FILE *files, int n, int total, int *errp) {
+    RECIPE_LOCATION *locations = calloc(total, sizeof(RECIPE_LOCATION));
+    if(locations == NULL) {
+	(*errp)++;
+	return;
+    }
+    int k = 0;
+    for(int i = 0; i < n; i++) {
+	RECIPE *rp = files[i].cbp->recipes;
+	for(int j = 0; j < files[i].num_recipes; j++, rp = rp->next, k++) {
+	    locations[k].path = files[i].path;
+	    locations[k].line = files[i].lines[j];
+	    rp->state = &locations[k];
+	}
+    }
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next) {
+	RECIPE *first = get_recipe(cbp, rp->name);
+	RECIPE_LOCATION *here = rp->state, *there = first->state;
+	if(first != rp && here->path != there->path) {
+	    COOKBOOK_PARSER p = { .name = here->path };
+	    report(&p, here->line, "Recipe '%s' is already defined at %s:%d\n",
+		   rp->name, there->path, there->line);
+	    (*errp)++;
+	}
+    }
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+	rp->state = NULL;
+    free(locations);
+}
+
+/*
+ * Parse a cookbook split across the n files at paths, using up to nthreads
+ * threads to parse the files at the same time.  Each file is parsed in place
+ * as by parse_cookbook_file, except that it may depend on recipes in any of
+ * the others: the recipes of all the files, in the order given, make up one
+ * cookbook, whose dependencies are resolved once all of them have been read.
+ * A recipe defined in more than one file is an error, reported along with
+ * where each definition is.  In-file duplicates are left alone, as
+ * parse_cookbook leaves them.
+ *
+ * Everything, the mappings of the files included, ends up in the arena,
+ * as with parse_cookbook_buffer.  Diagnostics are prefixed with the file
+ * they concern.
+ *
+ * Returns the cookbook, or NULL if a file could not be read (which is
+ * reported) or memory could not be allocated.  Errors are counted in the
+ * variable pointed at by errp.
+ */
+COOKBOOK *parse_cookbook_files(char *const paths[], int n, int nthreads, ARENA *arena, int *errp) {
+    *errp = 0;
+    FILE_QUEUE q = { .num_files = n };
+    if((q.files = calloc(n, sizeof(COOKBOOK_FILE))) == NULL)
+	return NULL;
+    for(int i = 0; i < n; i++)
+	q.files[i].path = paths[i];
+    pthread_mutex_init(&q.lock, NULL);
+
+    // This thread parses files too, alongside the ones started for the rest.
+    if(nthreads > n)
+	nthreads = n;
+    pthread_t *threads = calloc(nthreads > 1 ? nthreads - 1 : 1, sizeof(pthread_t));
+    int started = 0;
+    while(threads != NULL && started < nthreads - 1
+	  && pthread_create(&threads[started], NULL, load_files, &q) == 0)
+	started++;
+    load_files(&q);
+    for(int i = 0; i < started; i++)
+	pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&q.lock);
+
+    // Chain the recipes of the files together in a cookbook of their own,
+    // in the arena that everything of theirs goes to.
+    COOKBOOK *cbp = arena_alloc(arena, sizeof(COOKBOOK));
+    COOKBOOK_STATE *cs = arena_alloc(arena, sizeof(COOKBOOK_STATE));
+    int total = 0, failed = cbp == NULL || cs == NULL;
+    RECIPE **last = cbp != NULL ? &cbp->recipes : NULL;
+    for(int i = 0; i < n; i++) {
+	COOKBOOK_FILE *f = &q.files[i];
+	if(f->cbp == NULL) {
+	    COOKBOOK_PARSER p = { .name = f->path };
+	    report(&p, 0, "%s\n", strerror(f->error));
+	    failed = 1;
+	} else if(!failed) {
+	    *errp += f->err;
+	    for(RECIPE *rp = f->cbp->recipes; rp != NULL; rp = rp->next) {
+		*last = rp;
+		last = &rp->next;
+	    }
+	    total += f->num_recipes;
+	}
+	arena_absorb(arena, &f->arena);
+    }
+    if(failed) {
+	for(int i = 0; i < n; i++)
+	    free(q.files[i].lines);
+	free(q.files);
+	return NULL;
+    }
+    cs->arena = arena;
+    cbp->state = cs;
+
+    // The name index keeps one recipe per name, so unless it came out short
+    // there is no recipe defined twice & no need to look for one.
+    if(cbp->recipes != NULL && get_recipe(cbp, cbp->recipes->name) != NULL
+       && cs->index.slots != NULL && cs->index.count < (size_t)total)
+	find_duplicates(cbp, q.files, n, total, errp);
+    for(int i = 0; i < n; i++)
+	free(q.files[i].lines);
+    free(q.files);
+
+    // Now that every recipe is known, link them all.
+    COOKBOOK_PARSER p;
+    cookbook_parser_init_buffer(&p, NULL, 0, arena);
+    if(cbp->recipes == NULL || set_dependencies(&p, cbp))
+	(*errp)++;
+    return cbp;
+}
+
+/*
+ * Free a cookbook, however it was loaded.  An arena cookbook is released by
+ * resetting its arena, which keeps the arena's pages for the next cookbook.
+ * A cookbook from parse_cookbook is taken apart node by node.
+ */
+void free_cookbook(COOKBOOK *cbp) {
+    COOKBOOK_STATE *cs = cbp->state;
+    if(cs != NULL && cs->arena != NULL) {
+	arena_reset(cs->arena);
+	return;
+    }
+    RECIPE *rp = cbp->recipes;
+    while(rp != NULL) {
+	RECIPE *next_recipe = rp->next;
+	RECIPE_LINK *link, *next_link;
+	for(link = rp->this_depends_on; link != NULL; link = next_link) {
+	    next_link = link->next;
+	    free(link->name);
+	    free(link);
+	}
+	// The inverse links share the names of the recipes they point to.
+	for(link = rp->depend_on_this; link != NULL; link = next_link) {
+	    next_link = link->next;
+	    free(link);
+	}
+	TASK *task, *next_task;
+	for(task = rp->tasks; task != NULL; task = next_task) {
+	    next_task = task->next;
+	    STEP *step, *next_step;
+	    for(step = task->steps; step != NULL; step = next_step) {
+		next_step = step->next;
+		for(char **w = step->words; *w != NULL; w++)
+		    free(*w);
+		free(step->words);
+		free(step);
+	    }
+	    free(task->input_file);
+	    free(task->output_file);
+	    free(task);
+	}
+	free(rp->name);
+	free(rp);
+	rp = next_recipe;
+    }
+    if(cs != NULL) {
+	recipe_index_free(&cs->index);
+	free(cs);
+    }
+    free(cbp);
+}
+
+/*
+ * Print a diagnostic, preceded by the parser's name if it has one and by
+ * lineno unless that is 0.  The stream is locked throughout, so that
+ * diagnostics from parsers running on other threads are not interleaved.
+ */
+static void report(COOKBOOK_PARSER *p, int lineno, const char *fmt, ...) {
+    FILE *out = p->errors != NULL ? p->errors : stderr;
+    va_list ap;
+    flockfile(out);
+    if(p->name != NULL)
+	fprintf(out, "%s:", p->name);
+    if(lineno != 0)
+	fprintf(out, "%d:", lineno);
+    if(p->name != NULL || lineno != 0)
+	fputc(' ', out);
+    va_start(ap, fmt);
+    vfprintf(out, fmt, ap);
+    va_end(ap);
+    funlockfile(out);
+}
+
+/*
+ * Allocate a zero-filled node of the cookbook.
+ */
+static void *new_node(COOKBOOK_PARSER *p, size_t size) {
+    return p->arena != NULL ? arena_alloc(p->arena, size) : calloc(1, size);
+}
+
+/*
+ * Release a token that did not become part of the cookbook.
+ * Only tokens read from a stream were allocated individually.
+ */
+static void free_token(COOKBOOK_PARSER *p, char *w) {
+    if(p->arena == NULL)
+	free(w);
+}
+
+/*
+ * Make sure the scratch space at *bufp holds at least size bytes.
+ * Returns 0 on success, -1 if memory could not be allocated.
+ */
+static int grow(void *bufp, size_t *sizep, size_t size) {
+    if(size <= *sizep)
+	return 0;
+    size_t n = *sizep ? 2 * *sizep : 256;
+    while(n < size)
+	n *= 2;
+    void *buf = realloc(*(void **)bufp, n);
+    if(buf == NULL)
+	return -1;
+    *(void **)bufp = buf;
+    *sizep = n;
+    return 0;
+}
+
+static COOKBOOK *parse(COOKBOOK_PARSER *p, int *errp) {
     debug("***COOKBOOK");
-    COOKBOOK *cbp = calloc(1, sizeof(COOKBOOK));
+    COOKBOOK *cbp = new_node(p, sizeof(COOKBOOK));
     *errp = 0;
-    lineno = 1;
-    
+    p->lineno = 1;
+    if(cbp == NULL)
+	return NULL;
+
+    // An arena cookbook says so in its state, so its name index and whatever
+    // else is kept per cookbook go to the arena as well.
+    if(p->arena != NULL) {
+	COOKBOOK_STATE *cs = new_node(p, sizeof(COOKBOOK_STATE));
+	if(cs == NULL)
+	    return NULL;
+	cs->arena = p->arena;
+	cbp->state = cs;
+    }
+
     // A cookbook is a sequence of recipes.
     RECIPE *rp;
     RECIPE **last = &cbp->recipes;
-    while((rp = parse_recipe(in, errp)) != NULL) {
+    while((rp = parse_recipe(p, errp)) != NULL) {
 	*last = rp;
         last = &rp->next;
     }
-    if(ferror(in)) {
-	fprintf(stderr, "%d: I/O error reading cookbook\n", lineno);
-	(*errp)++;
-    }
-    if(cbp->recipes == NULL || set_dependencies(cbp))
+    free(p->words);
+    free(p->text);
+    if(p->defer_links)
+	return cbp;
+    if(cbp->recipes == NULL || set_dependencies(p, cbp))
 	(*errp)++;
     return cbp;
 }
 
+/*
+ * Whether the end of the input has been reached.
+ */
+static int at_eof(COOKBOOK_PARSER *p) {
+    return p->in != NULL ? feof(p->in) : p->eof;
+}
+
 /*
  * Parse a recipe.
  *
  * Returns the recipe, or NULL if EOF is encountered or an error occurs.
  * In case of error, errno is set.
  */
-static RECIPE *parse_recipe(FILE *in, int *errp) {
+static RECIPE *parse_recipe(COOKBOOK_PARSER *p, int *errp) {
     debug("***RECIPE");
     // A recipe consists of a header line, followed by a sequence of tasks.
-    RECIPE *rp = parse_recipe_header(in, errp);
+    RECIPE *rp = parse_recipe_header(p, errp);
     if(rp == NULL)
 	return NULL;
 
     // Parse the recipe tasks and link them into the cookbook.
     TASK *task;
     TASK **last = &rp->tasks;
-    while((task = parse_task(in, errp)) != NULL) {
+    while((task = parse_task(p, errp)) != NULL) {
 	*last = task;
 	last = &task->next;
     }
@@ -170,7 +647,7 @@ static RECIPE *parse_recipe(FILE *in, int *errp) {
  * Returns partially initialized recipe on success, NULL otherwise.
  * In case of error, errno is set.
  */
-static RECIPE *parse_recipe_header(FILE *in, int *errp) {
+static RECIPE *parse_recipe_header(COOKBOOK_PARSER *p, int *errp) {
     debug("***RECIPE HEADER");
     // A recipe header consists of a name, followed by a colon as a word by itself,
     // followed by a sequence of sub-recipe names.
@@ -179,37 +656,50 @@ static RECIPE *parse_recipe_header(FILE *in, int *errp) {
     char *w;
 
     // Skip any blank lines preceding the recipe.
-    while(!feof(in) && (w = parse_token(in, errp)) != NULL && *w == '\0')
-	free(w);
-    if(feof(in))
+    while(!at_eof(p) && (w = parse_token(p, errp)) != NULL && *w == '\0')
+	free_token(p, w);
+    if(at_eof(p))
 	return NULL;
 
     // At this point, w should contain the recipe name.
-    RECIPE *rp = calloc(1, sizeof(RECIPE));
+    RECIPE *rp = new_node(p, sizeof(RECIPE));
+    if(rp == NULL)
+	return NULL;
     rp->name = w;
+    if(p->defer_links) {
+	if(grow(&p->lines, &p->lines_size, (p->num_recipes + 1) * sizeof(int))) {
+	    (*errp)++;
+	    return NULL;
+	}
+	p->lines[p->num_recipes++] = p->lineno;
+    }
 
     // Check for the colon that is supposed to follow.
-    if((w = parse_token(in, errp)) == NULL || strcmp(w, ":")) {
-	fprintf(stderr, "%d: Expected ':' after recipe name '%s' but '%s' was seen.\n",
-		lineno, rp->name, w != NULL ? w : "(NULL)");
+    if((w = parse_token(p, errp)) == NULL || strcmp(w, ":")) {
+	report(p, p->lineno, "Expected ':' after recipe name '%s' but '%s' was seen.\n",
+	       rp->name, w != NULL ? w : "(NULL)");
 	if(w != NULL)
-	    free(w);
+	    free_token(p, w);
 	(*errp)++;
 	return rp;
     }
-    free(w);
+    free_token(p, w);
 
     // The remaining words are the names of sub-recipes.
     // Create links for them.
     RECIPE_LINK **last = &rp->this_depends_on;
-    while((w = parse_token(in, errp)) != NULL && *w != '\0') {
-	RECIPE_LINK *link = calloc(1, sizeof(RECIPE_LINK));
+    while((w = parse_token(p, errp)) != NULL && *w != '\0') {
+	RECIPE_LINK *link = new_node(p, sizeof(RECIPE_LINK));
+	if(link == NULL) {
+	    (*errp)++;
+	    break;
+	}
 	link->name = w;
 	*last = link;
 	last = &link->next;
     }
     if(w != NULL)
-	free(w);
+	free_token(p, w);
 
     return rp;
 }
@@ -219,16 +709,18 @@ static RECIPE *parse_recipe_header(FILE *in, int *errp) {
  *
  * Returns the task, or NULL if a blank line is seen.
  */
-static TASK *parse_task(FILE *in, int *errp) {
+static TASK *parse_task(COOKBOOK_PARSER *p, int *errp) {
     debug("***TASK");
-    TASK *tp = calloc(1, sizeof(TASK));
+    TASK *tp = new_node(p, sizeof(TASK));
+    if(tp == NULL)
+	return NULL;
 
     // A task consists of a sequence of steps to be run as a pipeline,
     // optionally followed by input and output redirections.
     STEP *sp;
     STEP **lastp = &tp->steps;
     int ends_with_vbar = 0;
-    while(!feof(in) && (sp = parse_step(in, errp)) != NULL) {
+    while(!at_eof(p) && (sp = parse_step(p, errp)) != NULL) {
 	// parse_step() stops when EOF, NL, |, <, or > is seen,
 	// and it leaves the delimiter token unread.
 	ends_with_vbar = 0;
@@ -237,40 +729,39 @@ static TASK *parse_task(FILE *in, int *errp) {
 	// Examine the delimiter that caused parse_step to stop.
 	// Check for redirections and pipelines that end with "|".
 	char *w;
-	while(!feof(in) && (w = parse_token(in, errp)) != NULL) {
+	while(!at_eof(p) && (w = parse_token(p, errp)) != NULL) {
 	    debug("(step delimiter: '%s')", w);
 	    if(*w == '\0') {
-		free(w);
+		free_token(p, w);
 		break;
 	    } else if(!strcmp(w, "|")) {
 		ends_with_vbar = 1;
-		free(w);
+		free_token(p, w);
 		break;  // Parse another step.
 	    } else if(!strcmp(w, "<") || !strcmp(w, ">")) {
 		// Input or output redirection -- get filename.
-		char *n = parse_token(in, errp);
+		char *n = parse_token(p, errp);
 		if(n == NULL) {
-		    fprintf(stderr, "%d: Missing filename in input or output redirection\n",
-			    lineno);
-		    free(w);
+		    report(p, p->lineno, "Missing filename in input or output redirection\n");
+		    free_token(p, w);
 		    (*errp)++;
 		    return tp;
 		}
 		debug("(redirect '%s')", n);
 		char **np = (*w == '<' ? &tp->input_file : &tp->output_file);
 		if(*np != NULL) {
-		    fprintf(stderr, "%d: Redundant input or output redirection\n", lineno);
-		    free(w);
-		    free(n);
+		    report(p, p->lineno, "Redundant input or output redirection\n");
+		    free_token(p, w);
+		    free_token(p, n);
 		    (*errp)++;
 		    continue;
 		}
 		*np = n;
-		free(w);
+		free_token(p, w);
 	    } else {
 		// Shouldn't happen.
-		fprintf(stderr, "%d: Step terminated by unknown delimiter '%s'", lineno, w);
-		free(w);
+		report(p, p->lineno, "Step terminated by unknown delimiter '%s'", w);
+		free_token(p, w);
 		(*errp)++;
 		break;
 	    }
@@ -281,11 +772,12 @@ static TASK *parse_task(FILE *in, int *errp) {
 	}
     }
     if(ends_with_vbar) {
-	fprintf(stderr, "%d: Pipeline terminated by '|' -- another step is required\n", lineno);
+	report(p, p->lineno, "Pipeline terminated by '|' -- another step is required\n");
 	(*errp)++;
     }
     if(tp->steps == NULL) {
-	free(tp);
+	if(p->arena == NULL)
+	    free(tp);
 	debug("(empty task -- end of recipe)");
 	return NULL;
     }
@@ -296,40 +788,44 @@ static TASK *parse_task(FILE *in, int *errp) {
 /*
  * Parse a step.
  */
-static STEP *parse_step(FILE *in, int *errp) {
+static STEP *parse_step(COOKBOOK_PARSER *p, int *errp) {
     debug("***STEP");
     // A step consists of a sequence of non-delimiter words.
     // Delimiters are "|", "<", and ">" in words by themselves.
-    STEP *sp = calloc(1, sizeof(STEP));
+    // The words are collected in scratch space, then copied into
+    // an array of exactly the right size.
     char *w;
     int length = 0;
-    int max = 8;
-    sp->words = calloc(max, sizeof(char *));
-    while((w = parse_token(in, errp)) != NULL && *w != '\0') {
-	if(length >= max-1) {
-	    max *= 2;
-	    sp->words = realloc(sp->words, max * sizeof(char *));
+    while((w = parse_token(p, errp)) != NULL && *w != '\0') {
+	if(grow(&p->words, &p->words_size, (length + 2) * sizeof(char *))) {
+	    (*errp)++;
+	    break;
 	}
 	if(!strcmp(w, "|") || !strcmp(w, "<") || !strcmp(w, ">")) {
 	    break;
 	} else {
-	    sp->words[length++] = w;
+	    p->words[length++] = w;
 	}
     }
     if(w != NULL) {
 	debug("(push back '%s')", w);
-	peek_token = w; 
+	p->peek_token = w; 
 	if(*w == '\0')
-	    lineno--;
+	    p->lineno--;
     }
     if(length == 0) {
 	// No step here
-	free(sp->words);
-	free(sp);
+	return NULL;
+    }
+    STEP *sp = new_node(p, sizeof(STEP));
+    char **words = new_node(p, (length + 1) * sizeof(char *));
+    if(sp == NULL || words == NULL) {
+	(*errp)++;
 	return NULL;
     }
     debug("(end step)");
-    sp->words[length] = NULL;
+    memcpy(words, p->words, length * sizeof(char *));
+    sp->words = words;
     return sp;
 }
 
@@ -354,20 +850,32 @@ static int is_delim(int c) {
  * subject to this quoting behavior; thus two backslashes in a row result in
  * a single backslash in the token.
  *
- * The caller is responsible for freeing any non-NULL token returned.
+ * The caller is responsible for releasing any non-NULL token returned
+ * with free_token.
  */
-static char *parse_token(FILE *in, int *errp) {
-    int c;
-    int bs = 0;  // Whether a backslash was just read.
-
+static char *parse_token(COOKBOOK_PARSER *p, int *errp) {
     // Check for a previously read token that was pushed back.
-    if(peek_token != NULL) {
-	char *w = peek_token;
-	peek_token = NULL;
+    if(p->peek_token != NULL) {
+	char *w = p->peek_token;
+	p->peek_token = NULL;
 	if(*w == '\0')
-	    lineno++;
+	    p->lineno++;
 	return w;
     }
+    if(p->in != NULL)
+	return read_token(p->in, &p->lineno);
+    char *w = scan_token(p);
+    if(w == NULL && !p->eof)
+	(*errp)++;      // Out of memory.
+    return w;
+}
+
+/*
+ * Read a token from a stream, into a malloc'ed string.
+ */
+static char *read_token(FILE *in, int *lineno) {
+    int c;
+    int bs = 0;  // Whether a backslash was just read.
 
     // Skip initial whitespace, stopping if a newline is encountered.
     while((c = fgetc(in)) != EOF && isspace(c) && c != '\n')
@@ -378,7 +886,7 @@ static char *parse_token(FILE *in, int *errp) {
     }
     if(c == '\n') {
 	debug("(NL)");
-	lineno++;
+	(*lineno)++;
 	return strdup("");
     }
 
@@ -481,22 +989,148 @@ static char *parse_token(FILE *in, int *errp) {
     return word;
 }
 
+/*
+ * Read a character of the buffer, as fgetc would from a stream.
+ */
+static int buf_getc(COOKBOOK_PARSER *p) {
+    if(p->held != EOF) {
+	int c = p->held;
+	p->held = EOF;
+	return c;
+    }
+    if(p->pos < p->end)
+	return (unsigned char)*p->pos++;
+    p->eof = 1;
+    return EOF;
+}
+
+/*
+ * Scan a token from the buffer.  Tokens are the same as read_token would
+ * return, but a token without backslashes is left in place: the character
+ * that ends it is held back for the next token and overwritten with a NUL.
+ * Delimiters and newlines are static strings.
+ *
+ * Returns NULL at EOF, or if memory could not be allocated.
+ */
+static char *scan_token(COOKBOOK_PARSER *p) {
+    int c;
+
+    // Skip initial whitespace, stopping if a newline is encountered.
+    while((c = buf_getc(p)) != EOF && isspace(c) && c != '\n')
+	;
+    if(c == EOF) {
+	debug("(EOF)");
+	return NULL;
+    }
+    if(c == '\n') {
+	debug("(NL)");
+	p->lineno++;
+	return "";
+    }
+    if(c == '<')
+	return "<";
+    if(c == '>')
+	return ">";
+    if(c == '|')
+	return "|";
+    if(c == ':')
+	return ":";
+
+    // A held character always ends a token, so c came from the buffer.
+    char *start = p->pos - 1;
+    char *q = p->pos;
+    while(q < p->end && !isspace((unsigned char)*q) && !is_delim(*q) && *q != '\\')
+	q++;
+    if(c != '\\' && q < p->end && *q != '\\') {
+	p->held = (unsigned char)*q;
+	*q = '\0';
+	p->pos = q + 1;
+	debug("WORD: %s", start);
+	return start;
+    }
+    return scan_escaped_token(p, c);
+}
+
+/*
+ * Scan the rest of a token that starts with c and contains a backslash,
+ * or runs to the end of the buffer, into a copy in the arena.
+ * This follows read_token character by character.
+ */
+static char *scan_escaped_token(COOKBOOK_PARSER *p, int c) {
+    int bs = 0;  // Whether a backslash was just read.
+    size_t length = 0;
+    do {
+	// Ensure space for another character.
+	if(grow(&p->text, &p->text_size, length + 2))
+	    return NULL;
+	// Check for EOF.
+	if(c == EOF) {
+	    debug("(EOF)");
+	    if(bs) {
+		p->text[length++] = '\\';
+		return arena_strndup(p->arena, p->text, length);
+	    }
+	}
+	// Check for newline.
+	if(c == '\n') {
+	    p->held = c;
+	    if(bs)
+		p->text[length++] = '\\';
+	    return arena_strndup(p->arena, p->text, length);
+	}
+	// Check for backslash character.
+	if(c == '\\') {
+	    if(bs) {
+		bs = 0;
+	    } else {
+		bs = 1;
+		c = buf_getc(p);
+		continue;
+	    }
+	}
+	// Check for delimiter characters, which end the token.
+	if(!bs && is_delim(c)) {
+	    p->held = c;  // Leave it for next time.
+	    return arena_strndup(p->arena, p->text, length);
+	}
+	// Check for space characters.
+	// These terminate the current token, but unless there is a
+	// preceding backslash they are never added to the token.
+	if(isspace(c)) {
+	    if(bs) {
+		bs = 0;
+		p->text[length++] = c;
+		c = buf_getc(p);
+	    } else {
+		break;
+	    }
+	}
+	// Default case: add character to token.
+	p->text[length++] = c;
+	c = buf_getc(p);
+    } while(c != EOF);
+    if(c != EOF && !isspace(c))
+	p->held = c;  // Leave it for next time.
+
+    // Finish up.
+    if(length == 0) {
+	// Only whitespace was read.
+	debug("(EMPTY)");
+	return "";
+    }
+    return arena_strndup(p->arena, p->text, length);
+}
+
 /*
  * Get the recipe with a given name from a cookbook.
  */
 
 static RECIPE *get_recipe(COOKBOOK *cbp, char *name) {
     /*
-     * We are just using inefficient linear search.
-     * If we want to do better, we could first create an index for
-     * the cookbook, in the form a of a hash table or sorted list of names
-     * that could be accessed using binary search.
+     * The first lookup builds a hash index of the cookbook, which is
+     * kept in the cookbook's state so that later lookups are O(1).
      */
-    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next) {
-	if(!strcmp(rp->name, name))
-	    return rp;
-    }
-    return NULL;
+    return cookbook_find_recipe(cbp, name);
 }
 
 /*
@@ -507,7 +1141,7 @@ static RECIPE *get_recipe(COOKBOOK *cbp, char *name) {
  * of the sub-recipes on which they depend.
  */
 
-static int set_dependencies(COOKBOOK *cbp) {
+static int set_dependencies(COOKBOOK_PARSER *p, COOKBOOK *cbp) {
     RECIPE *rp, *sp;
     for(rp = cbp->recipes; rp != NULL; rp = rp->next) {
 	debug("set_dependencies: %s", rp->name);
@@ -516,13 +1150,15 @@ static int set_dependencies(COOKBOOK *cbp) {
 	    debug("depends on: %s", rlp->name);
 	    sp = get_recipe(cbp, rlp->name);
 	    if(sp == NULL) {
-		fprintf(stderr, "Recipe %s depends on non-existent sub-recipe %s\n",
-			rp->name, rlp->name);
+		report(p, 0, "Recipe %s depends on non-existent sub-recipe %s\n",
+		       rp->name, rlp->name);
 		return 1;
 	    }
 	    debug("Set dependency: %s -> %s", rp->name, sp->name);
 	    rlp->recipe = sp;
-	    RECIPE_LINK *rlp1 = calloc(1, sizeof(RECIPE_LINK));
+	    RECIPE_LINK *rlp1 = new_node(p, sizeof(RECIPE_LINK));
+	    if(rlp1 == NULL)
+		return 1;
 	    rlp1->name = rp->name;
 	    rlp1->recipe = rp;
 	    rlp1->next = sp->depend_on_this;
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cookbook.h"
+#include "recipe_index.h"
+#include "debug.h"
+
+/*
+ * FNV-1a hash of a recipe name.
+ */
+unsigned long hash_name(const char *name) {
+    unsigned long h = 14695981039346656037UL;
+    while(*name != '\0') {
+	h ^= (unsigned char)*name++;
+	h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/*
+ * Build an index over a list of recipes, with its slots in the arena if
+ * one is given.
+ * Returns 0 on success, -1 if memory could not be allocated.
+ */
+int recipe_index_build(RECIPE_INDEX *idx, RECIPE *recipes, ARENA *arena) {
+    size_t n = 0;
+    for(RECIPE *rp = recipes; rp != NULL; rp = rp->next)
+	n++;
+    size_t cap = 16;
+    while(cap < 2 * n)
+	cap *= 2;
+    if(arena != NULL)
+	idx->slots = arena_alloc(arena, cap * sizeof(RECIPE *));
+    else
+	idx->slots = calloc(cap, sizeof(RECIPE *));
+    if(idx->slots == NULL)
+	return -1;
+    idx->capacity = cap;
+    idx->count = 0;
+    for(RECIPE *rp = recipes; rp != NULL; rp = rp->next) {
+	size_t i = hash_name(rp->name) & (cap - 1);
+	while(idx->slots[i] != NULL && strcmp(idx->slots[i]->name, rp->name))
+	    i = (i + 1) & (cap - 1);
+	// Keep the first recipe with a given name.
+	if(idx->slots[i] == NULL) {
+	    idx->slots[i] = rp;
+	    idx->count++;
+	}
+    }
+    debug("Indexed %zu recipes in %zu slots", idx->count, cap);
+    return 0;
+}
+
+/*
+ * Look up a name in an index.  Returns NULL if it is not present.
+ */
+RECIPE *recipe_index_lookup(RECIPE_INDEX *idx, const char *name) {
+    size_t mask = idx->capacity - 1;
+    size_t i = hash_name(name) & mask;
+    RECIPE *rp;
+    while((rp = idx->slots[i]) != NULL) {
+	if(!strcmp(rp->name, name))
+	    return rp;
+	i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+void recipe_index_free(RECIPE_INDEX *idx) {
+    free(idx->slots);
+    idx->slots = NULL;
+    idx->capacity = idx->count = 0;
+}
+
+RECIPE *cookbook_find_recipe(COOKBOOK *cbp, const char *name) {
+    COOKBOOK_STATE *cs = cbp->state;
+    if(cs == NULL) {
+	cs = calloc(1, sizeof(COOKBOOK_STATE));
+	if(cs != NULL && recipe_index_build(&cs->index, cbp->recipes, NULL)) {
+	    free(cs);
+	    cs = NULL;
+	}
+	cbp->state = cs;
+    } else if(cs->index.slots == NULL) {
+	// An arena cookbook gets its index from the same arena.
+	recipe_index_build(&cs->index, cbp->recipes, cs->arena);
+    }
+    if(cs != NULL && cs->index.slots != NULL)
+	return recipe_index_lookup(&cs->index, name);
+    // Out of memory: fall back to linear search.
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next) {
+	if(!strcmp(rp->name, name))
+	    return rp;
+    }
+    return NULL;
+}
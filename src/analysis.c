@@ -0,0 +1,333 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "analysis.h"
+
+
+#define ANALYSIS_GRAIN 1024 // smallest level worth splitting among the threads
+
+// what the threads do with the recipes of a level
+typedef enum analysis_phase {
+   PHASE_MARK,     // mark the sub-recipes of each as required, count its links
+   PHASE_LEVEL,    // release the dependents whose last unsorted sub-recipe it is
+   PHASE_EXIT
+} ANALYSIS_PHASE;
+
+// a growable array of recipes
+typedef struct recipe_list {
+   RECIPE **recipes;
+   int count;
+   int size;
+} RECIPE_LIST;
+
+struct analysis;
+
+// what one thread found in its slice of a level
+typedef struct analysis_slice {
+   struct analysis *analysis;
+   int id;                 // which slice of the level is this thread's
+   RECIPE_LIST next;       // recipes of the next level
+   RECIPE_LIST leaves;     // required recipes without sub-recipes (PHASE_MARK only)
+   int failed;             // a missing sub-recipe, or out of memory
+} ANALYSIS_SLICE;
+
+typedef struct analysis {
+   ANALYSIS_PHASE phase;
+   RECIPE **level;         // the level being worked on
+   int level_size;
+   int active;             // # of slices the level is split into
+   int num_threads;
+   ANALYSIS_SLICE *slices; // one per thread, the calling thread's first
+   pthread_t *threads;
+   int started;            // # of threads running besides the calling one
+   pthread_mutex_t setup;  // held until the barriers are set up for the threads that started
+   pthread_barrier_t start, done;
+} ANALYSIS;
+
+
+// append recipe to list. returns 0, or -1 if memory could not be allocated
+static int list_push(RECIPE_LIST *list, RECIPE *recipe)
+{
+   if (list->count == list->size)
+   {
+       int size = list->size > 0 ? 2 * list->size : 256;
+       RECIPE **recipes = realloc(list->recipes, size * sizeof(RECIPE *));
+       if (recipes == NULL)
+       {
+           return -1;
+       }
+       list->recipes = recipes;
+       list->size = size;
+   }
+   list->recipes[list->count++] = recipe;
+   return 0;
+}
+
+
+// append the count recipes at recipes to list. returns 0, or -1 if memory could not be allocated
+static int list_append(RECIPE_LIST *list, RECIPE **recipes, int count)
+{
+   if (count == 0)
+   {
+       return 0;
+   }
+   if (list->count + count > list->size)
+   {
+       int size = list->size > 0 ? list->size : 256;
+       while (size < list->count + count)
+       {
+           size *= 2;
+       }
+       RECIPE **grown = realloc(list->recipes, size * sizeof(RECIPE *));
+       if (grown == NULL)
+       {
+           return -1;
+       }
+       list->recipes = grown;
+       list->size = size;
+   }
+   memcpy(list->recipes + list->count, recipes, count * sizeof(RECIPE *));
+   list->count += count;
+   return 0;
+}
+
+
+/*
+   work through this thread's share of the level. the required flag is claimed
+   with an atomic exchange, so each newly required recipe goes to exactly one
+   thread's next level. likewise the last decrement of a recipe's unsorted_deps
+   is seen by one thread only, which puts it on the next topological level.
+*/
+static void work_on_slice(ANALYSIS_SLICE *slice)
+{
+   ANALYSIS *a = slice->analysis;
+   int begin = (long)a->level_size * slice->id / a->active;
+   int end = (long)a->level_size * (slice->id + 1) / a->active;
+
+   slice->next.count = 0;
+   for (int i = begin; i < end; i++)
+   {
+       RECIPE *rp = a->level[i];
+       RECIPE_STATE *state = (RECIPE_STATE *)rp->state;
+       if (a->phase == PHASE_MARK)
+       {
+           int links = 0;
+           for (RECIPE_LINK *link = rp->this_depends_on; link != NULL; link = link->next)
+           {
+               links++;
+               if (link->recipe == NULL)
+               {
+                   slice->failed = 1;
+                   continue;
+               }
+               RECIPE_STATE *sub_state = (RECIPE_STATE *)link->recipe->state;
+               if (!__atomic_exchange_n(&sub_state->required, 1, __ATOMIC_RELAXED) && list_push(&slice->next, link->recipe) != 0)
+               {
+                   slice->failed = 1;
+               }
+           }
+           state->pending_deps = links;
+           state->unsorted_deps = links;
+           if (links == 0 && list_push(&slice->leaves, rp) != 0)
+           {
+               slice->failed = 1;
+           }
+       }
+       else
+       {
+           for (RECIPE_LINK *link = rp->depend_on_this; link != NULL; link = link->next)
+           {
+               RECIPE_STATE *dependent_state = (RECIPE_STATE *)link->recipe->state;
+               if (dependent_state->required && __atomic_sub_fetch(&dependent_state->unsorted_deps, 1, __ATOMIC_RELAXED) == 0
+                   && list_push(&slice->next, link->recipe) != 0)
+               {
+                   slice->failed = 1;
+               }
+           }
+       }
+   }
+}
+
+
+static void *analysis_thread(void *arg)
+{
+   ANALYSIS_SLICE *slice = (ANALYSIS_SLICE *)arg;
+   ANALYSIS *a = slice->analysis;
+   pthread_mutex_lock(&a->setup);
+   pthread_mutex_unlock(&a->setup);
+   while (1)
+   {
+       pthread_barrier_wait(&a->start);
+       if (a->phase == PHASE_EXIT)
+       {
+           return NULL;
+       }
+       if (slice->id < a->active)
+       {
+           work_on_slice(slice);
+       }
+       pthread_barrier_wait(&a->done);
+   }
+}
+
+
+/*
+   work through a->level: on the calling thread alone while the level is
+   small, split among all the threads once it is not. the threads are only
+   started by the first level that needs them. afterwards the next level is
+   in the slices of threads 0 to a->active - 1.
+*/
+static void run_level(ANALYSIS *a)
+{
+   if (a->level_size >= ANALYSIS_GRAIN && a->num_threads > 1 && a->threads == NULL)
+   {
+       if ((a->threads = calloc(a->num_threads - 1, sizeof(pthread_t))) != NULL)
+       {
+           pthread_mutex_init(&a->setup, NULL);
+           pthread_mutex_lock(&a->setup);
+           while (a->started < a->num_threads - 1
+                  && pthread_create(&a->threads[a->started], NULL, analysis_thread, &a->slices[a->started + 1]) == 0)
+           {
+               a->started++;
+           }
+           // a thread that could not be started just leaves more for the others
+           pthread_barrier_init(&a->start, NULL, a->started + 1);
+           pthread_barrier_init(&a->done, NULL, a->started + 1);
+           pthread_mutex_unlock(&a->setup);
+       }
+   }
+
+   if (a->level_size >= ANALYSIS_GRAIN && a->started > 0)
+   {
+       a->active = a->started + 1;
+       pthread_barrier_wait(&a->start);
+       work_on_slice(&a->slices[0]);
+       pthread_barrier_wait(&a->done);
+   }
+   else
+   {
+       a->active = 1;
+       work_on_slice(&a->slices[0]);
+   }
+}
+
+
+// move the next level out of the slices & onto the end of list
+static int gather_level(ANALYSIS *a, RECIPE_LIST *list)
+{
+   int failed = 0;
+   for (int i = 0; i < a->active; i++)
+   {
+       failed |= list_append(list, a->slices[i].next.recipes, a->slices[i].next.count) != 0;
+   }
+   return failed ? -1 : 0;
+}
+
+
+/*
+   compute the required set, pending_deps & required_order on up to
+   num_threads threads. returns 0, or -1 if the analysis did not finish:
+   there is a cycle or a missing sub-recipe among the required recipes, or
+   memory could not be allocated. every recipe is then left unmarked, for
+   mark_required_recipes to go over again & report what went wrong.
+*/
+int mark_required_parallel(RECIPE *main_recipe, int num_threads)
+{
+   ANALYSIS a = { .num_threads = num_threads };
+   RECIPE_LIST marked = { 0 }, leaves = { 0 }, order = { 0 };
+   int failed = (a.slices = calloc(num_threads, sizeof(ANALYSIS_SLICE))) == NULL;
+   for (int i = 0; !failed && i < num_threads; i++)
+   {
+       a.slices[i].analysis = &a;
+       a.slices[i].id = i;
+   }
+
+   // breadth-first from the main recipe: each level is the recipes first reached from the one before
+   if (!failed)
+   {
+       ((RECIPE_STATE *)main_recipe->state)->required = 1;
+       failed = list_push(&marked, main_recipe) != 0;
+   }
+   int start = 0;
+   a.phase = PHASE_MARK;
+   while (!failed && start < marked.count)
+   {
+       a.level = marked.recipes + start;
+       a.level_size = marked.count - start;
+       run_level(&a);
+       start = marked.count;
+       failed = gather_level(&a, &marked) != 0;
+   }
+   for (int i = 0; !failed && i < num_threads; i++)
+   {
+       failed = a.slices[i].failed || list_append(&leaves, a.slices[i].leaves.recipes, a.slices[i].leaves.count) != 0;
+   }
+
+   // topological levels: the leaves, then each recipe once all of its sub-recipes are in the order
+   if (!failed)
+   {
+       failed = list_append(&order, leaves.recipes, leaves.count) != 0;
+   }
+   start = 0;
+   a.phase = PHASE_LEVEL;
+   while (!failed && start < order.count)
+   {
+       a.level = order.recipes + start;
+       a.level_size = order.count - start;
+       run_level(&a);
+       start = order.count;
+       failed = gather_level(&a, &order) != 0;
+   }
+   for (int i = 0; !failed && i < num_threads; i++)
+   {
+       failed = a.slices[i].failed;
+   }
+
+   if (a.started > 0)
+   {
+       a.phase = PHASE_EXIT;
+       pthread_barrier_wait(&a.start);
+       for (int i = 0; i < a.started; i++)
+       {
+           pthread_join(a.threads[i], NULL);
+       }
+   }
+   if (a.threads != NULL)
+   {
+       pthread_barrier_destroy(&a.start);
+       pthread_barrier_destroy(&a.done);
+       pthread_mutex_destroy(&a.setup);
+   }
+   free(a.threads);
+   for (int i = 0; a.slices != NULL && i < num_threads; i++)
+   {
+       free(a.slices[i].next.recipes);
+       free(a.slices[i].leaves.recipes);
+   }
+   free(a.slices);
+   free(leaves.recipes);
+
+   // recipes on a cycle never run out of unsorted sub-recipes, so they are missing from the order
+   if (failed || order.count != marked.count)
+   {
+       for (int i = 0; i < marked.count; i++)
+       {
+           RECIPE_STATE *state = (RECIPE_STATE *)marked.recipes[i]->state;
+           state->required = 0;
+           state->pending_deps = 0;
+           state->unsorted_deps = 0;
+       }
+       free(marked.recipes);
+       free(order.recipes);
+       return -1;
+   }
+
+   free(marked.recipes);
+   free(required_order);
+   required_order = order.recipes;
+   num_required_recipes = order.count;
+   return 0;
+}
@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "recipe_index.h"
+#include "command_table.h"
+
+
+/*
+   size the table for max_commands distinct commands at a load factor of at most
+   1/2 & open util/ for the lookups.
+   returns 0 on success, -1 if the slots could not be allocated.
+*/
+int command_table_init(COMMAND_TABLE *table, int max_commands)
+{
+   unsigned int capacity = 16;
+   while (capacity < 2u * (unsigned int)max_commands)
+   {
+       capacity *= 2;
+   }
+
+   table->slots = calloc(capacity, sizeof(COMMAND_ENTRY));
+   if (table->slots == NULL)
+   {
+       return -1;
+   }
+   table->capacity = capacity;
+   table->count = 0;
+   table->util_fd = open("util", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   return 0;
+}
+
+
+// slot holding name, or the empty slot where it belongs
+static COMMAND_ENTRY *find_slot(COMMAND_TABLE *table, const char *name)
+{
+   unsigned int i = hash_name(name) & (table->capacity - 1);
+   while (table->slots[i].name != NULL && strcmp(table->slots[i].name, name) != 0)
+   {
+       i = (i + 1) & (table->capacity - 1);
+   }
+   return &table->slots[i];
+}
+
+
+// malloc'd "dir/name"
+static char *join_path(const char *dir, size_t dir_len, const char *name)
+{
+   size_t name_len = strlen(name);
+   char *path = malloc(dir_len + 1 + name_len + 1);
+   if (path != NULL)
+   {
+       memcpy(path, dir, dir_len);
+       path[dir_len] = '/';
+       memcpy(path + dir_len + 1, name, name_len + 1);
+   }
+   return path;
+}
+
+
+/*
+   find what to execute for name, the same way the steps used to at exec time:
+   util/name if it is executable, else name itself if it contains a '/' (it may
+   not exist yet, e.g. a program built by an earlier recipe), else the first
+   executable name in a PATH directory.
+   sets *path to the result (NULL if nothing was found).
+   returns 0 on success, -1 if memory could not be allocated.
+*/
+static int find_command(COMMAND_TABLE *table, const char *name, char **path)
+{
+   *path = NULL;
+
+   if (table->util_fd != -1 && faccessat(table->util_fd, name, X_OK, 0) == 0)
+   {
+       *path = join_path("util", 4, name);
+       return (*path != NULL) ? 0 : -1;
+   }
+
+   if (strchr(name, '/') != NULL)
+   {
+       *path = strdup(name);
+       return (*path != NULL) ? 0 : -1;
+   }
+
+   // same default as execvp when PATH is unset
+   const char *search = getenv("PATH");
+   if (search == NULL)
+   {
+       search = "/bin:/usr/bin";
+   }
+   while (1)
+   {
+       const char *end = strchr(search, ':');
+       if (end == NULL)
+       {
+           end = search + strlen(search);
+       }
+       // an empty PATH entry means the current directory
+       char *candidate = (end == search) ? join_path(".", 1, name) : join_path(search, end - search, name);
+       if (candidate == NULL)
+       {
+           return -1;
+       }
+       if (access(candidate, X_OK) == 0)
+       {
+           *path = candidate;
+           return 0;
+       }
+       free(candidate);
+       if (*end == '\0')
+       {
+           return 0;
+       }
+       search = end + 1;
+   }
+}
+
+
+/*
+   resolve name, adding it to the table the first time it is seen.
+   sets *path to what to execute, or NULL if the command could not be found.
+   returns 0 on success, -1 if memory could not be allocated or the table is full.
+*/
+int command_table_resolve(COMMAND_TABLE *table, const char *name, const char **path)
+{
+   COMMAND_ENTRY *entry = find_slot(table, name);
+   if (entry->name == NULL)
+   {
+       if (2u * (unsigned int)(table->count + 1) > table->capacity)
+       {
+           errno = ENOSPC;
+           return -1;
+       }
+       if (find_command(table, name, &entry->path) != 0)
+       {
+           return -1;
+       }
+       entry->name = name;
+       table->count++;
+   }
+   *path = entry->path;
+   return 0;
+}
+
+
+// entry for name, or NULL if it was never resolved
+COMMAND_ENTRY *command_table_lookup(COMMAND_TABLE *table, const char *name)
+{
+   if (table->slots == NULL)
+   {
+       return NULL;
+   }
+   COMMAND_ENTRY *entry = find_slot(table, name);
+   return (entry->name != NULL) ? entry : NULL;
+}
+
+
+/*
+   what to execute for name when a step is started. a command found before the
+   run keeps the path found then. one that was not found (or not resolved at
+   all) is looked up again, as an earlier recipe may have installed it since,
+   & remembered once it is found.
+   returns the path, or NULL if the command can't be found.
+*/
+const char *command_table_path(COMMAND_TABLE *table, const char *name)
+{
+   const char *path = NULL;
+   if (table->slots == NULL || command_table_resolve(table, name, &path) != 0)
+   {
+       return NULL;
+   }
+   if (path == NULL)
+   {
+       COMMAND_ENTRY *entry = find_slot(table, name);
+       if (table->util_fd == -1)
+       {
+           // util/ itself may have been created since
+           table->util_fd = open("util", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+       }
+       if (find_command(table, name, &entry->path) != 0)
+       {
+           return NULL;
+       }
+       path = entry->path;
+   }
+   return path;
+}
+
+
+void command_table_free(COMMAND_TABLE *table)
+{
+   if (table->slots == NULL)
+   {
+       return; // never initialized
+   }
+   for (unsigned int i = 0; i < table->capacity; i++)
+   {
+       free(table->slots[i].path);
+   }
+   free(table->slots);
+   if (table->util_fd != -1)
+   {
+       close(table->util_fd);
+   }
+   memset(table, 0, sizeof(COMMAND_TABLE));
+}
@@ -1,4 +1,7 @@
+#define _GNU_SOURCE // posix_spawn_file_actions_addclosefrom_np
+
 #include <unistd.h>
+#include <spawn.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
@@ -6,73 +9,209 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/prctl.h>
+#include <signal.h>
 #include "cookbook.h"
+#include "cookbook_image.h"
+#include "cookbook_parser.h"
+#include "recipe_index.h"
+#include "pid_table.h"
+#include "ready_queue.h"
+#include "history.h"
+#include "command_table.h"
+#include "result_cache.h"
+#include "schedule.h"
+#include "analysis.h"
+#include "trace.h"
+#include "stats.h"
+#include "latency.h"
+#include "cook.h"
+#include "cook_state.h"
 
 
 //////////////////////////// header stuff ////////////////////////////
 
-// structure to hold the state of each recipe
-typedef struct recipe_state {
-   int required;       // indicates if the recipe is required for the main recipe
-   int processing;     // indicates if processing has started for this recipe
-   int completed;      // indicates if the recipe has been completed successfully
-   int failed;         // indicates if the recipe has failed
-   pid_t pid;          // process ID of the cook process handling this recipe
-} RECIPE_STATE;
-
-
-typedef struct work_queue_node
-{
-   RECIPE *recipe;
-   struct work_queue_node *next;
-} WORK_QUEUE_NODE;
-
-
-WORK_QUEUE_NODE *work_queue_head;
-WORK_QUEUE_NODE *work_queue_tail;
+READY_QUEUE work_queue; // recipes ready to be dispatched
+READY_QUEUE_ORDER work_queue_order = NULL; // dispatch order of the work queue (NULL for FIFO)
+COOK_SCHEDULE schedule_global = SCHEDULE_FIFO; // scheduling policy selected by init_work_queue
 
 COOKBOOK *cookbook_global;
-char *main_recipe_name_global;
+const char *main_recipe_name_global;
 int active_cooks = 0; // # of active cook processes
 int max_cooks_global = 1; // max cooks allowed
 sigset_t mask_all, mask_sigchld, prev_mask; // signal masks for syncronization
-
-void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *max_cooks, char **main_recipe_name);
-void enqueue_recipe(RECIPE *recipe);
-RECIPE *dequeue_recipe();
-int is_work_queue_empty();
-void process_recipe(RECIPE *recipe);
-int execute_task(TASK *task);
+PID_TABLE cook_pids; // pid -> recipe for every active cook process
+HISTORY cook_history; // recorded wall times, loaded by load_history
+const char *history_filename_global = NULL; // where the history is saved, or NULL to not record it
+COMMAND_TABLE commands; // resolved executable of every command of the required recipes
+COOK_ON_FAILURE on_failure_global = FAILURE_CONTINUE; // what to do once the main recipe is unreachable
+RECIPE *main_recipe_global;
+volatile sig_atomic_t main_unreachable = 0; // the main recipe has failed or been blocked
+static int recipe_states_used = 0; // a dependency analysis has written to the recipe states
+static int num_recipe_states = 0;  // size of the state array
+RECIPE **required_recipes = NULL;  // every required recipe, in cookbook order
+RECIPE **required_order = NULL;    // every required recipe, sub-recipes before the recipes needing them
+int num_required_recipes = 0;
+int analysis_threads_global = 1; // threads of the dependency analysis, 1 for the serial one
+
+extern char **environ;
 void sigchld_handler(int signo);
-int mark_required_recipes(RECIPE *recipe);
-int is_recipe_ready(RECIPE *recipe);
-RECIPE *find_recipe_by_pid(pid_t pid);
-RECIPE *find_recipe_by_name(COOKBOOK *cbp, const char *name);
+int mark_required_recipes(RECIPE *main_recipe);
+static int mark_required_from_image(COOKBOOK *cbp, RECIPE *main_recipe);
+int collect_required_recipes();
+int resolve_commands(COOKBOOK *cbp);
+void block_dependents(RECIPE *recipe);
+void sigalrm_handler(int signo);
+static long monotonic_us();
 
 //////////////////////////// header stuff ////////////////////////////
 
+#define CANCEL_GRACE_US 1000000 // time cooks get to exit after SIGTERM before fail-fast SIGKILLs them
+
+#define USAGE "Usage: cook [-f cookbook]... [-c max_cooks] [--threads=n] [--engine=signal|epoll] [--exec=cook|direct] [--on-failure=continue|keep-going|fail-fast] [--schedule=fifo|critical-path|history] [--history=file] [--cache=dir] [--workers=n] [--trace=file] [--stats[=file.csv]] [--latency-report] [--daemon=socket | --connect=socket] [main_recipe_name]\n       cook --compile cookbook [-o image]\n"
+
 
 /*
 handle the optional arguments
    -f cookbook:
        specifies the file containing the cookbook (.ckb file).
        if omitted, the default is cookbook.ckb in the current directory.
+       given more than once, the cookbook is split across the files, which are
+       parsed in parallel & then linked as one, so a recipe in one file may
+       depend on recipes in the others (see parse_cookbook_files). a recipe
+       name defined in two files is an error. the first file names the
+       cookbook in messages. images can't be combined this way.
 
    -c max_cooks:
        specifies the maximum number of cooks (parallel workers).
        if omitted, the default is 1.
 
+   --threads=n:
+       the # of threads parsing the files of a cookbook given with several -f,
+       & analyzing the dependencies of the main recipe (see analysis.c).
+       if omitted, the default is 1: the files are parsed & the analysis is
+       done on the calling thread alone. more threads only pay off for large
+       cookbooks.
+
+   --engine=signal|epoll:
+       selects the scheduler engine. "signal" (the default) reaps cooks in a
+       SIGCHLD handler around sigsuspend. "epoll" waits on a pidfd per cook
+       & does all queue & state updates in normal context (see event_loop.c).
+
+   --exec=cook|direct:
+       selects how a recipe's tasks are run. "cook" (the default) forks a cook
+       process per recipe, which runs the tasks & waits for their steps.
+       "direct" has the scheduler start every step itself & move a recipe on to
+       its next task when all steps of the current one have exited. it needs
+       --engine=epoll. -c still counts recipes, not steps.
+
+   --on-failure=continue|keep-going|fail-fast:
+       what to do once a failed recipe has made the main recipe unreachable.
+       "continue" (the default) keeps dispatching every ready recipe & waits
+       for all cooks. "keep-going" dispatches nothing more but lets the cooks in
+       flight finish. "fail-fast" also puts every cook (or with --exec=direct,
+       every task's steps) in a process group of its own, SIGTERMs the groups
+       in flight, SIGKILLs whatever is left a second later & exits.
+
+   --schedule=fifo|critical-path|history:
+       selects the dispatch order of ready recipes. "fifo" (the default) starts
+       them in the order they became ready. "critical-path" starts the recipe
+       with the heaviest remaining path to the main recipe first (see schedule.c).
+       "history" does the same with the wall times recorded in the history file,
+       so it requires --history.
+
+   --history=file:
+       reads per-recipe wall times from file before the run & writes the wall
+       times of this run's successful recipes back to it afterwards (see history.c).
+
+   --cache=dir:
+       incremental mode. a recipe whose fingerprint (tasks, input file contents &
+       sub-recipe fingerprints) matches an earlier successful run is completed
+       without running it, restoring its output files from dir if needed
+       (see result_cache.c). hits & misses are reported at exit.
+
+   --workers=n:
+       coordinator mode. the scheduler runs no recipes itself but sends them to
+       n worker processes over stream sockets, which report back when they are
+       done (see coordinator.c & worker.c). -c still limits the # of recipes in
+       flight & is split evenly into the capacity of the workers. a worker that
+       dies has its recipes re-queued on the others.
+       the --engine loop is not used. --exec=direct & fail-fast are not supported.
+
+   --trace=file:
+       writes a trace of the run to file in the Chrome trace event format, for
+       chrome://tracing or Perfetto (see trace.c). the scheduler's lane shows
+       recipes entering the work queue. each cook slot has a lane of its own
+       with the recipes it ran, from dispatch to completion, their tasks & the
+       exec & exit of every step. with --workers only the scheduler's side is
+       traced, & a cook killed by fail-fast loses the events it had buffered.
+
+   --stats[=file.csv]:
+       reaps every cook & step with wait4 & prints a table of the recipes that
+       ran at exit, most CPU first: the user & system CPU time of their steps
+       & how much of the recipe's wall time that was, the largest max RSS, page
+       faults & context switches of the steps, & the CPU time of the cook
+       itself (see stats.c). with a file the table is also written to it as
+       CSV. --workers reports nothing for its recipes.
+
+   --latency-report:
+       records how long recipes wait at each hand-off of the scheduler &
+       prints percentiles of each at exit: ready->dispatch (enqueued .. cook
+       forked), fork->exec (.. first step exec'd), exit->reap (cook exited ..
+       its completion taken up) & reap->enqueue (.. each dependent enqueued).
+       see latency.c.
+
+   --daemon=socket:
+       parses the cookbook once & serves runs of it on the Unix socket, each in
+       a process of its own (see daemon.c). the options of a run are those of
+       the client that sent it. SIGHUP makes the daemon load the cookbook again.
+       only the daemon's own user may connect.
+
+   --connect=socket:
+       client mode. forwards the command line, the working directory, the
+       environment & stdin/stdout/stderr to the daemon on socket & exits with
+       the status of the run. the cookbook is the daemon's; -f may only name
+       the same file.
+
+   --compile cookbook [-o image]:
+       parses & links cookbook & writes it out as an image (cookbook.ckbc by
+       default), then exits without running anything. -f accepts an image in
+       place of a cookbook & maps it instead of parsing (see cookbook_image.c).
+       an image whose cookbook has changed since it was compiled is refused.
+       a dependency cycle does not stop the compile: as with a parsed cookbook,
+       only a run that needs the recipes on it fails.
+
    main_recipe_name:
        specifies the main recipe to prepare.
        if omitted, the first recipe in the cookbook is used as the main recipe.
 if invalid options are provided, display usage information & exit.
 */
-void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *max_cooks, char **main_recipe_name)
+void parse_command_line(int argc, char *argv[], COOK_OPTIONS *options)
 {
    // set default values
-   *cookbook_filename = "cookbook.ckb"; // default cookbook filename
-   *max_cooks = 1;                      // default max cooks
-   *main_recipe_name = NULL;            // default main recipe name (use the first recipe if not provided)
+   options->cookbook_filename = "cookbook.ckb"; // default cookbook filename
+   options->cookbook_files = NULL;              // default: the one cookbook file
+   options->num_cookbook_files = 0;
+   options->threads = 1;                        // default: parse & analyze on one thread
+   options->max_cooks = 1;                      // default max cooks
+   options->main_recipe_name = NULL;            // default main recipe name (use the first recipe if not provided)
+   options->engine = ENGINE_SIGNAL;             // default engine
+   options->exec = EXEC_COOK;                   // default: one cook process per recipe
+   options->on_failure = FAILURE_CONTINUE;      // default: run everything that can run
+   options->schedule = SCHEDULE_FIFO;           // default schedule
+   options->history_filename = NULL;            // default: keep no history
+   options->cache_dir = NULL;                   // default: run every required recipe
+   options->trace_filename = NULL;              // default: no trace
+   options->stats = 0;                          // default: no resource usage report
+   options->stats_filename = NULL;
+   options->latency_report = 0;                 // default: no latency histograms
+   options->workers = 0;                        // default: run recipes in local cooks
+   options->daemon_socket = NULL;               // default: run once & exit
+   options->connect_socket = NULL;              // default: parse & run the cookbook here
+   options->compile_source = NULL;              // default: run a cookbook, don't compile one
+   options->compile_output = NULL;
 
    // index variable for looping through argv
    int i = 1;
@@ -92,12 +231,19 @@ void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *m
                // make sure there is a next argument for the filename
                if (i + 1 < argc)
                {
-                   *cookbook_filename = argv[++i]; // increment i & assign the filename
+                   // the first file is the cookbook's name, the rest are collected with it
+                   if (options->cookbook_files == NULL && (options->cookbook_files = malloc(argc * sizeof(char *))) == NULL)
+                   {
+                       perror("malloc");
+                       exit(EXIT_FAILURE);
+                   }
+                   options->cookbook_files[options->num_cookbook_files++] = argv[++i]; // increment i & assign the filename
+                   options->cookbook_filename = options->cookbook_files[0];
                }
                else
                {
                    fprintf(stderr, "Error: -f option requires a filename argument\n");
-                   fprintf(stderr, "Usage: cook [-f cookbook] [-c max_cooks] [main_recipe_name]\n");
+                   fprintf(stderr, USAGE);
                    exit(EXIT_FAILURE);
                }
            }
@@ -106,8 +252,8 @@ void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *m
                // make sure there is a next argument for the max cooks
                if (i + 1 < argc)
                {
-                   *max_cooks = atoi(argv[++i]); // increment i & assign the max cooks
-                   if (*max_cooks <= 0)
+                   options->max_cooks = atoi(argv[++i]); // increment i & assign the max cooks
+                   if (options->max_cooks <= 0)
                    {
                        fprintf(stderr, "Error: -c option requires a positive integer\n");
                        exit(EXIT_FAILURE);
@@ -116,7 +262,150 @@ void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *m
                else
                {
                    fprintf(stderr, "Error: -c option requires a number argument\n");
-                   fprintf(stderr, "Usage: cook [-f cookbook] [-c max_cooks] [main_recipe_name]\n");
+                   fprintf(stderr, USAGE);
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strcmp(arg, "--compile") == 0 || strcmp(arg, "-o") == 0)
+           {
+               if (i + 1 < argc)
+               {
+                   if (arg[1] == 'o')
+                   {
+                       options->compile_output = argv[++i];
+                   }
+                   else
+                   {
+                       options->compile_source = argv[++i];
+                   }
+               }
+               else
+               {
+                   fprintf(stderr, "Error: %s option requires a filename argument\n", arg);
+                   fprintf(stderr, USAGE);
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strncmp(arg, "--engine=", 9) == 0)
+           {
+               if (strcmp(arg + 9, "signal") == 0)
+               {
+                   options->engine = ENGINE_SIGNAL;
+               }
+               else if (strcmp(arg + 9, "epoll") == 0)
+               {
+                   options->engine = ENGINE_EPOLL;
+               }
+               else
+               {
+                   fprintf(stderr, "Error: Unknown engine '%s' (expected 'signal' or 'epoll')\n", arg + 9);
+                   fprintf(stderr, USAGE);
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strncmp(arg, "--exec=", 7) == 0)
+           {
+               if (strcmp(arg + 7, "cook") == 0)
+               {
+                   options->exec = EXEC_COOK;
+               }
+               else if (strcmp(arg + 7, "direct") == 0)
+               {
+                   options->exec = EXEC_DIRECT;
+               }
+               else
+               {
+                   fprintf(stderr, "Error: Unknown exec mode '%s' (expected 'cook' or 'direct')\n", arg + 7);
+                   fprintf(stderr, USAGE);
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strncmp(arg, "--on-failure=", 13) == 0)
+           {
+               if (strcmp(arg + 13, "continue") == 0)
+               {
+                   options->on_failure = FAILURE_CONTINUE;
+               }
+               else if (strcmp(arg + 13, "keep-going") == 0)
+               {
+                   options->on_failure = FAILURE_KEEP_GOING;
+               }
+               else if (strcmp(arg + 13, "fail-fast") == 0)
+               {
+                   options->on_failure = FAILURE_FAIL_FAST;
+               }
+               else
+               {
+                   fprintf(stderr, "Error: Unknown failure mode '%s' (expected 'continue', 'keep-going' or 'fail-fast')\n", arg + 13);
+                   fprintf(stderr, USAGE);
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strncmp(arg, "--schedule=", 11) == 0)
+           {
+               if (strcmp(arg + 11, "fifo") == 0)
+               {
+                   options->schedule = SCHEDULE_FIFO;
+               }
+               else if (strcmp(arg + 11, "critical-path") == 0)
+               {
+                   options->schedule = SCHEDULE_CRITICAL_PATH;
+               }
+               else if (strcmp(arg + 11, "history") == 0)
+               {
+                   options->schedule = SCHEDULE_HISTORY;
+               }
+               else
+               {
+                   fprintf(stderr, "Error: Unknown schedule '%s' (expected 'fifo', 'critical-path' or 'history')\n", arg + 11);
+                   fprintf(stderr, USAGE);
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strncmp(arg, "--history=", 10) == 0 && arg[10] != '\0')
+           {
+               options->history_filename = arg + 10;
+           }
+           else if (strncmp(arg, "--cache=", 8) == 0 && arg[8] != '\0')
+           {
+               options->cache_dir = arg + 8;
+           }
+           else if (strcmp(arg, "--stats") == 0 || (strncmp(arg, "--stats=", 8) == 0 && arg[8] != '\0'))
+           {
+               options->stats = 1;
+               options->stats_filename = (arg[7] == '=') ? arg + 8 : NULL;
+           }
+           else if (strcmp(arg, "--latency-report") == 0)
+           {
+               options->latency_report = 1;
+           }
+           else if (strncmp(arg, "--trace=", 8) == 0 && arg[8] != '\0')
+           {
+               options->trace_filename = arg + 8;
+           }
+           else if (strncmp(arg, "--daemon=", 9) == 0 && arg[9] != '\0')
+           {
+               options->daemon_socket = arg + 9;
+           }
+           else if (strncmp(arg, "--connect=", 10) == 0 && arg[10] != '\0')
+           {
+               options->connect_socket = arg + 10;
+           }
+           else if (strncmp(arg, "--threads=", 10) == 0)
+           {
+               options->threads = atoi(arg + 10);
+               if (options->threads <= 0)
+               {
+                   fprintf(stderr, "Error: --threads option requires a positive integer\n");
+                   exit(EXIT_FAILURE);
+               }
+           }
+           else if (strncmp(arg, "--workers=", 10) == 0)
+           {
+               options->workers = atoi(arg + 10);
+               if (options->workers <= 0)
+               {
+                   fprintf(stderr, "Error: --workers option requires a positive integer\n");
                    exit(EXIT_FAILURE);
                }
            }
@@ -124,34 +413,227 @@ void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *m
            {
                // unknown option
                fprintf(stderr, "Error: Unknown option '%s'\n", arg);
-               fprintf(stderr, "Usage: cook [-f cookbook] [-c max_cooks] [main_recipe_name]\n");
+               fprintf(stderr, USAGE);
                exit(EXIT_FAILURE);
            }
        }
        else
        {
            // not an option. treat it as the main recipe name
-           if (*main_recipe_name == NULL)
+           if (options->main_recipe_name == NULL)
            {
-               *main_recipe_name = arg;
+               options->main_recipe_name = arg;
            }
            else
            {
                // multiple main recipe names provided
-               fprintf(stderr, "Error: Multiple main recipe names provided ('%s' and '%s')\n", *main_recipe_name, arg);
-               fprintf(stderr, "Usage: cook [-f cookbook] [-c max_cooks] [main_recipe_name]\n");
+               fprintf(stderr, "Error: Multiple main recipe names provided ('%s' and '%s')\n", options->main_recipe_name, arg);
+               fprintf(stderr, USAGE);
                exit(EXIT_FAILURE);
            }
        }
        i++; // move to the next argument
    }
+
+   if (options->exec == EXEC_DIRECT && options->engine != ENGINE_EPOLL)
+   {
+       fprintf(stderr, "Error: --exec=direct requires --engine=epoll\n");
+       fprintf(stderr, USAGE);
+       exit(EXIT_FAILURE);
+   }
+
+   if (options->workers > 0 && (options->exec == EXEC_DIRECT || options->on_failure == FAILURE_FAIL_FAST))
+   {
+       fprintf(stderr, "Error: --workers does not support --exec=direct or --on-failure=fail-fast\n");
+       fprintf(stderr, USAGE);
+       exit(EXIT_FAILURE);
+   }
+
+   if (options->daemon_socket != NULL && options->connect_socket != NULL)
+   {
+       fprintf(stderr, "Error: --daemon & --connect can't be used together\n");
+       fprintf(stderr, USAGE);
+       exit(EXIT_FAILURE);
+   }
+
+   if (options->compile_output != NULL && options->compile_source == NULL)
+   {
+       fprintf(stderr, "Error: -o requires --compile\n");
+       fprintf(stderr, USAGE);
+       exit(EXIT_FAILURE);
+   }
+
+   if (options->schedule == SCHEDULE_HISTORY && options->history_filename == NULL)
+   {
+       fprintf(stderr, "Error: --schedule=history requires --history=file\n");
+       fprintf(stderr, USAGE);
+       exit(EXIT_FAILURE);
+   }
+}
+
+
+/*
+   free what parse_command_line allocated, once the options are done with.
+   the file names themselves are argv's, so cookbook_filename stays valid.
+*/
+void free_options(COOK_OPTIONS *options)
+{
+   free(options->cookbook_files);
+   options->cookbook_files = NULL;
+   options->num_cookbook_files = 0;
+}
+
+
+/*
+   load the cookbook in filename into arena: map it if it is a compiled image,
+   otherwise map & parse it. pipes & the like are read as a stream & parsed
+   into malloc'd memory instead. errors are reported here.
+   returns the cookbook, or NULL if it could not be loaded or did not parse.
+*/
+COOKBOOK *load_cookbook(const char *filename, ARENA *arena)
+{
+   COOKBOOK *cbp;
+   int err = 0;
+   FILE *in;
+
+   if (cookbook_image_is_image(filename))
+   {
+       return cookbook_image_load(filename, arena, &err);
+   }
+
+   errno = 0;
+   if ((cbp = parse_cookbook_file(filename, arena, &err)) == NULL && errno == ENODEV && (in = fopen(filename, "r")) != NULL)
+   {
+       cbp = parse_cookbook(in, &err);
+       fclose(in); // close the file after parsing
+   }
+   if (cbp == NULL)
+   {
+       fprintf(stderr, "Can't open cookbook '%s': %s\n", filename, strerror(errno));
+       return NULL;
+   }
+   if (err)
+   {
+       fprintf(stderr, "Error parsing cookbook '%s'\n", filename);
+       free_cookbook(cbp);
+       return NULL;
+   }
+   return cbp;
+}
+
+
+/*
+   load the cookbook the options name into arena. a cookbook given with
+   several -f is parsed from all of its files in parallel, on up to
+   options->threads threads. errors are reported here.
+   returns the cookbook, or NULL if it could not be loaded or did not parse.
+*/
+COOKBOOK *load_cookbooks(COOK_OPTIONS *options, ARENA *arena)
+{
+   if (options->num_cookbook_files <= 1)
+   {
+       return load_cookbook(options->cookbook_filename, arena);
+   }
+
+   for (int i = 0; i < options->num_cookbook_files; i++)
+   {
+       if (cookbook_image_is_image(options->cookbook_files[i]))
+       {
+           fprintf(stderr, "Error: image '%s' can't be combined with other cookbook files\n", options->cookbook_files[i]);
+           return NULL;
+       }
+   }
+
+   int err;
+   COOKBOOK *cbp = parse_cookbook_files(options->cookbook_files, options->num_cookbook_files, options->threads, arena, &err);
+   if (cbp == NULL)
+   {
+       fprintf(stderr, "Can't load cookbook '%s' (%d files)\n", options->cookbook_filename, options->num_cookbook_files);
+       arena_reset(arena);
+       return NULL;
+   }
+   if (err)
+   {
+       fprintf(stderr, "Error parsing cookbook '%s' (%d files)\n", options->cookbook_filename, options->num_cookbook_files);
+       free_cookbook(cbp);
+       return NULL;
+   }
+   return cbp;
+}
+
+
+/*
+   run the cookbook as the options say: pick & check the main recipe, load the
+   history, analyze the dependencies & process the recipes. does not return,
+   process_recipes exits with the status of the run.
+*/
+void run_cookbook(COOKBOOK *cbp, COOK_OPTIONS *options)
+{
+   // if main_recipe_name is NULL, set it to the name of the first recipe in the cookbook
+   if (options->main_recipe_name == NULL)
+   {
+       if (cbp->recipes != NULL)
+       {
+           options->main_recipe_name = cbp->recipes->name;
+       }
+       else
+       {
+           fprintf(stderr, "Error: Cookbook '%s' contains no recipes\n", options->cookbook_filename);
+           exit(EXIT_FAILURE);
+       }
+   }
+   else if (find_recipe_by_name(cbp, options->main_recipe_name) == NULL)
+   {
+       // resolved through the cookbook's name index built by the parser
+       fprintf(stderr, "Error: Main recipe '%s' not found in cookbook '%s'\n", options->main_recipe_name, options->cookbook_filename);
+       exit(EXIT_FAILURE);
+   }
+
+   // read the recorded wall times of earlier runs
+   if (options->history_filename != NULL && load_history(options->history_filename) != 0)
+   {
+       fprintf(stderr, "Error loading history '%s'\n", options->history_filename);
+       exit(EXIT_FAILURE);
+   }
+
+   // opened before the analysis, which enqueues the leaves
+   if (options->trace_filename != NULL && trace_open(options->trace_filename) != 0)
+   {
+       exit(EXIT_FAILURE);
+   }
+   if (options->latency_report && latency_open() != 0)
+   {
+       exit(EXIT_FAILURE);
+   }
+
+   // initialize the work queue to manage recipes ready for processing
+   init_work_queue(options->schedule);
+
+   // do an analysis to determine all sub-recipes required by the main recipe
+   analysis_threads_global = options->threads;
+   if (perform_dependency_analysis(cbp, options->main_recipe_name) != 0)
+   {
+       fprintf(stderr, "Error during dependency analysis\n");
+       exit(EXIT_FAILURE);
+   }
+
+   // call process_recipes to start the main processing loop
+   process_recipes(cbp, options);
+}
+
+
+// read the duration history & remember where to save it after the run
+int load_history(const char *path)
+{
+   history_filename_global = path;
+   return history_load(&cook_history, path);
 }
 
 
 /*
    find the main recipe. start from the main recipe & identify all sub-recipes required
    initialize state for all recipes
-   recursively mark required recipes starting from the main recipe
+   mark required recipes starting from the main recipe
    enqueue leaf recipes into the work queue
 
    search for the main recipe by name or default to the first recipe.
@@ -159,15 +641,17 @@ void parse_command_line(int argc, char *argv[], char **cookbook_filename, int *m
    allocate a RECIPE_STATE structure for each recipe to track
    its status throughout execution.
 
-   recursively mark all recipes required by the main recipe.
+   mark all recipes required by the main recipe, putting them in topological
+   order & refusing a cookbook whose required recipes form a cycle.
    involves traversing this_depends_on links.
    */
-int perform_dependency_analysis(COOKBOOK *cbp, char *main_recipe_name)
+int perform_dependency_analysis(COOKBOOK *cbp, const char *main_recipe_name)
 {
    RECIPE *main_recipe = NULL;
 
    cookbook_global = cbp;
    main_recipe_name_global = main_recipe_name;
+   main_unreachable = 0;
 
    // find the main recipe by name
    main_recipe = find_recipe_by_name(cbp, main_recipe_name);
@@ -178,29 +662,72 @@ int perform_dependency_analysis(COOKBOOK *cbp, char *main_recipe_name)
    }
 
    // initialize state for all recipes
-   for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+   if (reset_recipe_states(cbp) != 0)
    {
-       RECIPE_STATE *state = calloc(1, sizeof(RECIPE_STATE));
-       if (state == NULL)
-       {
-           perror("calloc");
-           return -1;
-       }
-       rp->state = state;
+       perror("calloc");
+       return -1;
+   }
+   recipe_states_used = 1;
+
+   // mark required recipes starting from the main recipe, unless the image the
+   // cookbook is mapped from has them already. the parallel analysis leaves
+   // whatever it can't handle to the serial one, which reports it
+   if (!mark_required_from_image(cbp, main_recipe)
+       && (analysis_threads_global <= 1 || mark_required_parallel(main_recipe, analysis_threads_global) != 0)
+       && mark_required_recipes(main_recipe) != 0)
+   {
+       return -1;
    }
 
-   // recursively mark required recipes starting from the main recipe
-   if (mark_required_recipes(main_recipe) != 0)
+   // from here on only the required recipes are visited, so the cost of a run
+   // does not grow with the recipes of the cookbook it never needs
+   if (collect_required_recipes() != 0)
    {
+       perror("calloc");
        return -1;
    }
 
 
-   // enqueue leaf recipes (required recipes with no dependencies)
-   for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+   // size the work queue for every required recipe. each one is enqueued at most once
+   // at a time, so enqueue_recipe never needs to allocate
+   int num_required = num_required_recipes;
+   ready_queue_free(&work_queue);
+   if (ready_queue_init(&work_queue, num_required, work_queue_order) != 0)
+   {
+       perror("calloc");
+       return -1;
+   }
+
+   // look up every command once, before any cook is forked
+   if (resolve_commands(cbp) != 0)
+   {
+       return -1;
+   }
+   main_recipe_global = main_recipe;
+   main_unreachable = ((RECIPE_STATE *)main_recipe->state)->failed || ((RECIPE_STATE *)main_recipe->state)->blocked;
+
+   // the priorities must be in place before the leaves are pushed onto the heap
+   if (schedule_global != SCHEDULE_FIFO)
+   {
+       if (schedule_global == SCHEDULE_HISTORY)
+       {
+           assign_history_weights(required_order, num_required, &cook_history);
+       }
+       else
+       {
+           assign_structural_weights(required_order, num_required);
+       }
+       compute_critical_path(required_order, num_required);
+   }
+
+
+   // enqueue leaf recipes (required recipes with no dependencies). the marking
+   // counted the links of each required recipe into its pending_deps
+   for (int i = 0; i < num_required_recipes; i++)
    {
+       RECIPE *rp = required_recipes[i];
        RECIPE_STATE *state = (RECIPE_STATE *)rp->state;
-       if (state->required && rp->this_depends_on == NULL)
+       if (state->pending_deps == 0 && !state->failed && !state->blocked)
        {
            enqueue_recipe(rp);
        }
@@ -209,110 +736,360 @@ int perform_dependency_analysis(COOKBOOK *cbp, char *main_recipe_name)
    return 0;
 }
 
-int is_work_queue_empty()
+/*
+   when cbp is mapped from an image whose root is main_recipe, every recipe
+   is required. their pending_deps & required_order then come straight from
+   the image's CSR edges & topological order, in one pass over arrays instead
+   of a walk of the graph (see cookbook_image.h).
+   returns 1 if it marked the recipes, 0 if they have to be found by a walk.
+*/
+static int mark_required_from_image(COOKBOOK *cbp, RECIPE *main_recipe)
 {
-    return (work_queue_head == NULL);
+   const uint32_t *topo, *dep_start;
+   uint64_t n = cookbook_image_closure(cbp, main_recipe, &topo, &dep_start);
+   RECIPE **order = (n > 0) ? malloc(n * sizeof(RECIPE *)) : NULL;
+   if (order == NULL)
+   {
+       return 0; // the walk reports a failed allocation
+   }
+
+   for (uint64_t i = 0; i < n; i++)
+   {
+       RECIPE *rp = &cbp->recipes[topo[i]];
+       RECIPE_STATE *state = (RECIPE_STATE *)rp->state;
+       state->required = 1;
+       state->pending_deps = dep_start[topo[i] + 1] - dep_start[topo[i]];
+       order[i] = rp;
+   }
+   free(required_order);
+   required_order = order;
+   num_required_recipes = n;
+   return 1;
 }
 
 
-// returns the RECIPE pointer if found. otherwise returns NULL
-RECIPE *find_recipe_by_name(COOKBOOK *cbp, const char *name)
+/*
+   give every recipe a zeroed RECIPE_STATE. the states of a cookbook live in one
+   array, allocated the first time & only cleared again once an analysis has
+   used them. a run forked from the daemon inherits states that were never
+   used, so it neither clears nor copies the array. the array of an arena
+   cookbook comes from its arena & goes with it. returns 0, or -1 if the
+   allocation failed.
+*/
+int reset_recipe_states(COOKBOOK *cbp)
 {
-   for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+   if (cbp->recipes == NULL)
+   {
+       return 0;
+   }
+
+   RECIPE_STATE *states = (RECIPE_STATE *)cbp->recipes->state;
+   if (states != NULL)
    {
-       if (strcmp(rp->name, name) == 0)
+       if (recipe_states_used)
        {
-           return rp;
+           memset(states, 0, num_recipe_states * sizeof(RECIPE_STATE));
        }
+       return 0;
    }
-   return NULL;
+
+   int num_recipes = 0;
+   for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+   {
+       num_recipes++;
+   }
+   num_recipe_states = num_recipes;
+   COOKBOOK_STATE *cs = (COOKBOOK_STATE *)cbp->state;
+   if (cs != NULL && cs->arena != NULL)
+   {
+       states = arena_alloc(cs->arena, num_recipes * sizeof(RECIPE_STATE));
+   }
+   else
+   {
+       states = calloc(num_recipes, sizeof(RECIPE_STATE));
+   }
+   if (states == NULL)
+   {
+       return -1;
+   }
+   for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+   {
+       rp->state = states++;
+   }
+   return 0;
 }
 
 
-/*
-   base case: if already required, return
-   mark recipe as required
-   recursively mark all sub-recipes
-*/
-int mark_required_recipes(RECIPE *recipe)
+int is_work_queue_empty()
 {
-   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+    return (work_queue.count == 0);
+}
+
+
+// returns the RECIPE pointer if found. otherwise returns NULL
+// lookups go through the cookbook's hash index (see recipe_index.h)
+RECIPE *find_recipe_by_name(COOKBOOK *cbp, const char *name)
+{
+   return cookbook_find_recipe(cbp, name);
+}
+
 
+// a recipe on the path explored by mark_required_recipes & the next of its links to follow
+typedef struct mark_frame
+{
+   RECIPE *recipe;
+   RECIPE_LINK *link;
+} MARK_FRAME;
 
-   if (state->required)
+
+// report the cycle closed by a link to recipe, which is on the stack below the top
+static void report_cycle(MARK_FRAME *stack, int depth, RECIPE *recipe)
+{
+   int i = depth - 1;
+   while (stack[i].recipe != recipe)
    {
-       // already marked as required. avoid infinite recursion
-       return 0;
+       i--;
    }
+   fprintf(stderr, "Error: Dependency cycle: ");
+   for (; i < depth; i++)
+   {
+       fprintf(stderr, "%s -> ", stack[i].recipe->name);
+   }
+   fprintf(stderr, "%s\n", recipe->name);
+}
 
 
-   state->required = 1; // mark as required
-
+/*
+   mark the main recipe & everything it depends on as required, without
+   recursion: a depth-first search with an explicit stack, so the depth of the
+   cookbook is limited by memory only. a recipe is visiting (gray) while it is
+   on the stack & done (black) once all its sub-recipes are, at which point it
+   is appended to required_order. that puts every sub-recipe before the
+   recipes that need it. a link to a recipe that is still visiting closes a
+   dependency cycle, which is reported with the recipes on it.
+   each required recipe is pushed & each of its links followed once, & counted
+   into its pending_deps, since every sub-recipe of a required recipe is itself
+   required.
+   returns 0, or -1 on a cycle, a missing sub-recipe or if memory could not be allocated.
+*/
+int mark_required_recipes(RECIPE *main_recipe)
+{
+   int depth = 0, stack_size = 64, order_size = 64, status = 0;
+   MARK_FRAME *stack = malloc(stack_size * sizeof(MARK_FRAME));
+   free(required_order);
+   required_order = malloc(order_size * sizeof(RECIPE *));
+   num_required_recipes = 0;
+   if (stack == NULL || required_order == NULL)
+   {
+       perror("malloc");
+       free(stack);
+       return -1;
+   }
 
-   // recursively mark all sub-recipes
-   for (RECIPE_LINK *link = recipe->this_depends_on; link != NULL; link = link->next)
+   RECIPE_STATE *state = (RECIPE_STATE *)main_recipe->state;
+   state->required = 1;
+   state->visiting = 1;
+   stack[depth++] = (MARK_FRAME){ main_recipe, main_recipe->this_depends_on };
+   while (depth > 0)
    {
+       MARK_FRAME *top = &stack[depth - 1];
+       RECIPE_LINK *link = top->link;
+
+       // all sub-recipes done: so is this recipe
+       if (link == NULL)
+       {
+           if (num_required_recipes == order_size)
+           {
+               RECIPE **order = realloc(required_order, 2 * order_size * sizeof(RECIPE *));
+               if (order == NULL)
+               {
+                   perror("realloc");
+                   status = -1;
+                   break;
+               }
+               required_order = order;
+               order_size *= 2;
+           }
+           ((RECIPE_STATE *)top->recipe->state)->visiting = 0;
+           required_order[num_required_recipes++] = top->recipe;
+           depth--;
+           continue;
+       }
+
+       top->link = link->next;
+       ((RECIPE_STATE *)top->recipe->state)->pending_deps++;
        RECIPE *sub_recipe = link->recipe;
        if (sub_recipe == NULL)
        {
-           fprintf(stderr, "Error: Recipe '%s' depends on non-existent recipe '%s'\n", recipe->name, link->name);
-           return -1;
+           fprintf(stderr, "Error: Recipe '%s' depends on non-existent recipe '%s'\n", top->recipe->name, link->name);
+           status = -1;
+           break;
        }
-       if (mark_required_recipes(sub_recipe) != 0)
+       state = (RECIPE_STATE *)sub_recipe->state;
+       if (state->visiting)
        {
-           return -1;
+           report_cycle(stack, depth, sub_recipe);
+           status = -1;
+           break;
+       }
+       if (state->required)
+       {
+           continue; // reached before by another path
+       }
+
+       if (depth == stack_size)
+       {
+           MARK_FRAME *frames = realloc(stack, 2 * stack_size * sizeof(MARK_FRAME));
+           if (frames == NULL)
+           {
+               perror("realloc");
+               status = -1;
+               break;
+           }
+           stack = frames;
+           stack_size *= 2;
        }
+       state->required = 1;
+       state->visiting = 1;
+       stack[depth++] = (MARK_FRAME){ sub_recipe, sub_recipe->this_depends_on };
    }
 
+   free(stack);
+   return status;
+}
+
 
+/*
+   resolve the command of every step of every required recipe into the command
+   table, so no step looks in util/ or walks PATH at exec time.
+   a command that cannot be found yet is not an error: an earlier recipe may
+   install it, so it is looked up again when its step is started.
+   returns 0 on success, -1 if memory could not be allocated.
+*/
+int resolve_commands(COOKBOOK *cbp)
+{
+   // every step may name a different command
+   int num_steps = 0;
+   for (int i = 0; i < num_required_recipes; i++)
+   {
+       RECIPE *rp = required_recipes[i];
+       for (TASK *task = rp->tasks; task != NULL; task = task->next)
+       {
+           for (STEP *step = task->steps; step != NULL; step = step->next)
+           {
+               num_steps++;
+           }
+       }
+   }
+
+   command_table_free(&commands);
+   if (command_table_init(&commands, num_steps) != 0)
+   {
+       perror("calloc");
+       return -1;
+   }
+
+   for (int i = 0; i < num_required_recipes; i++)
+   {
+       for (TASK *task = required_recipes[i]->tasks; task != NULL; task = task->next)
+       {
+           for (STEP *step = task->steps; step != NULL; step = step->next)
+           {
+               const char *path;
+               if (command_table_resolve(&commands, step->words[0], &path) != 0)
+               {
+                   perror("command_table_resolve");
+                   return -1;
+               }
+           }
+       }
+   }
    return 0;
 }
 
 
-void init_work_queue()
+// the states are one array in cookbook order, so their addresses order the recipes
+static int compare_recipe_position(const void *a, const void *b)
 {
-   work_queue_head = NULL;
-   work_queue_tail = NULL;
+   const RECIPE_STATE *sa = (*(RECIPE * const *)a)->state;
+   const RECIPE_STATE *sb = (*(RECIPE * const *)b)->state;
+   return (sa > sb) - (sa < sb);
 }
 
 
-void enqueue_recipe(RECIPE *recipe)
+/*
+   copy the recipes marked by mark_required_recipes into the required_recipes
+   array, sorted into cookbook order, so the passes over it enqueue leaves &
+   report errors in the same order as a scan of the cookbook.
+   returns 0, or -1 if memory could not be allocated.
+*/
+int collect_required_recipes()
 {
-   WORK_QUEUE_NODE *node = malloc(sizeof(WORK_QUEUE_NODE));
-   if (node == NULL)
+   free(required_recipes);
+   required_recipes = calloc(num_required_recipes > 0 ? num_required_recipes : 1, sizeof(RECIPE *));
+   if (required_recipes == NULL)
    {
-       perror("malloc");
-       exit(EXIT_FAILURE);
+       return -1;
    }
-   node->recipe = recipe;
-   node->next = NULL;
-
-
-   if (work_queue_tail == NULL)
+   if (num_required_recipes == num_recipe_states)
    {
-       // queue is empty
-       work_queue_head = node;
+       // every recipe is required, so each one's place is that of its state
+       RECIPE_STATE *states = (RECIPE_STATE *)cookbook_global->recipes->state;
+       for (int i = 0; i < num_required_recipes; i++)
+       {
+           required_recipes[(RECIPE_STATE *)required_order[i]->state - states] = required_order[i];
+       }
+       return 0;
    }
-   else
+   memcpy(required_recipes, required_order, num_required_recipes * sizeof(RECIPE *));
+   qsort(required_recipes, num_required_recipes, sizeof(RECIPE *), compare_recipe_position);
+   return 0;
+}
+
+
+void init_work_queue(COOK_SCHEDULE schedule)
+{
+   schedule_global = schedule;
+   work_queue_order = (schedule != SCHEDULE_FIFO) ? critical_path_order : NULL;
+
+   // storage is allocated by perform_dependency_analysis once the # of required recipes is known
+   ready_queue_free(&work_queue);
+}
+
+
+void enqueue_recipe(RECIPE *recipe)
+{
+   trace_event(TRACE_QUEUE, TRACE_SCHEDULER, recipe->name, 0, 0);
+   ((RECIPE_STATE *)recipe->state)->ready_ns = latency_now();
+   if (ready_queue_push(&work_queue, recipe) != 0)
    {
-       work_queue_tail->next = node;
+       // cannot happen: the queue has room for every required recipe
+       fprintf(stderr, "Error: work queue overflow\n");
+       exit(EXIT_FAILURE);
    }
-   work_queue_tail = node;
 }
 
 
 RECIPE *dequeue_recipe() {
-   if (work_queue_head == NULL) {
-       return NULL;
-   }
+   return ready_queue_pop(&work_queue);
+}
 
-   WORK_QUEUE_NODE *node = work_queue_head;
-   RECIPE *recipe = node->recipe;
-   work_queue_head = node->next;
-   if (work_queue_head == NULL) {
-       work_queue_tail = NULL;
+
+/*
+   dequeue the next recipe that has to run. recipes the result cache finds up to
+   date are completed on the spot, which may enqueue their dependents, & skipped.
+   returns NULL once the work queue is empty.
+*/
+RECIPE *dequeue_recipe_to_run()
+{
+   RECIPE *recipe;
+   while ((recipe = dequeue_recipe()) != NULL && result_cache_restore(recipe))
+   {
+       RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+       state->cached = 1;
+       state->start_us = monotonic_us();
+       complete_recipe(recipe, 0);
    }
-   free(node);
    return recipe;
 }
 
@@ -327,26 +1104,311 @@ void debug_print(COOKBOOK *cbp){
        }
    }
 
-   // testing: print recipes in the work queue (leaf recipes)
-   printf("\nRecipes in the work queue (leaf recipes):\n");
-   WORK_QUEUE_NODE *current = work_queue_head;
-   while (current != NULL) {
-       printf(" - %s\n", current->recipe->name);
-       current = current->next;
+   // testing: print recipes in the work queue (leaf recipes)
+   printf("\nRecipes in the work queue (leaf recipes):\n");
+   for (int i = 0; i < work_queue.count; i++) {
+       printf(" - %s\n", ready_queue_at(&work_queue, i)->name);
+   }
+
+
+   // empty the work queue
+   while (!is_work_queue_empty()) {
+       dequeue_recipe();
+   }
+}
+
+// monotonic clock in microseconds. async-signal-safe, so complete_recipe can call it
+static long monotonic_us()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+
+// mark recipe as running under pid (0 for direct exec) & count it against max_cooks
+void begin_recipe(RECIPE *recipe, pid_t pid)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   state->processing = 1;
+   state->pid = pid;
+   state->start_us = monotonic_us();
+   active_cooks++;
+}
+
+
+/*
+   fork a cook process for recipe.
+   the child restores child_mask, resets SIGCHLD to its default disposition,
+   processes the recipe & exits with its status. the parent marks the recipe as
+   processing & counts the new cook. on fork failure the recipe is re-enqueued
+   & -1 is returned.
+*/
+pid_t start_cook(RECIPE *recipe, const sigset_t *child_mask)
+{
+   trace_dispatch(recipe);
+   latency_dispatch(recipe);
+   pid_t pid = fork();
+   if (pid == -1)
+   {
+       perror("fork");
+       // re-enqueue the recipe if the fork failed
+       trace_complete(recipe, 1);
+       enqueue_recipe(recipe);
+       return -1;
+   }
+   else if (pid == 0)
+   {
+       // child process (cook process)
+       trace_enter_cook(recipe);
+       stats_enter_cook(recipe);
+       latency_expect_exec(recipe);
+
+       // fail-fast kills the cook together with its steps through its process group
+       if (on_failure_global == FAILURE_FAIL_FAST)
+       {
+           setpgid(0, 0);
+       }
+
+       // unblock signals
+       sigprocmask(SIG_SETMASK, child_mask, NULL);
+
+       // reset SIGCHLD handler to default in the cook process
+       struct sigaction sa_default;
+       sa_default.sa_handler = SIG_DFL;
+       sigemptyset(&sa_default.sa_mask);
+       sa_default.sa_flags = 0;
+       if (sigaction(SIGCHLD, &sa_default, NULL) == -1)
+       {
+           perror("sigaction");
+           exit(EXIT_FAILURE);
+       }
+
+       // now proceed to process the recipe
+       process_recipe(recipe);
+
+       // exit with status based on recipe success or failure
+       RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+       if (!state->failed)
+       {
+           result_cache_store(recipe);
+       }
+       trace_flush();
+       latency_cook_exit(recipe);
+       exit(state->failed ? EXIT_FAILURE : EXIT_SUCCESS);
+   }
+
+   // parent process
+   // update recipe state
+   begin_recipe(recipe, pid);
+   if (on_failure_global == FAILURE_FAIL_FAST)
+   {
+       // also done here, so the group exists before the parent can signal it
+       setpgid(pid, pid);
+       ((RECIPE_STATE *)recipe->state)->pgid = pid;
+   }
+   return pid;
+}
+
+
+// exit status for the whole run: success iff the main recipe was neither failed nor blocked
+int main_recipe_status(COOKBOOK *cbp)
+{
+   RECIPE *main_recipe = find_recipe_by_name(cbp, main_recipe_name_global);
+   RECIPE_STATE *main_state = (RECIPE_STATE *)main_recipe->state;
+   return (main_state->failed || main_state->blocked) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*
+   fold the wall times of this run's successful recipes into the history & save it.
+   runs once, after the last cook has been reaped. a failure to save is reported
+   but does not change the exit status.
+*/
+static void save_history(void)
+{
+   if (history_filename_global == NULL)
+   {
+       return;
+   }
+   for (int i = 0; i < num_required_recipes; i++)
+   {
+       RECIPE_STATE *state = (RECIPE_STATE *)required_order[i]->state;
+       if (state->completed && !state->cached && history_record(&cook_history, required_order[i], state->duration_us) != 0)
+       {
+           return;
+       }
+   }
+   history_save(&cook_history, history_filename_global);
+}
+
+
+// whether ready recipes may still be started. only --on-failure=continue dispatches once the main recipe is unreachable
+int may_dispatch()
+{
+   return on_failure_global == FAILURE_CONTINUE || !main_unreachable;
+}
+
+
+// whether fail-fast is cancelling the run. recipes in flight must not start another task
+int fail_fast_cancelled()
+{
+   return on_failure_global == FAILURE_FAIL_FAST && main_unreachable;
+}
+
+
+// process groups that were in flight when fail-fast cancelled the run
+static pid_t *cancelled_groups = NULL;
+static int num_cancelled_groups = 0;
+static long cancel_deadline_us = 0;  // when the groups get SIGKILL
+static int cancel_killed = 0;
+
+
+static void signal_cancelled_groups(int signo)
+{
+   for (int i = 0; i < num_cancelled_groups; i++)
+   {
+       kill(-cancelled_groups[i], signo);
+   }
+}
+
+
+/*
+   fail-fast cancellation, driven by the engine loops on every iteration.
+   the first call after the main recipe became unreachable records the process
+   group of every recipe in flight & SIGTERMs them. the first call after the
+   grace period SIGKILLs the groups.
+   returns the # of ms until the SIGKILL is due, or -1 if there is nothing to wait for.
+*/
+int cancel_in_flight()
+{
+   if (!fail_fast_cancelled() || cancel_killed)
+   {
+       return -1;
+   }
+
+   long now = monotonic_us();
+   if (cancel_deadline_us == 0)
+   {
+       cancelled_groups = calloc(max_cooks_global, sizeof(pid_t));
+       if (cancelled_groups == NULL)
+       {
+           perror("calloc");
+           exit(EXIT_FAILURE);
+       }
+       // only required recipes are ever dispatched
+       for (int i = 0; i < num_required_recipes; i++)
+       {
+           RECIPE_STATE *state = (RECIPE_STATE *)required_order[i]->state;
+           if (state->processing && state->pgid > 0 && num_cancelled_groups < max_cooks_global)
+           {
+               cancelled_groups[num_cancelled_groups++] = state->pgid;
+           }
+       }
+       signal_cancelled_groups(SIGTERM);
+       cancel_deadline_us = now + CANCEL_GRACE_US;
+   }
+   else if (now >= cancel_deadline_us)
+   {
+       signal_cancelled_groups(SIGKILL);
+       cancel_killed = 1;
+       return -1;
+   }
+   return (int)((cancel_deadline_us - now + 999) / 1000);
+}
+
+
+/*
+   a cook killed by SIGTERM is reaped at once, but steps that ignore SIGTERM
+   live on in its process group. wait until every cancelled group is gone,
+   SIGKILLing them once the grace period is over. fail-fast makes the scheduler
+   the subreaper of its descendants, so the orphaned steps are reaped here.
+   give up a grace period after the SIGKILL, in case some never are.
+*/
+static void wait_cancelled_groups()
+{
+   struct timespec poll_interval = { 0, 10 * 1000 * 1000 };
+   for (int i = 0; i < num_cancelled_groups; i++)
+   {
+       while (kill(-cancelled_groups[i], 0) == 0 && monotonic_us() < cancel_deadline_us + CANCEL_GRACE_US)
+       {
+           while (waitpid(-cancelled_groups[i], NULL, WNOHANG) > 0)
+           {
+               // reap the group's zombies, so they stop counting as members
+           }
+           if (!cancel_killed && monotonic_us() >= cancel_deadline_us)
+           {
+               signal_cancelled_groups(SIGKILL);
+               cancel_killed = 1;
+           }
+           nanosleep(&poll_interval, NULL);
+       }
+   }
+   free(cancelled_groups);
+   cancelled_groups = NULL;
+   num_cancelled_groups = 0;
+}
+
+
+// only interrupts sigsuspend when a fail-fast SIGKILL is due
+void sigalrm_handler(int signo)
+{
+}
+
+
+// save the history, report the cache & exit with the status of the main recipe
+static void finish_run(COOKBOOK *cbp)
+{
+   wait_cancelled_groups();
+   save_history();
+   result_cache_report(stderr);
+   stats_report(stderr);
+   latency_report(stderr);
+   trace_close();
+   exit(main_recipe_status(cbp));
+}
+
+
+// "main processing loop"
+void process_recipes(COOKBOOK *cbp, COOK_OPTIONS *options)
+{
+   // set the global max_cooks variable
+   max_cooks_global = options->max_cooks;
+   on_failure_global = options->on_failure;
+
+   // orphaned steps of a cancelled cook are reparented to us instead of init, so
+   // wait_cancelled_groups can tell when they are gone
+   if (on_failure_global == FAILURE_FAIL_FAST)
+   {
+       prctl(PR_SET_CHILD_SUBREAPER, 1);
+   }
+
+   if (options->cache_dir != NULL && result_cache_open(options->cache_dir) != 0)
+   {
+       exit(EXIT_FAILURE);
+   }
+
+   // before the first cook is forked, so every cook shares the totals
+   if (options->stats && stats_init(required_order, num_required_recipes, options->stats_filename) != 0)
+   {
+       exit(EXIT_FAILURE);
+   }
+   if (latency_track(required_order, num_required_recipes) != 0)
+   {
+       exit(EXIT_FAILURE);
    }
 
-
-   // clean up the work queue to prevent memory leaks
-   while (work_queue_head != NULL) {
-       dequeue_recipe();
+   if (options->workers > 0)
+   {
+       run_coordinator(cbp, options->workers, (options->max_cooks + options->workers - 1) / options->workers);
+       finish_run(cbp);
    }
-}
 
-// "main processing loop"
-void process_recipes(COOKBOOK *cbp, int max_cooks)
-{
-   // set the global max_cooks variable
-   max_cooks_global = max_cooks;
+   if (options->engine == ENGINE_EPOLL)
+   {
+       run_event_loop(cbp, options->exec == EXEC_DIRECT);
+       finish_run(cbp);
+   }
 
 
    // set up signal handling for SIGCHLD
@@ -361,6 +1423,27 @@ void process_recipes(COOKBOOK *cbp, int max_cooks)
    }
 
 
+   // one slot per possible cook. sized here so the handler never allocates
+   if (pid_table_init(&cook_pids, max_cooks_global) != 0)
+   {
+       perror("calloc");
+       exit(EXIT_FAILURE);
+   }
+
+
+   // the sigsuspend loop needs a timer to wake up for a fail-fast SIGKILL
+   if (on_failure_global == FAILURE_FAIL_FAST)
+   {
+       sa.sa_handler = sigalrm_handler;
+       sa.sa_flags = 0;
+       if (sigaction(SIGALRM, &sa, NULL) == -1)
+       {
+           perror("sigaction");
+           exit(EXIT_FAILURE);
+       }
+   }
+
+
    // initialize signal masks
    sigfillset(&mask_all);             // mask all signals
    sigemptyset(&mask_sigchld);        // empty mask
@@ -374,8 +1457,17 @@ void process_recipes(COOKBOOK *cbp, int max_cooks)
        sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_mask);
 
 
+       // on the failure that dooms the main recipe, fail-fast stops the cooks in flight
+       int cancel_ms = cancel_in_flight();
+       if (cancel_ms >= 0)
+       {
+           struct itimerval timer = { { 0, 0 }, { cancel_ms / 1000, (cancel_ms % 1000) * 1000 + 1 } };
+           setitimer(ITIMER_REAL, &timer, NULL);
+       }
+
+
        // check if processing is complete
-       if (is_work_queue_empty() && active_cooks == 0)
+       if ((is_work_queue_empty() || !may_dispatch()) && active_cooks == 0)
        {
            // all recipes have been processed
            sigprocmask(SIG_SETMASK, &prev_mask, NULL); // restore previous mask
@@ -384,53 +1476,16 @@ void process_recipes(COOKBOOK *cbp, int max_cooks)
 
 
        // start new cook processes if possible
-       if (!is_work_queue_empty() && active_cooks < max_cooks_global)
+       if (!is_work_queue_empty() && active_cooks < max_cooks_global && may_dispatch())
        {
-           RECIPE *recipe = dequeue_recipe();
+           RECIPE *recipe = dequeue_recipe_to_run();
            if (recipe != NULL)
            {
                // start a new cook process
-               pid_t pid = fork();
-               if (pid == -1)
-               {
-                   perror("fork");
-                   // re-enqueue the recipe if the fork failed
-                   enqueue_recipe(recipe);
-               }
-               else if (pid == 0)
-                {
-                    // child process (cook process)
-
-                    // unblock signals
-                    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
-
-                    // reset SIGCHLD handler to default in the cook process
-                    struct sigaction sa_default;
-                    sa_default.sa_handler = SIG_DFL;
-                    sigemptyset(&sa_default.sa_mask);
-                    sa_default.sa_flags = 0;
-                    if (sigaction(SIGCHLD, &sa_default, NULL) == -1)
-                    {
-                        perror("sigaction");
-                        exit(EXIT_FAILURE);
-                    }
-
-                    // now proceed to process the recipe
-                    process_recipe(recipe);
-
-                    // exit with status based on recipe success or failure
-                    RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
-                    exit(state->failed ? EXIT_FAILURE : EXIT_SUCCESS);
-                }
-
-               else
+               pid_t pid = start_cook(recipe, &prev_mask);
+               if (pid > 0)
                {
-                   // parent process
-                   // update recipe state
-                   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
-                   state->processing = 1;
-                   state->pid = pid;
-                   active_cooks++;
+                   pid_table_insert(&cook_pids, pid, recipe);
                }
            }
        }
@@ -446,13 +1501,7 @@ void process_recipes(COOKBOOK *cbp, int max_cooks)
 
    // after processing, check if the main recipe completed successfully
    // & set the exit status
-   RECIPE *main_recipe = find_recipe_by_name(cbp, main_recipe_name_global);
-   RECIPE_STATE *main_state = (RECIPE_STATE *)main_recipe->state;
-   if (main_state->failed) {
-       exit(EXIT_FAILURE);
-   } else {
-       exit(EXIT_SUCCESS);
-   }
+   finish_run(cbp);
 }
 
 
@@ -460,13 +1509,14 @@ void sigchld_handler(int signo)
 {
    pid_t pid;
    int status;
+   struct rusage usage;
 
 
    // reap all terminated child processes
-   while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+   while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0)
    {
        // find the recipe corresponding to this PID
-       RECIPE *recipe = find_recipe_by_pid(pid);
+       RECIPE *recipe = pid_table_remove(&cook_pids, pid);
        if (recipe == NULL)
        {
            // unknown child process. possibly a step in a pipeline
@@ -475,69 +1525,91 @@ void sigchld_handler(int signo)
 
 
        RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
-       if (WIFEXITED(status))
-       {
-           int exit_status = WEXITSTATUS(status);
-           if (exit_status == 0)
-           {
-               // recipe completed successfully
-               state->completed = 1;
-           }
-           else
-           {
-               // recipe failed
-               state->failed = 1;
-           }
-       }
-       else if (WIFSIGNALED(status))
-       {
-           // recipe process terminated by a signal
-           state->failed = 1;
-       }
-       state->processing = 0;
        state->pid = 0;
        active_cooks--;
+       stats_cook_reaped(recipe, &usage);
 
-
-       // enqueue dependent recipes if they are now ready
-       for (RECIPE_LINK *link = recipe->depend_on_this; link != NULL; link = link->next)
-       {
-           RECIPE *dependent_recipe = link->recipe;
-           if (is_recipe_ready(dependent_recipe))
-           {
-               enqueue_recipe(dependent_recipe);
-           }
-       }
+       // a cook fails if it exits nonzero or is terminated by a signal
+       complete_recipe(recipe, !WIFEXITED(status) || WEXITSTATUS(status) != 0);
    }
 }
 
 
-int is_recipe_ready(RECIPE *recipe) {
+/*
+   record the outcome of a recipe whose cook has terminated.
+   on success, count down the remaining dependencies of each required dependent
+   & enqueue the ones that reach zero. each completion costs O(fan-out).
+   on failure, every recipe that transitively depends on this one is blocked.
+*/
+void complete_recipe(RECIPE *recipe, int failed)
+{
    RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
-   if (!state->required || state->processing || state->completed || state->failed) {
-       return 0; // not ready
+   if (state->processing)
+   {
+       trace_complete(recipe, failed);
+       stats_complete(recipe, monotonic_us() - state->start_us);
+       latency_reaped(recipe);
+   }
+   state->processing = 0;
+
+   if (failed)
+   {
+       state->failed = 1;
+       block_dependents(recipe);
+       RECIPE_STATE *main_state = (RECIPE_STATE *)main_recipe_global->state;
+       main_unreachable = main_state->failed || main_state->blocked;
+       return;
    }
-   // check if all dependencies are completed successfully
-   for (RECIPE_LINK *link = recipe->this_depends_on; link != NULL; link = link->next) {
-       RECIPE *dep_recipe = link->recipe;
-       RECIPE_STATE *dep_state = (RECIPE_STATE *)dep_recipe->state;
-       if (!dep_state->completed) {
-           return 0; // dependency not completed
+
+   state->completed = 1;
+   state->duration_us = monotonic_us() - state->start_us;
+   for (RECIPE_LINK *link = recipe->depend_on_this; link != NULL; link = link->next)
+   {
+       RECIPE *dependent_recipe = link->recipe;
+       RECIPE_STATE *dependent_state = (RECIPE_STATE *)dependent_recipe->state;
+       if (!dependent_state->required || dependent_state->blocked || dependent_state->failed)
+       {
+           continue;
+       }
+       if (--dependent_state->pending_deps == 0)
+       {
+           enqueue_recipe(dependent_recipe);
+           latency_record(LATENCY_REAP_ENQUEUE, state->reaped_ns);
        }
    }
-   return 1; // ready to be processed
 }
 
 
-RECIPE *find_recipe_by_pid(pid_t pid) {
-   // iterate over all recipes to find the one with the matching PID
-   for (RECIPE *rp = cookbook_global->recipes; rp != NULL; rp = rp->next) {
-       RECIPE_STATE *state = (RECIPE_STATE *)rp->state;
-       if (state->pid == pid) {
-           return rp;
+/*
+   mark all required recipes that transitively depend on recipe as blocked.
+   walks depend_on_this with a worklist threaded through the recipe states,
+   so it neither recurses nor allocates (it runs inside the SIGCHLD handler).
+   a blocked recipe has not been enqueued (it still had a pending dependency)
+   & never will be.
+*/
+void block_dependents(RECIPE *recipe)
+{
+   RECIPE *worklist = recipe;
+   ((RECIPE_STATE *)recipe->state)->next_blocked = NULL;
+
+   while (worklist != NULL)
+   {
+       RECIPE *rp = worklist;
+       worklist = ((RECIPE_STATE *)rp->state)->next_blocked;
+
+       for (RECIPE_LINK *link = rp->depend_on_this; link != NULL; link = link->next)
+       {
+           RECIPE *dependent_recipe = link->recipe;
+           RECIPE_STATE *dependent_state = (RECIPE_STATE *)dependent_recipe->state;
+           if (!dependent_state->required || dependent_state->blocked)
+           {
+               continue;
+           }
+           dependent_state->blocked = 1;
+           dependent_state->next_blocked = worklist;
+           worklist = dependent_recipe;
        }
    }
-   return NULL; // recipe not found
 }
 
 
@@ -559,80 +1631,144 @@ void process_recipe(RECIPE *recipe) {
 }
 
 
-int execute_task(TASK *task)
+/*
+   start one step of a pipeline with posix_spawn, reading from in_fd & writing to
+   out_fd (-1 leaves the cook's stdin/stdout). posix_spawn creates the child
+   vfork-style, so its cost does not grow with the cook's address space.
+   the file actions dup2 the pipe ends into place & close every other descriptor.
+   with a non-NULL pgid the step is put in process group *pgid, or in a new
+   group of its own if *pgid is 0, in which case *pgid is set to its pid.
+   the path resolve_commands found for the command is executed as is. only a
+   command it did not find is looked up in util/ & PATH again here.
+   returns the pid of the step, or -1 if it could not be started.
+*/
+static pid_t spawn_step(STEP *step, int in_fd, int out_fd, pid_t *pgid)
 {
-   STEP *step;
-   int num_steps = 0;
-   int i = 0;
-   int status = 0;
-   int task_failed = 0;
-   pid_t *child_pids = NULL;
-   int **pipes = NULL;
-   int input_fd = -1;
-   int output_fd = -1;
+   posix_spawn_file_actions_t actions;
+   posix_spawnattr_t attr;
+   if (posix_spawn_file_actions_init(&actions) != 0 || posix_spawnattr_init(&attr) != 0)
+   {
+       perror("posix_spawn_file_actions_init");
+       return -1;
+   }
+   int err = 0;
+   if (pgid != NULL)
+   {
+       err |= posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+       err |= posix_spawnattr_setpgroup(&attr, *pgid);
+   }
+   if (in_fd != -1)
+   {
+       err |= posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+   }
+   if (out_fd != -1)
+   {
+       err |= posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+   }
+   err |= posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+   if (err != 0)
+   {
+       fprintf(stderr, "Error: Cannot set up step '%s'\n", step->words[0]);
+       posix_spawn_file_actions_destroy(&actions);
+       posix_spawnattr_destroy(&attr);
+       return -1;
+   }
 
+   // execute the command resolved up front, or found since
+   const char *command = command_table_path(&commands, step->words[0]);
+   pid_t pid;
+   if (command == NULL)
+   {
+       command = step->words[0];
+       err = ENOENT;
+   }
+   else
+   {
+       err = posix_spawn(&pid, command, &actions, &attr, step->words, environ);
+   }
+   posix_spawn_file_actions_destroy(&actions);
+   posix_spawnattr_destroy(&attr);
 
-   // count the number of steps in the task
-   for (step = task->steps; step != NULL; step = step->next)
+   if (err != 0)
    {
-       num_steps++;
+       fprintf(stderr, "Error: Failed to execute '%s': %s\n", command, strerror(err));
+       return -1;
+   }
+   if (pgid != NULL && *pgid == 0)
+   {
+       *pgid = pid; // the first step leads the group
    }
+   return pid;
+}
 
 
-   if (num_steps == 0)
+// close the descriptors of a task that the cook still holds (-1 marks closed ones)
+static void close_task_fds(int *pipe_fds, int num_pipe_fds, int input_fd, int output_fd)
+{
+   if (input_fd != -1)
+       close(input_fd);
+   if (output_fd != -1)
+       close(output_fd);
+   for (int i = 0; i < num_pipe_fds; i++)
    {
-       // no steps to execute
-       return 0;
+       if (pipe_fds[i] != -1)
+       {
+           close(pipe_fds[i]);
+       }
    }
+}
 
 
-   // allocate arrays for child PIDs & pipes
-   child_pids = malloc(num_steps * sizeof(pid_t));
-   if (child_pids == NULL)
+// # of steps in task
+int count_steps(TASK *task)
+{
+   int num_steps = 0;
+   for (STEP *step = task->steps; step != NULL; step = step->next)
    {
-       perror("malloc");
-       return -1;
+       num_steps++;
+   }
+   return num_steps;
+}
+
+
+/*
+   start the num_steps steps of task as a pipeline without waiting for them.
+   child_pids needs room for num_steps pids & pipe_fds for 2 * (num_steps - 1)
+   descriptors. pipe i is pipe_fds[2 * i] (read) & pipe_fds[2 * i + 1] (write).
+   all descriptors are closed again before returning.
+   pgid is passed on to spawn_step for every step (NULL leaves the steps in the
+   caller's process group).
+   a step that cannot be started gets pid -1 & counts as a step that exited with
+   EXIT_FAILURE, as when exec failed in a forked child. the rest of the pipeline
+   still runs.
+   returns 0 if every step was started, EXIT_FAILURE if some step was not, or -1
+   if the task could not be set up (no step was started).
+*/
+int start_task(TASK *task, int num_steps, pid_t *child_pids, int *pipe_fds, pid_t *pgid)
+{
+   STEP *step;
+   int i = 0;
+   int task_exit_status = 0;
+   int input_fd = -1;
+   int output_fd = -1;
+   int num_pipe_fds = 2 * (num_steps - 1);
+
+
+   for (i = 0; i < num_pipe_fds; i++)
+   {
+       pipe_fds[i] = -1;
    }
 
 
-   if (num_steps > 1)
+   // create the pipes
+   for (i = 0; i < num_steps - 1; i++)
    {
-       pipes = malloc((num_steps - 1) * sizeof(int *));
-       if (pipes == NULL)
+       if (pipe(&pipe_fds[2 * i]) == -1)
        {
-           perror("malloc");
-           free(child_pids);
+           perror("pipe");
+           close_task_fds(pipe_fds, num_pipe_fds, input_fd, output_fd);
            return -1;
        }
-       for (i = 0; i < num_steps - 1; i++)
-       {
-           pipes[i] = malloc(2 * sizeof(int));
-           if (pipes[i] == NULL)
-           {
-               perror("malloc");
-               // free previously allocated pipes
-               for (int j = 0; j < i; j++)
-               {
-                   free(pipes[j]);
-               }
-               free(pipes);
-               free(child_pids);
-               return -1;
-           }
-           // create the pipe
-           if (pipe(pipes[i]) == -1)
-           {
-               perror("pipe");
-               // free allocated resources
-               for (int j = 0; j <= i; j++)
-               {
-                   free(pipes[j]);
-               }
-               free(pipes);
-               free(child_pids);
-               return -1;
-           }
-       }
    }
 
 
@@ -643,18 +1779,7 @@ int execute_task(TASK *task)
        if (input_fd == -1)
        {
            fprintf(stderr, "Error: Cannot open input file '%s': %s\n", task->input_file, strerror(errno));
-           // clean up resources
-           if (pipes != NULL)
-           {
-               for (i = 0; i < num_steps - 1; i++)
-               {
-                   close(pipes[i][0]);
-                   close(pipes[i][1]);
-                   free(pipes[i]);
-               }
-               free(pipes);
-           }
-           free(child_pids);
+           close_task_fds(pipe_fds, num_pipe_fds, input_fd, output_fd);
            return -1;
        }
    }
@@ -667,143 +1792,42 @@ int execute_task(TASK *task)
        if (output_fd == -1)
        {
            fprintf(stderr, "Error: Cannot open output file '%s': %s\n", task->output_file, strerror(errno));
-           // clean up resources
-           if (input_fd != -1)
-               close(input_fd);
-           if (pipes != NULL)
-           {
-               for (i = 0; i < num_steps - 1; i++)
-               {
-                   close(pipes[i][0]);
-                   close(pipes[i][1]);
-                   free(pipes[i]);
-               }
-               free(pipes);
-           }
-           free(child_pids);
+           close_task_fds(pipe_fds, num_pipe_fds, input_fd, output_fd);
            return -1;
        }
    }
 
 
-   // reset step pointer
+   // start every step
    step = task->steps;
    for (i = 0; i < num_steps; i++)
    {
-       pid_t pid = fork();
-       if (pid == -1)
+       int in_fd = (i == 0) ? input_fd : pipe_fds[2 * (i - 1)];
+       int out_fd = (i == num_steps - 1) ? output_fd : pipe_fds[2 * i + 1];
+
+       child_pids[i] = spawn_step(step, in_fd, out_fd, pgid);
+       if (child_pids[i] == -1)
        {
-           perror("fork");
-           task_failed = 1;
-           break;
+           task_exit_status = EXIT_FAILURE;
        }
-       else if (pid == 0)
+       else
        {
-           // child process
-           // set up input redirection
-           if (i == 0)
-           {
-               // first step
-               if (input_fd != -1)
-               {
-                   if (dup2(input_fd, STDIN_FILENO) == -1)
-                   {
-                       perror("dup2");
-                       exit(EXIT_FAILURE);
-                   }
-               }
-           }
-           else
-           {
-               // not the first step, get input from previous pipe
-               if (dup2(pipes[i - 1][0], STDIN_FILENO) == -1)
-               {
-                   perror("dup2");
-                   exit(EXIT_FAILURE);
-               }
-           }
-
-
-           // set up output redirection
-           if (i == num_steps - 1)
-           {
-               // last step
-               if (output_fd != -1)
-               {
-                   if (dup2(output_fd, STDOUT_FILENO) == -1)
-                   {
-                       perror("dup2");
-                       exit(EXIT_FAILURE);
-                   }
-               }
-           }
-           else
-           {
-               // not the last step, output to next pipe
-               if (dup2(pipes[i][1], STDOUT_FILENO) == -1)
-               {
-                   perror("dup2");
-                   exit(EXIT_FAILURE);
-               }
-           }
-
-
-           // close unused file descriptors
-           if (input_fd != -1)
-               close(input_fd);
-           if (output_fd != -1)
-               close(output_fd);
-           if (pipes != NULL)
-           {
-               for (int j = 0; j < num_steps - 1; j++)
-               {
-                   close(pipes[j][0]);
-                   close(pipes[j][1]);
-               }
-           }
-
-
-           // try to execute the command
-           char *command = step->words[0];
-           char util_command_path[1024];
-           snprintf(util_command_path, sizeof(util_command_path), "util/%s", command);
+           latency_exec();
+       }
 
 
-           // check if the command exists in util
-           if (access(util_command_path, X_OK) == 0)
-           {
-               // command exists in util. execute it
-               execv(util_command_path, step->words);
-               // if execv fails
-               fprintf(stderr, "Error: Failed to execute '%s': %s\n", util_command_path, strerror(errno));
-               exit(EXIT_FAILURE);
-           }
-           else
-           {
-               // command not in util. try execvp
-               execvp(command, step->words);
-               // if execvp fails
-               fprintf(stderr, "Error: Failed to execute '%s': %s\n", command, strerror(errno));
-               exit(EXIT_FAILURE);
-           }
+       // close the pipe ends now owned by the step
+       if (i > 0)
+       {
+           // close read end of previous pipe
+           close(pipe_fds[2 * (i - 1)]);
+           pipe_fds[2 * (i - 1)] = -1;
        }
-       else
+       if (i < num_steps - 1)
        {
-           // parent process
-           child_pids[i] = pid;
-
-
-           // close unused file descriptors
-           if (i > 0)
-           {
-               // close read end of previous pipe
-               close(pipes[i - 1][0]);
-           }
-           if (i < num_steps - 1)
-           {
-               // close write end of current pipe
-               close(pipes[i][1]);
-           }
+           // close write end of current pipe
+           close(pipe_fds[2 * i + 1]);
+           pipe_fds[2 * i + 1] = -1;
        }
        // move to the next step
        step = step->next;
@@ -811,47 +1835,66 @@ int execute_task(TASK *task)
 
 
    // close remaining file descriptors in the parent
-   if (input_fd != -1)
-       close(input_fd);
-   if (output_fd != -1)
-       close(output_fd);
-   if (pipes != NULL)
+   close_task_fds(pipe_fds, num_pipe_fds, input_fd, output_fd);
+   return task_exit_status;
+}
+
+
+// run the steps of task as a pipeline & wait for all of them (cook process side)
+int execute_task(TASK *task)
+{
+   int i = 0;
+   int status = 0;
+   int task_failed = 0;
+   int num_steps = count_steps(task);
+
+
+   if (num_steps == 0)
    {
-       for (i = 0; i < num_steps - 1; i++)
-       {
-           // close remaining pipe ends
-           close(pipes[i][0]);
-           close(pipes[i][1]);
-           free(pipes[i]);
-       }
-       free(pipes);
+       // no steps to execute
+       return 0;
    }
 
 
-   if (task_failed)
+   // one buffer for the task: num_steps child PIDs followed by the pipes
+   pid_t *child_pids = malloc(num_steps * sizeof(pid_t) + 2 * (num_steps - 1) * sizeof(int));
+   if (child_pids == NULL)
    {
-       // if fork failed, wait for already forked children
-       for (int j = 0; j < i; j++)
-       {
-           waitpid(child_pids[j], NULL, 0);
-       }
+       perror("malloc");
+       return -1;
+   }
+
+   trace_event(TRACE_TASK_BEGIN, TRACE_THIS_COOK, "task", 0, num_steps);
+   int task_exit_status = start_task(task, num_steps, child_pids, (int *)(child_pids + num_steps), NULL);
+   if (task_exit_status == -1)
+   {
+       trace_event(TRACE_TASK_END, TRACE_THIS_COOK, "task", 0, 1);
        free(child_pids);
        return -1;
    }
+   task_failed = (task_exit_status != 0);
+   trace_steps_started(task, child_pids, TRACE_THIS_COOK);
 
 
    // wait for all child processes
-   int task_exit_status = 0;
-   for (i = 0; i < num_steps; i++)
+   STEP *step = task->steps;
+   for (i = 0; i < num_steps; i++, step = step->next)
    {
-       pid_t wpid = waitpid(child_pids[i], &status, 0);
+       if (child_pids[i] == -1)
+       {
+           continue;
+       }
+       struct rusage usage;
+       pid_t wpid = wait4(child_pids[i], &status, 0, &usage);
+       trace_step_exit(step, child_pids[i], wpid == -1 ? -1 : status, TRACE_THIS_COOK);
        if (wpid == -1)
        {
-           perror("waitpid");
+           perror("wait4");
            task_failed = 1;
        }
        else
        {
+           stats_step_reaped(NULL, &usage);
            if (WIFEXITED(status))
            {
                int exit_status = WEXITSTATUS(status);
@@ -870,6 +1913,7 @@ int execute_task(TASK *task)
 
 
    free(child_pids);
+   trace_event(TRACE_TASK_END, TRACE_THIS_COOK, "task", 0, task_failed);
 
 
    if (task_failed)
@@ -882,16 +1926,38 @@ int execute_task(TASK *task)
 }
 
 
+/*
+   free the cookbook & everything a run of it allocated, leaving the scheduler
+   ready to load & run another cookbook. an arena cookbook (see load_cookbook)
+   goes in one reset of its arena, which keeps the pages for the next load.
+*/
 void cleanup(COOKBOOK *cbp)
 {
-   // free the state associated with each recipe
-   for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+   ready_queue_free(&work_queue);
+   history_free(&cook_history);
+   pid_table_free(&cook_pids);
+   free(required_recipes);
+   required_recipes = NULL;
+   free(required_order);
+   required_order = NULL;
+   num_required_recipes = 0;
+   command_table_free(&commands);
+
+   // the states of all recipes are one array, starting with the first recipe's
+   COOKBOOK_STATE *cs = (COOKBOOK_STATE *)cbp->state;
+   if (cbp->recipes != NULL && (cs == NULL || cs->arena == NULL))
    {
-       if (rp->state != NULL)
+       free(cbp->recipes->state);
+       for (RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
        {
-           free(rp->state);
            rp->state = NULL;
        }
    }
+   recipe_states_used = 0;
+   num_recipe_states = 0;
+
+   cookbook_global = NULL;
+   main_recipe_global = NULL;
+   free_cookbook(cbp);
 }
 
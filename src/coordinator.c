@@ -0,0 +1,342 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "result_cache.h"
+#include "trace.h"
+#include "latency.h"
+#include "worker.h"
+
+
+/*
+   coordinator side of --workers=N.
+
+   the coordinator does everything the engines do (dependency counting, the
+   ready queue, the cache, the history) but runs no recipes itself. every ready
+   recipe is sent to the least loaded worker that has capacity left, & its DONE
+   completes it like a reaped cook would. a worker announces its capacity in
+   its HELLO & is sent nothing before that. -c still caps the recipes in flight
+   across all workers.
+
+   a worker whose connection breaks is dropped & the recipes it was running are
+   re-queued for the others. cooks it had started may still be running; their
+   recipes are simply run again, so they should be idempotent like any rerun.
+
+   the transport is any connected stream socket. launch_local_workers is the
+   stand-in used here: it forks the workers & talks to them over Unix-domain
+   socketpairs, so they share the working directory, util/ & the cache.
+*/
+
+
+typedef struct worker
+{
+   int fd;             // connection, or -1 once the worker is lost
+   pid_t pid;          // local worker process, or 0
+   int capacity;       // from its HELLO. 0 until then
+   int running;        // # of recipes sent & not answered yet
+   CONN conn;
+} WORKER;
+
+static WORKER *workers;
+static int num_workers;
+static int live_workers;
+static RECIPE **job_recipes;   // job id -> recipe (required_order, which only the analysis changes)
+static int num_jobs;
+
+
+// fork num workers of capacity recipes each, connected over socketpairs. returns 0 or -1
+static int launch_local_workers(int num, int capacity)
+{
+   fflush(NULL); // so the workers don't flush our buffered output again
+   for (int i = 0; i < num; i++)
+   {
+       int sv[2];
+       if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+       {
+           perror("socketpair");
+           return -1;
+       }
+
+       pid_t pid = fork();
+       if (pid == -1)
+       {
+           perror("fork");
+           close(sv[0]);
+           close(sv[1]);
+           return -1;
+       }
+       else if (pid == 0)
+       {
+           // a worker only keeps its own end of its own connection
+           for (int j = 0; j < i; j++)
+           {
+               close(workers[j].fd);
+           }
+           close(sv[0]);
+           trace_detach();
+           exit(worker_main(sv[1], capacity));
+       }
+
+       close(sv[1]);
+       workers[i].fd = sv[0];
+       workers[i].pid = pid;
+       if (conn_init(&workers[i].conn, sv[0]) != 0)
+       {
+           perror("malloc");
+           return -1;
+       }
+       num_workers++;
+       live_workers++;
+   }
+   return 0;
+}
+
+
+// the worker with the most free capacity, or NULL if all of them are busy
+static WORKER *least_loaded_worker()
+{
+   WORKER *best = NULL;
+   for (int i = 0; i < num_workers; i++)
+   {
+       WORKER *w = &workers[i];
+       if (w->fd != -1 && w->running < w->capacity && (best == NULL || w->capacity - w->running > best->capacity - best->running))
+       {
+           best = w;
+       }
+   }
+   return best;
+}
+
+
+// drop a worker whose connection broke & re-queue the recipes it was running
+static void lose_worker(int epfd, WORKER *w)
+{
+   int index = (int)(w - workers);
+   int requeued = 0;
+
+   epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL);
+   close(w->fd);
+   w->fd = -1;
+   live_workers--;
+
+   for (int job = 0; job < num_jobs; job++)
+   {
+       RECIPE_STATE *state = (RECIPE_STATE *)job_recipes[job]->state;
+       if (state->processing && state->worker == index)
+       {
+           trace_complete(job_recipes[job], 1); // it starts over on another lane
+           state->processing = 0;
+           state->worker = -1;
+           active_cooks--;
+           enqueue_recipe(job_recipes[job]);
+           requeued++;
+       }
+   }
+   w->running = 0;
+   fprintf(stderr, "Worker %d lost, re-queued %d recipe(s)\n", index, requeued);
+}
+
+
+// send recipe to w. returns 0, or -1 if w turned out to be lost (the recipe is re-queued)
+static int dispatch_to_worker(int epfd, WORKER *w, RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   char *body;
+   size_t len;
+   if (encode_recipe(recipe, state->job, &body, &len) != 0)
+   {
+       perror("encode_recipe");
+       exit(EXIT_FAILURE);
+   }
+
+   trace_dispatch(recipe);
+   latency_dispatch(recipe);
+   begin_recipe(recipe, 0);
+   state->worker = (int)(w - workers);
+   w->running++;
+   int err = send_message(w->fd, MSG_RUN, body, len);
+   free(body);
+   if (err != 0)
+   {
+       lose_worker(epfd, w);
+       return -1;
+   }
+   return 0;
+}
+
+
+// complete the recipe a DONE is about. returns 0, or -1 if the message makes no sense
+static int handle_done(WORKER *w, const char *body, size_t len)
+{
+   uint32_t job;
+   if (len != sizeof(job) + 1 || decode_job(body, len, &job) != 0 || job >= (uint32_t)num_jobs)
+   {
+       return -1;
+   }
+   RECIPE *recipe = job_recipes[job];
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   if (!state->processing || state->worker != (int)(w - workers))
+   {
+       return -1;
+   }
+
+   int failed = (body[sizeof(job)] != 0);
+   state->worker = -1;
+   w->running--;
+   if (!failed)
+   {
+       result_cache_store(recipe);
+   }
+   active_cooks--;
+   complete_recipe(recipe, failed);
+   return 0;
+}
+
+
+// read what w has sent & act on every complete message. a broken connection loses w
+static void serve_worker(int epfd, WORKER *w)
+{
+   if (conn_fill(&w->conn) <= 0)
+   {
+       lose_worker(epfd, w);
+       return;
+   }
+
+   int type, more;
+   char *body;
+   size_t len;
+   while ((more = conn_next(&w->conn, &type, &body, &len)) == 1)
+   {
+       uint32_t capacity;
+       if (type == MSG_HELLO && len == sizeof(capacity))
+       {
+           memcpy(&capacity, body, sizeof(capacity));
+           w->capacity = (int)ntohl(capacity);
+       }
+       else if (type != MSG_DONE || handle_done(w, body, len) != 0)
+       {
+           more = -1;
+           break;
+       }
+   }
+   if (more == -1)
+   {
+       fprintf(stderr, "Error: bad message from worker %d\n", (int)(w - workers));
+       lose_worker(epfd, w);
+   }
+}
+
+
+void run_coordinator(COOKBOOK *cbp, int num, int capacity)
+{
+   workers = calloc(num, sizeof(WORKER));
+   if (workers == NULL)
+   {
+       perror("calloc");
+       exit(EXIT_FAILURE);
+   }
+   // only required recipes are ever dispatched, so they are the jobs
+   job_recipes = required_order;
+   num_jobs = num_required_recipes;
+   for (int job = 0; job < num_jobs; job++)
+   {
+       RECIPE_STATE *state = (RECIPE_STATE *)job_recipes[job]->state;
+       state->job = job;
+       state->worker = -1;
+   }
+
+   if (launch_local_workers(num, capacity) != 0)
+   {
+       exit(EXIT_FAILURE);
+   }
+
+   int epfd = epoll_create1(EPOLL_CLOEXEC);
+   struct epoll_event *events = calloc(num, sizeof(struct epoll_event));
+   if (epfd == -1 || events == NULL)
+   {
+       perror("epoll_create1");
+       exit(EXIT_FAILURE);
+   }
+   for (int i = 0; i < num; i++)
+   {
+       struct epoll_event ev;
+       ev.events = EPOLLIN;
+       ev.data.ptr = &workers[i];
+       if (epoll_ctl(epfd, EPOLL_CTL_ADD, workers[i].fd, &ev) == -1)
+       {
+           perror("epoll_ctl");
+           exit(EXIT_FAILURE);
+       }
+   }
+
+   while (1)
+   {
+       // hand ready recipes to the workers while any has capacity left
+       WORKER *w;
+       while (!is_work_queue_empty() && active_cooks < max_cooks_global && may_dispatch() && (w = least_loaded_worker()) != NULL)
+       {
+           RECIPE *recipe = dequeue_recipe_to_run();
+           if (recipe == NULL)
+           {
+               break; // the rest of the queue was up to date
+           }
+           dispatch_to_worker(epfd, w, recipe);
+       }
+
+       if (active_cooks == 0 && (is_work_queue_empty() || !may_dispatch()))
+       {
+           break; // all recipes have been processed
+       }
+       if (live_workers == 0)
+       {
+           fprintf(stderr, "Error: all workers lost\n");
+           exit(EXIT_FAILURE);
+       }
+
+       // wait for HELLOs & DONEs
+       int n = epoll_wait(epfd, events, num, -1);
+       if (n == -1)
+       {
+           if (errno == EINTR)
+           {
+               continue;
+           }
+           perror("epoll_wait");
+           exit(EXIT_FAILURE);
+       }
+       for (int i = 0; i < n; i++)
+       {
+           w = (WORKER *)events[i].data.ptr;
+           if (w->fd != -1)
+           {
+               serve_worker(epfd, w);
+           }
+       }
+   }
+
+   // closing the connections tells the workers to exit
+   for (int i = 0; i < num_workers; i++)
+   {
+       if (workers[i].fd != -1)
+       {
+           close(workers[i].fd);
+       }
+       conn_free(&workers[i].conn);
+   }
+   for (int i = 0; i < num_workers; i++)
+   {
+       waitpid(workers[i].pid, NULL, 0);
+   }
+   free(events);
+   free(workers);
+   close(epfd);
+}
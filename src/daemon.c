@@ -0,0 +1,631 @@
+#define _GNU_SOURCE // accept4, MSG_CMSG_CLOEXEC, struct ucred
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "cookbook.h"
+#include "cook.h"
+#include "cook_state.h"
+#include "daemon.h"
+#include "recipe_index.h"
+#include "worker.h"
+
+
+/*
+   persistent cook daemon (--daemon=socket).
+
+   the daemon parses the cookbook, builds its name index & allocates the recipe
+   states once, then waits for requests. every request runs in a process forked
+   from the daemon, which takes over the client's stdin/stdout/stderr, working
+   directory & environment & calls run_cookbook with the client's options.
+   the forked run shares the linked graph with the daemon & only clears the
+   RECIPE_STATE array, & since process_recipes exits when it is done, the
+   daemon itself never runs a recipe & stays pristine for the next request.
+   the daemon watches the run through a pidfd & sends its exit status back.
+
+   SIGHUP makes the daemon load the cookbook again. the new cookbook goes into
+   the arena the previous reload freed, so a reload reuses its pages instead
+   of allocating the graph anew. if the cookbook no longer loads, the old one
+   stays. runs in progress keep the cookbook they were forked with.
+
+   a request runs arbitrary commands as the daemon's user, so the socket is
+   created 0600 & a connection from any other user is refused.
+
+   the client (--connect=socket) does not open the cookbook at all. it only
+   forwards its command line & waits for the status. interrupting the client
+   does not stop the run.
+*/
+
+
+extern char **environ;
+
+
+// a run in progress: the process serving it & the client waiting for its status
+typedef struct request
+{
+   pid_t pid;
+   int pidfd;
+   int fd;             // connection to the client
+   struct request *next;
+} REQUEST;
+
+static REQUEST *requests = NULL;
+
+static ARENA reload_arenas[2];  // the cookbook is loaded into these by turns
+static char reload_event;       // epoll data of the SIGHUP signalfd
+static sigset_t daemon_mask;    // signal mask to restore in a run
+
+
+/*
+   bind & listen on path, unless a daemon already answers there. a stale socket
+   left at path is replaced, but anything else there is refused. the socket is
+   created accessible to the daemon's user only. returns the socket, or -1.
+*/
+static int open_listen_socket(const char *path)
+{
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(addr.sun_path))
+   {
+       fprintf(stderr, "Error: socket path '%s' is too long\n", path);
+       return -1;
+   }
+   strcpy(addr.sun_path, path);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (fd == -1)
+   {
+       perror("socket");
+       return -1;
+   }
+   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+   {
+       fprintf(stderr, "Error: a cook daemon is already serving '%s'\n", path);
+       close(fd);
+       return -1;
+   }
+
+   // nobody answers, so a socket file left there is stale
+   struct stat st;
+   if (lstat(path, &st) == 0)
+   {
+       if (!S_ISSOCK(st.st_mode))
+       {
+           fprintf(stderr, "Error: '%s' exists & is not a socket\n", path);
+           close(fd);
+           return -1;
+       }
+       unlink(path);
+   }
+   mode_t mask = umask(0177);
+   int err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+   umask(mask);
+   if (err == -1 || listen(fd, SOMAXCONN) == -1)
+   {
+       perror(path);
+       close(fd);
+       return -1;
+   }
+   return fd;
+}
+
+
+/*
+   read a REQUEST & the descriptors that come with it from a new connection.
+   the client sends it right after connecting, so this blocks only briefly.
+   returns 0, or -1 if the connection broke or the request is malformed.
+*/
+static int recv_request(CONN *conn, int fds[3], char **body, size_t *len)
+{
+   char control[CMSG_SPACE(3 * sizeof(int))];
+   struct iovec iov = { conn->buf, conn->cap };
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   ssize_t n;
+   while ((n = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+   {
+       // retry
+   }
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+   if (n <= 0 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+   {
+       return -1;
+   }
+   memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+   conn->len = n;
+
+   int type, more;
+   while ((more = conn_next(conn, &type, body, len)) == 0)
+   {
+       if (conn_fill(conn) <= 0)
+       {
+           more = -1;
+           break;
+       }
+   }
+   if (more == -1 || type != MSG_REQUEST)
+   {
+       close(fds[0]);
+       close(fds[1]);
+       close(fds[2]);
+       return -1;
+   }
+   return 0;
+}
+
+
+// split body into NULL-terminated argv & environment arrays (pointing into body). returns 0 or -1
+static int split_request(char *body, size_t len, char **cwd, int *argc, char ***argv, char ***envp)
+{
+   uint32_t counts[2];
+   if (len < sizeof(counts))
+   {
+       return -1;
+   }
+   memcpy(counts, body, sizeof(counts));
+   int num_args = (int)ntohl(counts[0]);
+   int num_env = (int)ntohl(counts[1]);
+
+   char **strings = calloc((size_t)num_args + num_env + 2, sizeof(char *));
+   if (strings == NULL || num_args < 1)
+   {
+       free(strings);
+       return -1;
+   }
+
+   // the working directory, then num_args + num_env strings, each NUL-terminated
+   char *p = body + sizeof(counts);
+   char *end = body + len;
+   for (int i = -1; i < num_args + num_env; i++)
+   {
+       char *s = memchr(p, '\0', end - p);
+       if (p >= end || s == NULL)
+       {
+           free(strings);
+           return -1;
+       }
+       if (i == -1)
+       {
+           *cwd = p;
+       }
+       else
+       {
+           // argv & the environment each get a terminating NULL
+           strings[i < num_args ? i : i + 1] = p;
+       }
+       p = s + 1;
+   }
+   *argc = num_args;
+   *argv = strings;
+   *envp = strings + num_args + 1;
+   return 0;
+}
+
+
+// request process side: become the client's run & never return
+static void run_request(COOKBOOK *cbp, const char *cookbook_filename, int fds[3], char *body, size_t len)
+{
+   for (int i = 0; i < 3; i++)
+   {
+       dup2(fds[i], i);
+       close(fds[i]);
+   }
+
+   char *cwd;
+   int argc;
+   char **argv, **envp;
+   if (split_request(body, len, &cwd, &argc, &argv, &envp) != 0)
+   {
+       fprintf(stderr, "Error: malformed request\n");
+       exit(EXIT_FAILURE);
+   }
+   if (chdir(cwd) == -1)
+   {
+       perror(cwd);
+       exit(EXIT_FAILURE);
+   }
+   environ = envp;
+
+   COOK_OPTIONS options;
+   parse_command_line(argc, argv, &options);
+   free_options(&options); // the request runs the daemon's cookbook, not its files
+   if (options.daemon_socket != NULL)
+   {
+       fprintf(stderr, "Error: --daemon can't be forwarded to a daemon\n");
+       exit(EXIT_FAILURE);
+   }
+   if (strcmp(options.cookbook_filename, "cookbook.ckb") != 0 && strcmp(options.cookbook_filename, cookbook_filename) != 0)
+   {
+       fprintf(stderr, "Error: the daemon serves cookbook '%s', not '%s'\n", cookbook_filename, options.cookbook_filename);
+       exit(EXIT_FAILURE);
+   }
+   options.cookbook_filename = (char *)cookbook_filename;
+
+   run_cookbook(cbp, &options);
+   exit(EXIT_FAILURE); // not reached
+}
+
+
+// accept a connection & fork a run for its request. a bad request is dropped
+static void accept_request(int epfd, int listen_fd, int sigfd, COOKBOOK *cbp, const char *cookbook_filename, CONN *conn)
+{
+   int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+   if (fd == -1)
+   {
+       perror("accept");
+       return;
+   }
+   struct ucred peer;
+   socklen_t peer_len = sizeof(peer);
+   if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == -1 || peer.uid != geteuid())
+   {
+       fprintf(stderr, "Warning: refused a connection from another user\n");
+       close(fd);
+       return;
+   }
+
+   int fds[3];
+   char *body;
+   size_t len;
+   conn->fd = fd;
+   conn->len = 0;
+   conn->off = 0;
+   REQUEST *request = malloc(sizeof(REQUEST));
+   if (request == NULL || recv_request(conn, fds, &body, &len) != 0)
+   {
+       free(request);
+       close(fd);
+       return;
+   }
+
+   fflush(NULL);
+   pid_t pid = fork();
+   if (pid == 0)
+   {
+       // only the client's descriptors are kept
+       close(listen_fd);
+       close(epfd);
+       close(fd);
+       close(sigfd);
+       sigprocmask(SIG_SETMASK, &daemon_mask, NULL);
+       for (REQUEST *rq = requests; rq != NULL; rq = rq->next)
+       {
+           close(rq->fd);
+           close(rq->pidfd);
+       }
+       run_request(cbp, cookbook_filename, fds, body, len);
+   }
+   close(fds[0]);
+   close(fds[1]);
+   close(fds[2]);
+   if (pid == -1)
+   {
+       perror("fork");
+       uint32_t status = htonl(EXIT_FAILURE);
+       send_message(fd, MSG_STATUS, &status, sizeof(status));
+       free(request);
+       close(fd);
+       return;
+   }
+
+   request->pid = pid;
+   request->fd = fd;
+   request->pidfd = watch_process(epfd, pid, request);
+   request->next = requests;
+   requests = request;
+}
+
+
+// a run is over. send its status to the client & forget it
+static void finish_request(int epfd, REQUEST *request)
+{
+   int status = reap_process(epfd, request->pid, request->pidfd, NULL);
+   int exit_status = EXIT_FAILURE;
+   if (status != -1 && WIFEXITED(status))
+   {
+       exit_status = WEXITSTATUS(status);
+   }
+   else if (status != -1 && WIFSIGNALED(status))
+   {
+       exit_status = 128 + WTERMSIG(status);
+   }
+
+   // a client that went away can't be told. that is not the daemon's problem
+   uint32_t net_status = htonl((uint32_t)exit_status);
+   send_message(request->fd, MSG_STATUS, &net_status, sizeof(net_status));
+   close(request->fd);
+
+   for (REQUEST **rq = &requests; *rq != NULL; rq = &(*rq)->next)
+   {
+       if (*rq == request)
+       {
+           *rq = request->next;
+           break;
+       }
+   }
+   free(request);
+}
+
+
+// build everything a run can share, once: the name index & the states. returns 0 or -1
+static int prepare_cookbook(COOKBOOK *cbp)
+{
+   if (cbp->recipes != NULL)
+   {
+       find_recipe_by_name(cbp, cbp->recipes->name);
+   }
+   if (reset_recipe_states(cbp) != 0)
+   {
+       perror("calloc");
+       return -1;
+   }
+   return 0;
+}
+
+
+// load the cookbook again into whichever reload arena cbp is not in. returns the cookbook to serve
+static COOKBOOK *reload_cookbook(int sigfd, COOKBOOK *cbp, COOK_OPTIONS *options)
+{
+   struct signalfd_siginfo info;
+   while (read(sigfd, &info, sizeof(info)) == sizeof(info))
+   {
+       ; // several SIGHUPs make one reload
+   }
+
+   COOKBOOK_STATE *cs = (COOKBOOK_STATE *)cbp->state;
+   ARENA *arena = (cs != NULL) ? cs->arena : NULL;
+   ARENA *next = (arena == &reload_arenas[0]) ? &reload_arenas[1] : &reload_arenas[0];
+   COOKBOOK *reloaded = load_cookbooks(options, next);
+   if (reloaded == NULL || prepare_cookbook(reloaded) != 0)
+   {
+       fprintf(stderr, "Reload of '%s' failed, still serving the old cookbook\n", options->cookbook_filename);
+       if (reloaded != NULL)
+       {
+           cleanup(reloaded);
+       }
+       return cbp;
+   }
+
+   // the first cookbook's arena is not one of ours & isn't needed again
+   cleanup(cbp);
+   if (arena != NULL && arena != &reload_arenas[0] && arena != &reload_arenas[1])
+   {
+       arena_free(arena);
+   }
+   fprintf(stderr, "Reloaded '%s'\n", options->cookbook_filename);
+   return reloaded;
+}
+
+
+// serve runs of cbp on options->daemon_socket until killed. returns only on setup errors
+int daemon_main(COOKBOOK *cbp, COOK_OPTIONS *options)
+{
+   if (prepare_cookbook(cbp) != 0)
+   {
+       return EXIT_FAILURE;
+   }
+
+   // SIGHUP is read from a signalfd. runs get the original mask back
+   sigset_t hup;
+   sigemptyset(&hup);
+   sigaddset(&hup, SIGHUP);
+   sigprocmask(SIG_BLOCK, &hup, &daemon_mask);
+   int sigfd = signalfd(-1, &hup, SFD_NONBLOCK | SFD_CLOEXEC);
+   if (sigfd == -1)
+   {
+       perror("signalfd");
+       return EXIT_FAILURE;
+   }
+
+   CONN conn;
+   int listen_fd = open_listen_socket(options->daemon_socket);
+   int epfd = epoll_create1(EPOLL_CLOEXEC);
+   if (listen_fd == -1 || epfd == -1 || conn_init(&conn, -1) != 0)
+   {
+       return EXIT_FAILURE;
+   }
+
+   // the listening socket is the only event without a request
+   struct epoll_event ev;
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1)
+   {
+       perror("epoll_ctl");
+       return EXIT_FAILURE;
+   }
+   ev.data.ptr = &reload_event;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev) == -1)
+   {
+       perror("epoll_ctl");
+       return EXIT_FAILURE;
+   }
+
+   struct epoll_event events[16];
+   while (1)
+   {
+       int n = epoll_wait(epfd, events, 16, -1);
+       if (n == -1)
+       {
+           if (errno == EINTR)
+           {
+               continue;
+           }
+           perror("epoll_wait");
+           return EXIT_FAILURE;
+       }
+       for (int i = 0; i < n; i++)
+       {
+           if (events[i].data.ptr == NULL)
+           {
+               accept_request(epfd, listen_fd, sigfd, cbp, options->cookbook_filename, &conn);
+           }
+           else if (events[i].data.ptr == &reload_event)
+           {
+               cbp = reload_cookbook(sigfd, cbp, options);
+           }
+           else
+           {
+               finish_request(epfd, (REQUEST *)events[i].data.ptr);
+           }
+       }
+   }
+}
+
+
+// send all of a frame, with stdin, stdout & stderr attached to its first byte
+static int send_request(int fd, const char *frame, size_t len)
+{
+   int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+   char control[CMSG_SPACE(sizeof(fds))];
+   memset(control, 0, sizeof(control));
+   struct iovec iov = { (void *)frame, len };
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+   memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+   while (len > 0)
+   {
+       ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+       if (n == -1)
+       {
+           if (errno == EINTR)
+           {
+               continue;
+           }
+           return -1;
+       }
+       // the descriptors went with the first part
+       msg.msg_control = NULL;
+       msg.msg_controllen = 0;
+       iov.iov_base = (char *)iov.iov_base + n;
+       iov.iov_len -= n;
+       len -= n;
+   }
+   return 0;
+}
+
+
+// build the REQUEST frame for argv & the current directory & environment. returns 0 or -1
+static int build_request(int argc, char *argv[], char **frame, size_t *len)
+{
+   char cwd[4096];
+   if (getcwd(cwd, sizeof(cwd)) == NULL)
+   {
+       return -1;
+   }
+   int num_env = 0;
+   while (environ[num_env] != NULL)
+   {
+       num_env++;
+   }
+
+   FILE *out = open_memstream(frame, len);
+   if (out == NULL)
+   {
+       return -1;
+   }
+   char header[5] = { 0 }; // length & type, filled in below
+   header[4] = MSG_REQUEST;
+   fwrite(header, sizeof(header), 1, out);
+   uint32_t counts[2] = { htonl((uint32_t)argc), htonl((uint32_t)num_env) };
+   fwrite(counts, sizeof(counts), 1, out);
+   fwrite(cwd, strlen(cwd) + 1, 1, out);
+   for (int i = 0; i < argc; i++)
+   {
+       fwrite(argv[i], strlen(argv[i]) + 1, 1, out);
+   }
+   for (int i = 0; i < num_env; i++)
+   {
+       fwrite(environ[i], strlen(environ[i]) + 1, 1, out);
+   }
+   if (fclose(out) != 0)
+   {
+       return -1;
+   }
+
+   uint32_t frame_len = htonl((uint32_t)(*len - 4));
+   memcpy(*frame, &frame_len, sizeof(frame_len));
+   return 0;
+}
+
+
+// forward this run to the daemon on socket_path & return its exit status
+int client_main(const char *socket_path, int argc, char *argv[])
+{
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+   {
+       fprintf(stderr, "Error: can't reach a cook daemon on '%s': %s\n", socket_path, strerror(errno));
+       return EXIT_FAILURE;
+   }
+
+   char *frame;
+   size_t len;
+   if (build_request(argc, argv, &frame, &len) != 0 || send_request(fd, frame, len) != 0)
+   {
+       perror("cook");
+       return EXIT_FAILURE;
+   }
+   free(frame);
+
+   // wait for the status of the run
+   CONN conn;
+   int type, more;
+   char *body;
+   size_t body_len;
+   if (conn_init(&conn, fd) != 0)
+   {
+       perror("malloc");
+       return EXIT_FAILURE;
+   }
+   while ((more = conn_next(&conn, &type, &body, &body_len)) == 0)
+   {
+       if (conn_fill(&conn) <= 0)
+       {
+           more = -1;
+           break;
+       }
+   }
+   uint32_t status;
+   if (more == -1 || type != MSG_STATUS || body_len != sizeof(status))
+   {
+       fprintf(stderr, "Error: lost the cook daemon on '%s'\n", socket_path);
+       return EXIT_FAILURE;
+   }
+   memcpy(&status, body, sizeof(status));
+   conn_free(&conn);
+   close(fd);
+   return (int)ntohl(status);
+}
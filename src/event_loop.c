@@ -0,0 +1,405 @@
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "result_cache.h"
+#include "trace.h"
+#include "stats.h"
+#include "latency.h"
+
+
+/*
+   event-driven engine (--engine=epoll).
+
+   every cook gets a pidfd, which becomes readable when the cook exits. the loop
+   waits on all of them with epoll_wait, so reaping, state updates & enqueueing
+   of dependents all happen in normal context, with no SIGCHLD handler involved.
+   timers & other descriptors can be added to the same epoll set later.
+
+   with --exec=direct there are no cook processes. the loop starts the steps of
+   a recipe's current task itself & watches a pidfd per step. when the last step
+   of a task has been reaped, the recipe moves on to its next task, or completes.
+*/
+
+
+// a running step of a recipe (direct exec only)
+typedef struct step_slot
+{
+   RECIPE *recipe;
+   STEP *step;
+   pid_t pid;
+   int pidfd;
+   struct step_slot *next_free;
+} STEP_SLOT;
+
+static STEP_SLOT *step_slots;  // max_cooks * the widest task of a required recipe
+static STEP_SLOT *free_slots;
+static pid_t *task_pids;       // scratch for start_task
+static int *task_pipes;
+
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+   return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+   errno = ENOSYS;
+   return -1;
+#endif
+}
+
+
+// open a pidfd for pid & add it to the epoll set with ptr as its data. returns the pidfd
+int watch_process(int epfd, pid_t pid, void *ptr)
+{
+   int pidfd = open_pidfd(pid);
+   struct epoll_event ev;
+   ev.events = EPOLLIN;
+   ev.data.ptr = ptr;
+   if (pidfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, pidfd, &ev) == -1)
+   {
+       // without a pidfd there is no way to hear about this process
+       perror("pidfd_open");
+       fprintf(stderr, "Error: the epoll engine needs pidfd support (try --engine=signal)\n");
+       kill(pid, SIGKILL);
+       waitpid(pid, NULL, 0);
+       exit(EXIT_FAILURE);
+   }
+   return pidfd;
+}
+
+
+/*
+   reap a process whose pidfd became readable & drop the pidfd. its resource
+   usage is stored in usage, unless it is NULL.
+   returns its wait status, or -1 (usage is then left as it was)
+*/
+int reap_process(int epfd, pid_t pid, int pidfd, struct rusage *usage)
+{
+   int status;
+   if (wait4(pid, &status, 0, usage) == -1)
+   {
+       perror("wait4");
+       status = -1;
+   }
+
+   // processes forked later hold copies of this pidfd, so closing it alone would
+   // leave it registered. remove it from the epoll set explicitly
+   epoll_ctl(epfd, EPOLL_CTL_DEL, pidfd, NULL);
+   close(pidfd);
+   return status;
+}
+
+
+// a process failed if it could not be waited for, exited nonzero or was killed by a signal
+int process_failed(int status)
+{
+   return status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+
+// fork a cook for recipe & register its pidfd. returns 0, or -1 if the fork failed
+static int dispatch_recipe(int epfd, RECIPE *recipe, const sigset_t *child_mask)
+{
+   pid_t pid = start_cook(recipe, child_mask);
+   if (pid == -1)
+   {
+       return -1; // start_cook re-enqueued the recipe
+   }
+
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   state->pidfd = watch_process(epfd, pid, recipe);
+   return 0;
+}
+
+
+// reap the cook behind a readable pidfd & record its outcome
+static void reap_cook(int epfd, RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   struct rusage usage;
+   int status = reap_process(epfd, state->pid, state->pidfd, &usage);
+   if (status != -1)
+   {
+       stats_cook_reaped(recipe, &usage);
+   }
+   state->pidfd = -1;
+   state->pid = 0;
+   active_cooks--;
+
+   complete_recipe(recipe, process_failed(status));
+}
+
+
+// # of steps in the widest task of any required recipe (at least 1)
+static int max_task_width(void)
+{
+   int width = 1;
+   for (int i = 0; i < num_required_recipes; i++)
+   {
+       for (TASK *task = required_order[i]->tasks; task != NULL; task = task->next)
+       {
+           int num_steps = count_steps(task);
+           if (num_steps > width)
+           {
+               width = num_steps;
+           }
+       }
+   }
+   return width;
+}
+
+
+/*
+   allocate the step slots & the start_task scratch space for direct exec.
+   at most max_cooks recipes run at once, each with one task of at most width
+   steps, so nothing is allocated once the loop is running.
+   returns the # of slots, or -1 if memory could not be allocated.
+*/
+static int init_step_slots(int width)
+{
+   int num_slots = max_cooks_global * width;
+   step_slots = calloc(num_slots, sizeof(STEP_SLOT));
+   task_pids = calloc(width, sizeof(pid_t));
+   task_pipes = calloc(2 * width, sizeof(int));
+   if (step_slots == NULL || task_pids == NULL || task_pipes == NULL)
+   {
+       return -1;
+   }
+   free_slots = NULL;
+   for (int i = num_slots - 1; i >= 0; i--)
+   {
+       step_slots[i].next_free = free_slots;
+       free_slots = &step_slots[i];
+   }
+   return num_slots;
+}
+
+
+// a directly executed recipe is done. same outcome as a cook exiting with its status
+static void finish_direct(RECIPE *recipe, int failed)
+{
+   if (!failed)
+   {
+       result_cache_store(recipe);
+   }
+   active_cooks--;
+   complete_recipe(recipe, failed);
+}
+
+
+/*
+   start the next task of recipe that has steps, or complete the recipe if it
+   has none left. like process_recipe, a task that cannot be set up or whose
+   steps all failed to start fails the recipe.
+*/
+static void advance_recipe(int epfd, RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+
+   if (fail_fast_cancelled())
+   {
+       finish_direct(recipe, 1); // the run is being cancelled. start nothing new
+       return;
+   }
+
+   while (state->task != NULL)
+   {
+       TASK *task = state->task;
+       state->task = task->next;
+
+       int num_steps = count_steps(task);
+       if (num_steps == 0)
+       {
+           continue; // no steps to execute
+       }
+
+       // fail-fast puts the steps of each task in a process group of their own
+       state->pgid = 0;
+       pid_t *pgid = (on_failure_global == FAILURE_FAIL_FAST) ? &state->pgid : NULL;
+       trace_event(TRACE_TASK_BEGIN, state->lane, "task", 0, num_steps);
+       int task_status = start_task(task, num_steps, task_pids, task_pipes, pgid);
+       if (task_status == -1)
+       {
+           trace_event(TRACE_TASK_END, state->lane, "task", 0, 1);
+           finish_direct(recipe, 1);
+           return;
+       }
+       state->task_failed = (task_status != 0);
+       trace_steps_started(task, task_pids, state->lane);
+
+       STEP *step = task->steps;
+       for (int i = 0; i < num_steps; i++, step = step->next)
+       {
+           if (task_pids[i] == -1)
+           {
+               continue;
+           }
+           STEP_SLOT *slot = free_slots;
+           free_slots = slot->next_free;
+           slot->recipe = recipe;
+           slot->step = step;
+           slot->pid = task_pids[i];
+           slot->pidfd = watch_process(epfd, slot->pid, slot);
+           state->live_steps++;
+       }
+       if (state->live_steps == 0)
+       {
+           trace_event(TRACE_TASK_END, state->lane, "task", 0, 1);
+           finish_direct(recipe, 1); // no step could be started
+       }
+       return;
+   }
+
+   finish_direct(recipe, 0);
+}
+
+
+// start a recipe without a cook process. it counts against max_cooks until it completes
+static void dispatch_direct(int epfd, RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   trace_dispatch(recipe);
+   latency_dispatch(recipe);
+   begin_recipe(recipe, 0);
+   state->task = recipe->tasks;
+   state->live_steps = 0;
+   state->task_failed = 0;
+   latency_expect_exec(recipe);
+   advance_recipe(epfd, recipe);
+   latency_expect_exec(NULL);
+}
+
+
+// reap a step behind a readable pidfd. once its task has no live steps, move the recipe on
+static void reap_step(int epfd, STEP_SLOT *slot)
+{
+   RECIPE *recipe = slot->recipe;
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+
+   struct rusage usage;
+   int status = reap_process(epfd, slot->pid, slot->pidfd, &usage);
+   if (status != -1)
+   {
+       stats_step_reaped(recipe, &usage);
+   }
+   trace_step_exit(slot->step, slot->pid, status, state->lane);
+   if (process_failed(status))
+   {
+       state->task_failed = 1;
+   }
+   slot->recipe = NULL;
+   slot->next_free = free_slots;
+   free_slots = slot;
+
+   if (--state->live_steps > 0)
+   {
+       return;
+   }
+   trace_event(TRACE_TASK_END, state->lane, "task", 0, state->task_failed);
+   if (state->task_failed)
+   {
+       finish_direct(recipe, 1);
+   }
+   else
+   {
+       advance_recipe(epfd, recipe);
+   }
+}
+
+
+void run_event_loop(COOKBOOK *cbp, int direct)
+{
+   int epfd = epoll_create1(EPOLL_CLOEXEC);
+   if (epfd == -1)
+   {
+       perror("epoll_create1");
+       exit(EXIT_FAILURE);
+   }
+
+   // one pidfd per cook, or per running step with direct exec
+   int max_events = max_cooks_global;
+   if (direct && (max_events = init_step_slots(max_task_width())) == -1)
+   {
+       perror("calloc");
+       exit(EXIT_FAILURE);
+   }
+   struct epoll_event *events = calloc(max_events, sizeof(struct epoll_event));
+   if (events == NULL)
+   {
+       perror("calloc");
+       exit(EXIT_FAILURE);
+   }
+
+   // cooks inherit the mask the scheduler was started with
+   sigset_t child_mask;
+   sigprocmask(SIG_SETMASK, NULL, &child_mask);
+
+   while (1)
+   {
+       // start as many ready recipes as the cook limit allows
+       while (!is_work_queue_empty() && active_cooks < max_cooks_global && may_dispatch())
+       {
+           RECIPE *recipe = dequeue_recipe_to_run();
+           if (recipe == NULL)
+           {
+               break; // the rest of the queue was up to date
+           }
+           if (direct)
+           {
+               dispatch_direct(epfd, recipe);
+           }
+           else if (dispatch_recipe(epfd, recipe, &child_mask) != 0)
+           {
+               break;
+           }
+       }
+
+       if (active_cooks == 0)
+       {
+           if (is_work_queue_empty() || !may_dispatch())
+           {
+               break; // all recipes have been processed
+           }
+           continue; // fork failed with nothing running. retry
+       }
+
+       // wait for one or more cooks (or steps) to exit
+       // wake up for the SIGKILL of a fail-fast cancellation, if one is due
+       int n = epoll_wait(epfd, events, max_events, cancel_in_flight());
+       if (n == -1)
+       {
+           if (errno == EINTR)
+           {
+               continue;
+           }
+           perror("epoll_wait");
+           exit(EXIT_FAILURE);
+       }
+       for (int i = 0; i < n; i++)
+       {
+           if (direct)
+           {
+               reap_step(epfd, (STEP_SLOT *)events[i].data.ptr);
+           }
+           else
+           {
+               reap_cook(epfd, (RECIPE *)events[i].data.ptr);
+           }
+       }
+   }
+
+   free(events);
+   free(step_slots);
+   free(task_pids);
+   free(task_pipes);
+   close(epfd);
+}
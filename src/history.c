@@ -0,0 +1,242 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cookbook.h"
+#include "recipe_index.h"
+#include "history.h"
+
+
+#define HISTORY_MAGIC "CKH1"
+
+// on-disk header, followed by count HISTORY_RECORDs
+typedef struct history_header
+{
+   char magic[4];
+   uint32_t count;
+} HISTORY_HEADER;
+
+
+// FNV-1a over a string & its terminating NUL, continuing from h
+static uint64_t hash_string(uint64_t h, const char *s)
+{
+   do
+   {
+       h ^= (unsigned char)*s;
+       h *= 1099511628211UL;
+   } while (*s++ != '\0');
+   return h;
+}
+
+
+// hash of everything a recipe runs: the words of every step & the redirections of every task
+static uint64_t hash_tasks(RECIPE *recipe)
+{
+   uint64_t h = 14695981039346656037UL;
+   for (TASK *task = recipe->tasks; task != NULL; task = task->next)
+   {
+       for (STEP *step = task->steps; step != NULL; step = step->next)
+       {
+           for (char **word = step->words; *word != NULL; word++)
+           {
+               h = hash_string(h, *word);
+           }
+           h = hash_string(h, "|");
+       }
+       h = hash_string(h, task->input_file != NULL ? task->input_file : "");
+       h = hash_string(h, task->output_file != NULL ? task->output_file : "");
+       h = hash_string(h, ";");
+   }
+   return h;
+}
+
+
+static int compare_records(const void *a, const void *b)
+{
+   uint64_t ha = ((const HISTORY_RECORD *)a)->name_hash;
+   uint64_t hb = ((const HISTORY_RECORD *)b)->name_hash;
+   return (ha > hb) - (ha < hb);
+}
+
+
+// binary search of the sorted prefix. returns NULL if name_hash has no record there
+static HISTORY_RECORD *find_record(HISTORY *history, uint64_t name_hash)
+{
+   HISTORY_RECORD key;
+   key.name_hash = name_hash;
+   return bsearch(&key, history->records, history->sorted, sizeof(HISTORY_RECORD), compare_records);
+}
+
+
+/*
+   read the history file at path.
+   a missing file is an empty history. an unreadable or corrupt one is reported
+   & also treated as empty, so a bad file never stops the cook.
+   returns 0 on success, -1 if memory could not be allocated.
+*/
+int history_load(HISTORY *history, const char *path)
+{
+   memset(history, 0, sizeof(HISTORY));
+
+   FILE *in = fopen(path, "r");
+   if (in == NULL)
+   {
+       if (errno != ENOENT)
+       {
+           fprintf(stderr, "Warning: Can't read history '%s': %s\n", path, strerror(errno));
+       }
+       return 0;
+   }
+
+   // the count is only trusted as far as the file has room for the records
+   HISTORY_HEADER header;
+   struct stat st;
+   if (fstat(fileno(in), &st) != 0 || fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, HISTORY_MAGIC, 4) != 0
+       || st.st_size < (off_t)sizeof(header) || header.count > INT_MAX
+       || header.count > (uint64_t)(st.st_size - sizeof(header)) / sizeof(HISTORY_RECORD))
+   {
+       fprintf(stderr, "Warning: Ignoring malformed history '%s'\n", path);
+       fclose(in);
+       return 0;
+   }
+
+   if (header.count > 0)
+   {
+       history->records = malloc(header.count * sizeof(HISTORY_RECORD));
+       if (history->records == NULL)
+       {
+           perror("malloc");
+           fclose(in);
+           return -1;
+       }
+       if (fread(history->records, sizeof(HISTORY_RECORD), header.count, in) != header.count)
+       {
+           fprintf(stderr, "Warning: Ignoring truncated history '%s'\n", path);
+           free(history->records);
+           history->records = NULL;
+           fclose(in);
+           return 0;
+       }
+   }
+   fclose(in);
+
+   history->count = history->capacity = history->sorted = header.count;
+   // history_save writes the records in order, but don't trust the file for it
+   qsort(history->records, history->count, sizeof(HISTORY_RECORD), compare_records);
+   return 0;
+}
+
+
+// recorded wall time of recipe in microseconds, or -1 if it has none or its tasks changed
+long history_lookup(HISTORY *history, RECIPE *recipe)
+{
+   HISTORY_RECORD *record = find_record(history, hash_name(recipe->name));
+   if (record == NULL || record->tasks_hash != hash_tasks(recipe))
+   {
+       return -1;
+   }
+   return (long)record->duration_us;
+}
+
+
+/*
+   fold a measured wall time into the history.
+   a known recipe with unchanged tasks keeps a moving average (3/4 old, 1/4 new).
+   a recipe whose tasks changed starts over from this run.
+   new recipes are appended & put in order by history_save.
+   returns 0 on success, -1 if memory could not be allocated.
+*/
+int history_record(HISTORY *history, RECIPE *recipe, long duration_us)
+{
+   uint64_t name_hash = hash_name(recipe->name);
+   uint64_t tasks_hash = hash_tasks(recipe);
+
+   HISTORY_RECORD *record = find_record(history, name_hash);
+   if (record != NULL)
+   {
+       if (record->tasks_hash == tasks_hash)
+       {
+           record->duration_us = (3 * record->duration_us + (uint64_t)duration_us) / 4;
+       }
+       else
+       {
+           record->tasks_hash = tasks_hash;
+           record->duration_us = (uint64_t)duration_us;
+       }
+       return 0;
+   }
+
+   if (history->count == history->capacity)
+   {
+       int capacity = history->capacity ? 2 * history->capacity : 64;
+       HISTORY_RECORD *records = realloc(history->records, capacity * sizeof(HISTORY_RECORD));
+       if (records == NULL)
+       {
+           perror("realloc");
+           return -1;
+       }
+       history->records = records;
+       history->capacity = capacity;
+   }
+   record = &history->records[history->count++];
+   record->name_hash = name_hash;
+   record->tasks_hash = tasks_hash;
+   record->duration_us = (uint64_t)duration_us;
+   return 0;
+}
+
+
+/*
+   write the history to path, sorted by name hash with one record per name.
+   the file is written next to path & renamed over it, so a crash mid-write
+   leaves the previous history intact.
+   returns 0 on success, -1 on error.
+*/
+int history_save(HISTORY *history, const char *path)
+{
+   qsort(history->records, history->count, sizeof(HISTORY_RECORD), compare_records);
+
+   // a cookbook can repeat a recipe name. keep one record per name hash
+   int n = 0;
+   for (int i = 0; i < history->count; i++)
+   {
+       if (n == 0 || history->records[n - 1].name_hash != history->records[i].name_hash)
+       {
+           history->records[n++] = history->records[i];
+       }
+   }
+   history->count = history->sorted = n;
+
+   char tmp_path[1024];
+   snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+   FILE *out = fopen(tmp_path, "w");
+   if (out == NULL)
+   {
+       fprintf(stderr, "Error: Can't write history '%s': %s\n", tmp_path, strerror(errno));
+       return -1;
+   }
+
+   HISTORY_HEADER header;
+   memcpy(header.magic, HISTORY_MAGIC, 4);
+   header.count = n;
+   int err = fwrite(&header, sizeof(header), 1, out) != 1 ||
+             fwrite(history->records, sizeof(HISTORY_RECORD), n, out) != (size_t)n;
+   err |= fclose(out) != 0;
+   if (err || rename(tmp_path, path) == -1)
+   {
+       fprintf(stderr, "Error: Can't write history '%s': %s\n", path, strerror(errno));
+       unlink(tmp_path);
+       return -1;
+   }
+   return 0;
+}
+
+
+void history_free(HISTORY *history)
+{
+   free(history->records);
+   memset(history, 0, sizeof(HISTORY));
+}
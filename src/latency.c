@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "latency.h"
+
+
+#define SUB_BUCKET_BITS 4                   // 16 buckets per power of two
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+// one latency, in memory shared with the cooks
+typedef struct histogram {
+   long count;
+   long sum_ns;
+   long max_ns;
+   long buckets[NUM_BUCKETS];
+} HISTOGRAM;
+
+static const char *latency_names[NUM_LATENCIES] = {
+   [LATENCY_READY_DISPATCH] = "ready->dispatch",
+   [LATENCY_FORK_EXEC] = "fork->exec",
+   [LATENCY_EXIT_REAP] = "exit->reap",
+   [LATENCY_REAP_ENQUEUE] = "reap->enqueue",
+};
+
+static HISTOGRAM *histograms = NULL; // NULL while --latency-report is off
+static long exec_since_ns = 0;       // dispatch of the recipe whose first exec is next, or 0
+
+
+/*
+   values below SUB_BUCKETS have a bucket each. above, the bucket is picked by
+   the power of two of the value & its next SUB_BUCKET_BITS bits.
+*/
+static int bucket_of(long value)
+{
+   if (value < SUB_BUCKETS)
+   {
+       return value < 0 ? 0 : (int)value;
+   }
+   int magnitude = 63 - __builtin_clzl((unsigned long)value); // >= SUB_BUCKET_BITS
+   int shift = magnitude - SUB_BUCKET_BITS;
+   return (shift + 1) * SUB_BUCKETS + (int)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+
+// the middle of the values that go into bucket
+static long bucket_value(int bucket)
+{
+   if (bucket < SUB_BUCKETS)
+   {
+       return bucket;
+   }
+   int shift = bucket / SUB_BUCKETS - 1;
+   long low = (long)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+   return low + ((1L << shift) >> 1);
+}
+
+
+// start recording. returns 0, or -1 if the histograms could not be mapped
+int latency_open()
+{
+   histograms = mmap(NULL, NUM_LATENCIES * sizeof(HISTOGRAM), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (histograms == MAP_FAILED)
+   {
+       histograms = NULL;
+       perror("mmap");
+       return -1;
+   }
+   return 0;
+}
+
+
+/*
+   give each of the count recipes a slot for its cook's exit time, shared with
+   the cooks forked afterwards. returns 0, or -1 if they could not be mapped.
+*/
+int latency_track(RECIPE **recipes, int count)
+{
+   if (histograms == NULL)
+   {
+       return 0;
+   }
+   long *slots = mmap(NULL, (count > 0 ? count : 1) * sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (slots == MAP_FAILED)
+   {
+       perror("mmap");
+       return -1;
+   }
+   for (int i = 0; i < count; i++)
+   {
+       ((RECIPE_STATE *)recipes[i]->state)->exit_ns = &slots[i];
+   }
+   return 0;
+}
+
+
+// monotonic time in nanoseconds, or 0 without --latency-report (so it costs nothing)
+long latency_now()
+{
+   if (histograms == NULL)
+   {
+       return 0;
+   }
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+// record the time since since_ns (a latency_now time). nothing is recorded for 0
+void latency_record(LATENCY_KIND kind, long since_ns)
+{
+   if (histograms == NULL || since_ns == 0)
+   {
+       return;
+   }
+   long value = latency_now() - since_ns;
+   HISTOGRAM *h = &histograms[kind];
+   __atomic_fetch_add(&h->buckets[bucket_of(value)], 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&h->sum_ns, value, __ATOMIC_RELAXED);
+   long max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+   while (value > max && !__atomic_compare_exchange_n(&h->max_ns, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+   {
+   }
+}
+
+
+// recipe is being dispatched: it has been ready since it was enqueued
+void latency_dispatch(RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   latency_record(LATENCY_READY_DISPATCH, state->ready_ns);
+   state->dispatch_ns = latency_now();
+}
+
+
+// the next step started in this process is the first of recipe (NULL for none)
+void latency_expect_exec(RECIPE *recipe)
+{
+   exec_since_ns = (recipe != NULL) ? ((RECIPE_STATE *)recipe->state)->dispatch_ns : 0;
+}
+
+
+// a step has been exec'd. only the first of a recipe counts
+void latency_exec()
+{
+   latency_record(LATENCY_FORK_EXEC, exec_since_ns);
+   exec_since_ns = 0;
+}
+
+
+// in the cook of recipe, right before it exits
+void latency_cook_exit(RECIPE *recipe)
+{
+   long *slot = ((RECIPE_STATE *)recipe->state)->exit_ns;
+   if (slot != NULL)
+   {
+       *slot = latency_now();
+   }
+}
+
+
+// the scheduler takes up the completion of dispatched recipe
+void latency_reaped(RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   if (state->exit_ns != NULL)
+   {
+       latency_record(LATENCY_EXIT_REAP, *state->exit_ns);
+   }
+   state->reaped_ns = latency_now();
+}
+
+
+// the value below which fraction of the count recorded values of h are
+static long percentile(HISTOGRAM *h, double fraction)
+{
+   long rank = (long)(fraction * h->count + 0.5);
+   long seen = 0;
+   for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+   {
+       seen += h->buckets[bucket];
+       if (seen >= rank && seen > 0)
+       {
+           long value = bucket_value(bucket);
+           return value < h->max_ns ? value : h->max_ns;
+       }
+   }
+   return h->max_ns;
+}
+
+
+// print the count, mean & percentiles of every latency in microseconds
+void latency_report(FILE *out)
+{
+   static const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+   if (histograms == NULL)
+   {
+       return;
+   }
+   fprintf(out, "%-16s %9s %9s %9s %9s %9s %9s %9s\n", "latency (us)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+   for (int kind = 0; kind < NUM_LATENCIES; kind++)
+   {
+       HISTOGRAM *h = &histograms[kind];
+       fprintf(out, "%-16s %9ld", latency_names[kind], h->count);
+       if (h->count == 0)
+       {
+           fprintf(out, "\n");
+           continue;
+       }
+       fprintf(out, " %9.1f", h->sum_ns / 1e3 / h->count);
+       for (int i = 0; i < 4; i++)
+       {
+           fprintf(out, " %9.1f", percentile(h, fractions[i]) / 1e3);
+       }
+       fprintf(out, " %9.1f\n", h->max_ns / 1e3);
+   }
+}
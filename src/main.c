@@ -4,61 +4,73 @@
 #include <errno.h>
 
 #include "cookbook.h"
+#include "cookbook_image.h"
 #include "cook.h"
+#include "daemon.h"
+
+
+// the cookbook & its mapping live here until cleanup
+static ARENA cookbook_arena;
 
 
 int main(int argc, char *argv[]) {
     COOKBOOK *cbp;
-    int err = 0;
-    char *cookbook_filename = NULL;
-    int max_cooks = 1;
-    char *main_recipe_name = NULL;
-    FILE *in;
+    COOK_OPTIONS options;
 
     // call the function with command line arguments
-    parse_command_line(argc, argv, &cookbook_filename, &max_cooks, &main_recipe_name);
+    parse_command_line(argc, argv, &options);
 
-    // open the cookbook file
-    if ((in = fopen(cookbook_filename, "r")) == NULL)
+    // a client leaves the cookbook to the daemon it forwards the request to
+    if (options.connect_socket != NULL)
     {
-       fprintf(stderr, "Can't open cookbook '%s': %s\n", cookbook_filename, strerror(errno));
-       exit(EXIT_FAILURE);
+       int status = client_main(options.connect_socket, argc, argv);
+       free_options(&options);
+       exit(status);
     }
 
-    // parse the cookbook
-    cbp = parse_cookbook(in, &err);
-    fclose(in); // close the file after parsing
-    if (err)
+    // compiling parses the source instead of the cookbook to run
+    char *cookbook_filename = options.compile_source != NULL ? options.compile_source : options.cookbook_filename;
+
+    // map or parse the cookbook, or each of its files, into the arena
+    cbp = options.compile_source != NULL ? load_cookbook(cookbook_filename, &cookbook_arena) : load_cookbooks(&options, &cookbook_arena);
+    if (cbp == NULL)
     {
-       fprintf(stderr, "Error parsing cookbook '%s'\n", cookbook_filename);
+       free_options(&options);
        exit(EXIT_FAILURE);
     }
 
-    // if main_recipe_name is NULL, set it to the name of the first recipe in the cookbook
-    if (main_recipe_name == NULL)
+    // write the image & stop there
+    if (options.compile_source != NULL)
     {
-        if (cbp->recipes != NULL)
-        {
-           main_recipe_name = cbp->recipes->name;
-        }
-        else
-        {
-           fprintf(stderr, "Error: Cookbook '%s' contains no recipes\n", cookbook_filename);
-           exit(EXIT_FAILURE);
-        }
+       char *image_filename = options.compile_output;
+       if (image_filename == NULL)
+       {
+          size_t len = strlen(cookbook_filename) + 2;
+          if ((image_filename = malloc(len)) == NULL)
+          {
+             perror("malloc");
+             exit(EXIT_FAILURE);
+          }
+          snprintf(image_filename, len, "%sc", cookbook_filename);
+       }
+       int status = cookbook_image_write(cbp, cookbook_filename, image_filename) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+       free_options(&options);
+       exit(status);
     }
 
-    // initialize the work queue to manage recipes ready for processing
-    init_work_queue();
-
-    // do an analysis to determine all sub-recipes required by the main recipe
-    if (perform_dependency_analysis(cbp, main_recipe_name) != 0) {
-       fprintf(stderr, "Error during dependency analysis\n");
-       exit(EXIT_FAILURE);
+    // serve requests for this cookbook instead of running it once
+    if (options.daemon_socket != NULL)
+    {
+       int status = daemon_main(cbp, &options);
+       free_options(&options);
+       exit(status);
     }
 
-    // call process_recipes to start the main processing loop
-    process_recipes(cbp, max_cooks);
+    // only a daemon loads the files again, on a reload
+    free_options(&options);
+
+    // pick the main recipe, analyze its dependencies & process the recipes
+    run_cookbook(cbp, &options);
 
     // after processing, clean up resources before exiting
     cleanup(cbp);
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pid_table.h"
+
+
+// multiplicative hash of a pid into [0, 1 << bits)
+static unsigned int pid_slot(PID_TABLE *table, pid_t pid)
+{
+   return ((unsigned int)pid * 2654435761u) >> (32 - table->bits);
+}
+
+
+/*
+   size the table for max_entries live pids at a load factor of at most 1/2.
+   returns 0 on success, -1 if the slots could not be allocated.
+*/
+int pid_table_init(PID_TABLE *table, int max_entries)
+{
+   unsigned int bits = 4;
+   while ((1u << bits) < 2u * (unsigned int)max_entries)
+   {
+       bits++;
+   }
+
+   table->slots = calloc(1u << bits, sizeof(PID_ENTRY));
+   if (table->slots == NULL)
+   {
+       return -1;
+   }
+   table->bits = bits;
+   table->count = 0;
+   table->max_entries = max_entries;
+   return 0;
+}
+
+
+// returns 0 on success, -1 if the table is already holding max_entries pids
+int pid_table_insert(PID_TABLE *table, pid_t pid, RECIPE *recipe)
+{
+   if (table->count >= table->max_entries)
+   {
+       return -1;
+   }
+
+   unsigned int mask = (1u << table->bits) - 1;
+   unsigned int i = pid_slot(table, pid);
+   while (table->slots[i].pid != 0 && table->slots[i].pid != pid)
+   {
+       i = (i + 1) & mask;
+   }
+   if (table->slots[i].pid == 0)
+   {
+       table->count++;
+   }
+   table->slots[i].pid = pid;
+   table->slots[i].recipe = recipe;
+   return 0;
+}
+
+
+static int pid_table_find(PID_TABLE *table, pid_t pid)
+{
+   unsigned int mask = (1u << table->bits) - 1;
+   unsigned int i = pid_slot(table, pid);
+   while (table->slots[i].pid != 0)
+   {
+       if (table->slots[i].pid == pid)
+       {
+           return (int)i;
+       }
+       i = (i + 1) & mask;
+   }
+   return -1; // stray pid
+}
+
+
+RECIPE *pid_table_lookup(PID_TABLE *table, pid_t pid)
+{
+   int i = pid_table_find(table, pid);
+   return i < 0 ? NULL : table->slots[i].recipe;
+}
+
+
+/*
+   remove pid & return its recipe, or NULL if pid is not in the table.
+   the entries after the hole are shifted back so probe runs stay unbroken.
+*/
+RECIPE *pid_table_remove(PID_TABLE *table, pid_t pid)
+{
+   int found = pid_table_find(table, pid);
+   if (found < 0)
+   {
+       return NULL;
+   }
+
+   unsigned int mask = (1u << table->bits) - 1;
+   unsigned int hole = (unsigned int)found;
+   RECIPE *recipe = table->slots[hole].recipe;
+
+   unsigned int i = (hole + 1) & mask;
+   while (table->slots[i].pid != 0)
+   {
+       // move the entry at i into the hole unless its home slot lies
+       // cyclically in (hole, i], in which case it must stay put
+       unsigned int home = pid_slot(table, table->slots[i].pid);
+       if (((i - home) & mask) >= ((i - hole) & mask))
+       {
+           table->slots[hole] = table->slots[i];
+           hole = i;
+       }
+       i = (i + 1) & mask;
+   }
+   table->slots[hole].pid = 0;
+   table->slots[hole].recipe = NULL;
+   table->count--;
+   return recipe;
+}
+
+
+void pid_table_free(PID_TABLE *table)
+{
+   free(table->slots);
+   table->slots = NULL;
+   table->count = 0;
+}
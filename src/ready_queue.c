@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include "ready_queue.h"
+
+
+int ready_queue_init(READY_QUEUE *queue, int capacity, READY_QUEUE_ORDER order)
+{
+   queue->slots = calloc(capacity > 0 ? capacity : 1, sizeof(READY_ENTRY));
+   if (queue->slots == NULL)
+   {
+       return -1;
+   }
+   queue->capacity = capacity;
+   queue->head = 0;
+   queue->count = 0;
+   queue->next_seq = 0;
+   queue->order = order;
+   return 0;
+}
+
+
+// heap ordering: the hook decides, enqueue order breaks ties
+static int entry_before(READY_QUEUE *queue, READY_ENTRY *a, READY_ENTRY *b)
+{
+   int c = queue->order(a->recipe, b->recipe);
+   return c < 0 || (c == 0 && a->seq < b->seq);
+}
+
+
+// returns 0 on success, -1 if the queue is full
+int ready_queue_push(READY_QUEUE *queue, RECIPE *recipe)
+{
+   if (queue->count >= queue->capacity)
+   {
+       return -1;
+   }
+
+   READY_ENTRY entry = { recipe, queue->next_seq++ };
+
+   if (queue->order == NULL)
+   {
+       // FIFO: append at the tail of the ring
+       queue->slots[(queue->head + queue->count) % queue->capacity] = entry;
+       queue->count++;
+       return 0;
+   }
+
+   // heap: sift the new entry up from the last slot
+   int i = queue->count++;
+   while (i > 0)
+   {
+       int parent = (i - 1) / 2;
+       if (!entry_before(queue, &entry, &queue->slots[parent]))
+       {
+           break;
+       }
+       queue->slots[i] = queue->slots[parent];
+       i = parent;
+   }
+   queue->slots[i] = entry;
+   return 0;
+}
+
+
+// returns the next recipe to dispatch, or NULL if the queue is empty
+RECIPE *ready_queue_pop(READY_QUEUE *queue)
+{
+   if (queue->count == 0)
+   {
+       return NULL;
+   }
+
+   if (queue->order == NULL)
+   {
+       RECIPE *recipe = queue->slots[queue->head].recipe;
+       queue->head = (queue->head + 1) % queue->capacity;
+       queue->count--;
+       return recipe;
+   }
+
+   // heap: take the root & sift the last entry down from the top
+   RECIPE *recipe = queue->slots[0].recipe;
+   READY_ENTRY last = queue->slots[--queue->count];
+   int i = 0;
+   while (1)
+   {
+       int child = 2 * i + 1;
+       if (child >= queue->count)
+       {
+           break;
+       }
+       if (child + 1 < queue->count && entry_before(queue, &queue->slots[child + 1], &queue->slots[child]))
+       {
+           child++;
+       }
+       if (!entry_before(queue, &queue->slots[child], &last))
+       {
+           break;
+       }
+       queue->slots[i] = queue->slots[child];
+       i = child;
+   }
+   queue->slots[i] = last;
+   return recipe;
+}
+
+
+/*
+   returns the i-th queued recipe (0 <= i < count) without removing it.
+   in FIFO mode this is dispatch order. in heap mode it is storage order.
+*/
+RECIPE *ready_queue_at(READY_QUEUE *queue, int i)
+{
+   if (queue->order == NULL)
+   {
+       return queue->slots[(queue->head + i) % queue->capacity].recipe;
+   }
+   return queue->slots[i].recipe;
+}
+
+
+void ready_queue_free(READY_QUEUE *queue)
+{
+   free(queue->slots);
+   queue->slots = NULL;
+   queue->capacity = queue->count = 0;
+}
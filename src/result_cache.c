@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "result_cache.h"
+
+
+static char *cache_dir = NULL;  // NULL while the cache is not in use
+static int cache_hits = 0;
+static int cache_misses = 0;
+
+
+/*
+   128-bit content hash: two FNV-1a lanes with different offset bases.
+   a single 64-bit lane is too narrow to name objects in a store that
+   outlives many runs.
+*/
+typedef struct hash128
+{
+   uint64_t h[2];
+} HASH128;
+
+static void hash_init(HASH128 *hash)
+{
+   hash->h[0] = 14695981039346656037UL;
+   hash->h[1] = 0x84222325cbf29ce4UL;
+}
+
+static void hash_bytes(HASH128 *hash, const void *data, size_t len)
+{
+   const unsigned char *p = data;
+   for (size_t i = 0; i < len; i++)
+   {
+       hash->h[0] = (hash->h[0] ^ p[i]) * 1099511628211UL;
+       hash->h[1] = (hash->h[1] ^ p[i]) * 1099511628211UL;
+   }
+}
+
+// a string & its terminating NUL, so adjacent strings can't run together
+static void hash_string(HASH128 *hash, const char *s)
+{
+   hash_bytes(hash, s, strlen(s) + 1);
+}
+
+static void hash_hex(const uint64_t h[2], char hex[33])
+{
+   snprintf(hex, 33, "%016lx%016lx", (unsigned long)h[0], (unsigned long)h[1]);
+}
+
+
+// hash the contents of path. returns 0, or -1 if it could not be read
+static int hash_file(const char *path, HASH128 *hash)
+{
+   int fd = open(path, O_RDONLY);
+   if (fd == -1)
+   {
+       return -1;
+   }
+   hash_init(hash);
+   char buf[65536];
+   ssize_t n;
+   while ((n = read(fd, buf, sizeof(buf))) > 0)
+   {
+       hash_bytes(hash, buf, n);
+   }
+   close(fd);
+   return (n == -1) ? -1 : 0;
+}
+
+
+// copy from to to (created or truncated). returns 0, or -1 on error
+static int copy_file(const char *from, const char *to)
+{
+   int in = open(from, O_RDONLY);
+   if (in == -1)
+   {
+       return -1;
+   }
+   int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (out == -1)
+   {
+       close(in);
+       return -1;
+   }
+   char buf[65536];
+   ssize_t n;
+   int err = 0;
+   while (!err && (n = read(in, buf, sizeof(buf))) > 0)
+   {
+       err = (write(out, buf, n) != n);
+   }
+   err |= (n == -1);
+   close(in);
+   err |= (close(out) != 0);
+   return err ? -1 : 0;
+}
+
+
+static int make_dir(const char *path)
+{
+   if (mkdir(path, 0777) == -1 && errno != EEXIST)
+   {
+       fprintf(stderr, "Error: Can't create cache directory '%s': %s\n", path, strerror(errno));
+       return -1;
+   }
+   return 0;
+}
+
+
+/*
+   use dir as the cache, creating it & its entries/ & objects/ subdirectories.
+   returns 0 on success, -1 on error.
+*/
+int result_cache_open(const char *dir)
+{
+   char path[1024];
+   if (make_dir(dir) != 0)
+   {
+       return -1;
+   }
+   snprintf(path, sizeof(path), "%s/entries", dir);
+   if (make_dir(path) != 0)
+   {
+       return -1;
+   }
+   snprintf(path, sizeof(path), "%s/objects", dir);
+   if (make_dir(path) != 0)
+   {
+       return -1;
+   }
+   cache_dir = strdup(dir);
+   return (cache_dir != NULL) ? 0 : -1;
+}
+
+
+// fingerprint recipe into its state. all of its sub-recipes must have been fingerprinted
+static void fingerprint_recipe(RECIPE *recipe)
+{
+   HASH128 hash;
+   hash_init(&hash);
+
+   for (TASK *task = recipe->tasks; task != NULL; task = task->next)
+   {
+       for (STEP *step = task->steps; step != NULL; step = step->next)
+       {
+           for (char **word = step->words; *word != NULL; word++)
+           {
+               hash_string(&hash, *word);
+           }
+           hash_string(&hash, "|");
+       }
+       hash_string(&hash, task->output_file != NULL ? task->output_file : "");
+       hash_string(&hash, task->input_file != NULL ? task->input_file : "");
+       if (task->input_file != NULL)
+       {
+           // an unreadable input hashes like an empty one. the task will fail anyway
+           HASH128 contents = { { 0, 0 } };
+           hash_file(task->input_file, &contents);
+           hash_bytes(&hash, contents.h, sizeof(contents.h));
+       }
+       hash_string(&hash, ";");
+   }
+
+   for (RECIPE_LINK *link = recipe->this_depends_on; link != NULL; link = link->next)
+   {
+       hash_bytes(&hash, ((RECIPE_STATE *)link->recipe->state)->fingerprint, sizeof(hash.h));
+   }
+
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   memcpy(state->fingerprint, hash.h, sizeof(hash.h));
+}
+
+
+// make path hold the object named by hex. returns 0, or -1 if it can't be restored
+static int restore_output(const char *hex, const char *path)
+{
+   HASH128 current;
+   char current_hex[33];
+   if (hash_file(path, &current) == 0)
+   {
+       hash_hex(current.h, current_hex);
+       if (strcmp(current_hex, hex) == 0)
+       {
+           return 0; // present & unchanged
+       }
+   }
+
+   char object[1024];
+   snprintf(object, sizeof(object), "%s/objects/%s", cache_dir, hex);
+   return copy_file(object, path);
+}
+
+
+/*
+   read the next line of an entry: the hex name of an object, a space & the
+   output file it restores. a token of the cookbook never holds a newline, so
+   the path is the rest of the line & may contain spaces. on success *hex &
+   *output point into *line, which getline grows as needed.
+   returns 1 for a line, 0 at the end of entry, or -1 for a line that is
+   truncated or malformed, which makes the entry a miss.
+*/
+static int read_entry_line(FILE *entry, char **line, size_t *size, char **hex, char **output)
+{
+   ssize_t len = getline(line, size, entry);
+   if (len == -1)
+   {
+       return ferror(entry) ? -1 : 0;
+   }
+   char *s = *line;
+   if (len < 35 || s[len - 1] != '\n' || s[32] != ' ' || strspn(s, "0123456789abcdef") != 32)
+   {
+       return -1;
+   }
+   s[32] = '\0';
+   s[len - 1] = '\0';
+   *hex = s;
+   *output = s + 33;
+   return 1;
+}
+
+
+/*
+   fingerprint recipe & look it up. on a hit every recorded output file is
+   checked & restored from the objects where it is missing or changed.
+   called by the scheduler when recipe is dequeued.
+   returns 1 if the recipe is up to date & need not run, 0 if it must run.
+*/
+int result_cache_restore(RECIPE *recipe)
+{
+   if (cache_dir == NULL)
+   {
+       return 0;
+   }
+   fingerprint_recipe(recipe);
+
+   char hex[33], path[1024];
+   hash_hex(((RECIPE_STATE *)recipe->state)->fingerprint, hex);
+   snprintf(path, sizeof(path), "%s/entries/%s", cache_dir, hex);
+   FILE *entry = fopen(path, "r");
+   if (entry == NULL)
+   {
+       cache_misses++;
+       return 0;
+   }
+
+   // an entry without outputs can't stand in for running the recipe (see result_cache_store)
+   char *line = NULL, *object_hex, *output;
+   size_t size = 0;
+   int hit = 1, outputs = 0, status;
+   while (hit && (status = read_entry_line(entry, &line, &size, &object_hex, &output)) != 0)
+   {
+       hit = (status == 1 && restore_output(object_hex, output) == 0);
+       outputs++;
+   }
+   free(line);
+   fclose(entry);
+   hit &= (outputs > 0);
+
+   if (hit)
+   {
+       cache_hits++;
+   }
+   else
+   {
+       cache_misses++;
+   }
+   return hit;
+}
+
+
+// copy path into the objects & write its content hash to hex. returns 0, or -1 on error
+static int store_output(const char *path, char hex[33])
+{
+   HASH128 contents;
+   if (hash_file(path, &contents) != 0)
+   {
+       return -1;
+   }
+   hash_hex(contents.h, hex);
+
+   char object[1024], tmp[1100];
+   snprintf(object, sizeof(object), "%s/objects/%s", cache_dir, hex);
+   if (access(object, F_OK) == 0)
+   {
+       return 0; // already stored
+   }
+   // concurrent cooks may store the same contents. each writes its own file
+   snprintf(tmp, sizeof(tmp), "%s.%d", object, (int)getpid());
+   if (copy_file(path, tmp) != 0 || rename(tmp, object) != 0)
+   {
+       unlink(tmp);
+       return -1;
+   }
+   return 0;
+}
+
+
+/*
+   record the outputs of a recipe that has just completed successfully under the
+   fingerprint taken by result_cache_restore. runs in the cook process, or in
+   the scheduler with direct exec, so the outputs are stored before any later
+   recipe can change them.
+   a recipe that redirects no output has only side effects the cache can't
+   restore, so nothing is recorded & it runs every time. each output is one
+   line, read back by read_entry_line.
+   returns 0 on success, -1 if the result could not be stored (the recipe still
+   succeeded, it just won't be a hit next time).
+*/
+int result_cache_store(RECIPE *recipe)
+{
+   if (cache_dir == NULL)
+   {
+       return 0;
+   }
+   TASK *task = recipe->tasks;
+   while (task != NULL && task->output_file == NULL)
+   {
+       task = task->next;
+   }
+   if (task == NULL)
+   {
+       return 0;
+   }
+
+   char hex[33], path[1024], tmp[1100];
+   hash_hex(((RECIPE_STATE *)recipe->state)->fingerprint, hex);
+   snprintf(path, sizeof(path), "%s/entries/%s", cache_dir, hex);
+   snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+   FILE *entry = fopen(tmp, "w");
+   if (entry == NULL)
+   {
+       return -1;
+   }
+   int err = 0;
+   for (task = recipe->tasks; task != NULL && !err; task = task->next)
+   {
+       char object_hex[33];
+       if (task->output_file == NULL)
+       {
+           continue;
+       }
+       err = store_output(task->output_file, object_hex) != 0 ||
+             fprintf(entry, "%s %s\n", object_hex, task->output_file) < 0;
+   }
+   err |= (fclose(entry) != 0);
+   if (err || rename(tmp, path) != 0)
+   {
+       fprintf(stderr, "Warning: Can't cache the result of recipe '%s'\n", recipe->name);
+       unlink(tmp);
+       return -1;
+   }
+   return 0;
+}
+
+
+// print the # of recipes that were skipped & run because of the cache
+void result_cache_report(FILE *out)
+{
+   if (cache_dir != NULL)
+   {
+       fprintf(out, "cache: %d hits, %d misses\n", cache_hits, cache_misses);
+   }
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "history.h"
+#include "schedule.h"
+
+
+/*
+   structural cost estimate of a recipe: the # of steps over all its tasks.
+   every recipe costs at least one cook, so the weight is never below 1.
+*/
+long recipe_weight(RECIPE *recipe)
+{
+   long weight = 0;
+   for (TASK *task = recipe->tasks; task != NULL; task = task->next)
+   {
+       for (STEP *step = task->steps; step != NULL; step = step->next)
+       {
+           weight++;
+       }
+   }
+   return weight > 0 ? weight : 1;
+}
+
+
+// weight each of the num_required required recipes in order by its structure alone
+void assign_structural_weights(RECIPE **order, int num_required)
+{
+   for (int i = 0; i < num_required; i++)
+   {
+       ((RECIPE_STATE *)order[i]->state)->weight = recipe_weight(order[i]);
+   }
+}
+
+
+/*
+   weight each of the num_required required recipes in order by its recorded
+   wall time in microseconds.
+   recipes without a usable record fall back to their structural weight, scaled
+   by the mean recorded time per step of the recipes that have one, so both kinds
+   of weight are in the same unit. with no records at all, every weight is
+   structural.
+*/
+void assign_history_weights(RECIPE **order, int num_required, HISTORY *history)
+{
+   long recorded_us = 0, recorded_steps = 0;
+   for (int i = 0; i < num_required; i++)
+   {
+       RECIPE *rp = order[i];
+       RECIPE_STATE *state = (RECIPE_STATE *)rp->state;
+       state->weight = history_lookup(history, rp);  // -1 if there is no record
+       if (state->weight >= 0)
+       {
+           recorded_us += state->weight;
+           recorded_steps += recipe_weight(rp);
+       }
+   }
+
+   long us_per_step = (recorded_steps > 0 && recorded_us > 0) ? recorded_us / recorded_steps : 1;
+   if (us_per_step < 1)
+   {
+       us_per_step = 1;
+   }
+   for (int i = 0; i < num_required; i++)
+   {
+       RECIPE_STATE *state = (RECIPE_STATE *)order[i]->state;
+       if (state->weight < 0)
+       {
+           state->weight = recipe_weight(order[i]) * us_per_step;
+       }
+   }
+}
+
+
+/*
+   set the priority of every required recipe to the weight of the longest path
+   from it up to the main recipe (its own weight included). the weights must
+   already have been assigned by assign_structural_weights or assign_history_weights.
+
+   order is the topological order of the num_required required recipes built
+   by mark_required_recipes, sub-recipes first. walking it backwards from the
+   main recipe reaches every recipe after all of its required dependents, so
+   until then its priority holds the max over them, & every this_depends_on
+   link is looked at exactly once.
+*/
+void compute_critical_path(RECIPE **order, int num_required)
+{
+   for (int i = 0; i < num_required; i++)
+   {
+       ((RECIPE_STATE *)order[i]->state)->priority = 0;
+   }
+
+   for (int i = num_required - 1; i >= 0; i--)
+   {
+       RECIPE_STATE *state = (RECIPE_STATE *)order[i]->state;
+       state->priority += state->weight;
+
+       for (RECIPE_LINK *link = order[i]->this_depends_on; link != NULL; link = link->next)
+       {
+           RECIPE_STATE *sub_state = (RECIPE_STATE *)link->recipe->state;
+           if (sub_state->priority < state->priority)
+           {
+               sub_state->priority = state->priority;
+           }
+       }
+   }
+}
+
+
+// ready queue hook: longest remaining path first
+int critical_path_order(RECIPE *a, RECIPE *b)
+{
+   long pa = ((RECIPE_STATE *)a->state)->priority;
+   long pb = ((RECIPE_STATE *)b->state)->priority;
+   return (pa > pb) ? -1 : (pa < pb);
+}
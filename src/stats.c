@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "stats.h"
+
+
+static RECIPE **stats_recipes = NULL; // the recipes with totals, NULL while --stats is off
+static int num_stats_recipes = 0;
+static RECIPE_USAGE *cook_usage = NULL; // totals of the recipe this cook runs
+static const char *csv_path = NULL;
+
+
+static long timeval_us(struct timeval tv)
+{
+   return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+
+/*
+   give each of the count recipes zeroed totals, in memory shared with the
+   cooks forked afterwards. stats_report also writes them to path, unless it
+   is NULL. returns 0, or -1 if the totals could not be mapped.
+*/
+int stats_init(RECIPE **recipes, int count, const char *path)
+{
+   size_t size = (count > 0 ? count : 1) * sizeof(RECIPE_USAGE);
+   RECIPE_USAGE *usage = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (usage == MAP_FAILED)
+   {
+       perror("mmap");
+       return -1;
+   }
+   for (int i = 0; i < count; i++)
+   {
+       ((RECIPE_STATE *)recipes[i]->state)->usage = &usage[i];
+   }
+   stats_recipes = recipes;
+   num_stats_recipes = count;
+   csv_path = path;
+   return 0;
+}
+
+
+// the totals of recipe, or of the recipe this cook runs for NULL. NULL without --stats
+static RECIPE_USAGE *usage_of(RECIPE *recipe)
+{
+   if (recipe == NULL)
+   {
+       return cook_usage;
+   }
+   return stats_recipes != NULL ? ((RECIPE_STATE *)recipe->state)->usage : NULL;
+}
+
+
+/*
+   add the rusage of a step reaped with wait4 to recipe's totals (NULL for the
+   recipe this cook runs). async-signal-safe, like the rest of the recording.
+*/
+void stats_step_reaped(RECIPE *recipe, const struct rusage *ru)
+{
+   RECIPE_USAGE *usage = usage_of(recipe);
+   if (usage == NULL)
+   {
+       return;
+   }
+   usage->user_us += timeval_us(ru->ru_utime);
+   usage->sys_us += timeval_us(ru->ru_stime);
+   if (ru->ru_maxrss > usage->maxrss_kb)
+   {
+       usage->maxrss_kb = ru->ru_maxrss;
+   }
+   usage->minflt += ru->ru_minflt;
+   usage->majflt += ru->ru_majflt;
+   usage->nvcsw += ru->ru_nvcsw;
+   usage->nivcsw += ru->ru_nivcsw;
+   usage->steps++;
+}
+
+
+// the cook of recipe was reaped with wait4. its rusage includes the steps it waited for
+void stats_cook_reaped(RECIPE *recipe, const struct rusage *ru)
+{
+   RECIPE_USAGE *usage = usage_of(recipe);
+   if (usage == NULL)
+   {
+       return;
+   }
+   usage->cook_us = timeval_us(ru->ru_utime) + timeval_us(ru->ru_stime) - usage->user_us - usage->sys_us;
+}
+
+
+// a dispatched recipe completed after wall_us
+void stats_complete(RECIPE *recipe, long wall_us)
+{
+   RECIPE_USAGE *usage = usage_of(recipe);
+   if (usage == NULL)
+   {
+       return;
+   }
+   usage->wall_us = wall_us;
+   usage->ran = 1;
+}
+
+
+// in a newly forked cook: add the steps reaped from now on to recipe's totals
+void stats_enter_cook(RECIPE *recipe)
+{
+   cook_usage = usage_of(recipe);
+}
+
+
+// name as a quoted CSV field
+static void put_csv_name(FILE *csv, const char *name)
+{
+   fputc('"', csv);
+   for (const char *c = name; *c != '\0'; c++)
+   {
+       if (*c == '"')
+       {
+           fputc('"', csv);
+       }
+       fputc(*c, csv);
+   }
+   fputc('"', csv);
+}
+
+
+// most CPU time in the steps first, then by name
+static int compare_cpu(const void *a, const void *b)
+{
+   RECIPE *ra = *(RECIPE **)a;
+   RECIPE *rb = *(RECIPE **)b;
+   RECIPE_USAGE *ua = ((RECIPE_STATE *)ra->state)->usage;
+   RECIPE_USAGE *ub = ((RECIPE_STATE *)rb->state)->usage;
+   long ca = ua->user_us + ua->sys_us;
+   long cb = ub->user_us + ub->sys_us;
+   if (ca != cb)
+   {
+       return (ca < cb) - (ca > cb);
+   }
+   return strcmp(ra->name, rb->name);
+}
+
+
+/*
+   print the totals of every recipe that ran to out, most CPU first, & write
+   them to the CSV file given to stats_init. cpu% is the CPU time of the steps
+   over the recipe's wall time: near 100 (or above, for a pipeline) is
+   CPU-bound, near 0 is waiting. returns 0, or -1 if the CSV could not be written.
+*/
+int stats_report(FILE *out)
+{
+   if (stats_recipes == NULL)
+   {
+       return 0;
+   }
+   RECIPE **ran = malloc((num_stats_recipes > 0 ? num_stats_recipes : 1) * sizeof(RECIPE *));
+   if (ran == NULL)
+   {
+       perror("malloc");
+       return -1;
+   }
+   int count = 0;
+   for (int i = 0; i < num_stats_recipes; i++)
+   {
+       if (((RECIPE_STATE *)stats_recipes[i]->state)->usage->ran)
+       {
+           ran[count++] = stats_recipes[i];
+       }
+   }
+   qsort(ran, count, sizeof(RECIPE *), compare_cpu);
+
+   fprintf(out, "%-24s %5s %9s %9s %9s %6s %10s %8s %7s %8s %8s %8s\n", "recipe", "steps", "wall(s)", "user(s)",
+           "sys(s)", "cpu%", "maxrss(kB)", "minflt", "majflt", "vcsw", "ivcsw", "cook(ms)");
+   for (int i = 0; i < count; i++)
+   {
+       RECIPE_USAGE *u = ((RECIPE_STATE *)ran[i]->state)->usage;
+       double cpu = u->wall_us > 0 ? 100.0 * (u->user_us + u->sys_us) / u->wall_us : 0;
+       fprintf(out, "%-24s %5d %9.3f %9.3f %9.3f %6.1f %10ld %8ld %7ld %8ld %8ld %8.1f\n", ran[i]->name, u->steps,
+               u->wall_us / 1e6, u->user_us / 1e6, u->sys_us / 1e6, cpu, u->maxrss_kb, u->minflt, u->majflt,
+               u->nvcsw, u->nivcsw, u->cook_us / 1e3);
+   }
+
+   int err = 0;
+   if (csv_path != NULL)
+   {
+       FILE *csv = fopen(csv_path, "w");
+       if (csv == NULL)
+       {
+           fprintf(stderr, "Error: Cannot write stats to '%s': %s\n", csv_path, strerror(errno));
+           free(ran);
+           return -1;
+       }
+       fprintf(csv, "recipe,steps,wall_us,user_us,sys_us,maxrss_kb,minflt,majflt,nvcsw,nivcsw,cook_us\n");
+       for (int i = 0; i < count; i++)
+       {
+           RECIPE_USAGE *u = ((RECIPE_STATE *)ran[i]->state)->usage;
+           put_csv_name(csv, ran[i]->name);
+           fprintf(csv, ",%d,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", u->steps, u->wall_us,
+                   u->user_us, u->sys_us, u->maxrss_kb, u->minflt, u->majflt, u->nvcsw, u->nivcsw, u->cook_us);
+       }
+       if (fclose(csv) != 0)
+       {
+           fprintf(stderr, "Error: Cannot write stats to '%s': %s\n", csv_path, strerror(errno));
+           err = -1;
+       }
+   }
+   free(ran);
+   return err;
+}
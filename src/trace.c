@@ -0,0 +1,394 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "trace.h"
+
+
+#define TRACE_RECORDS 4096   // events buffered before they are written out
+#define TRACE_TEXT 65536     // size of the buffer they are formatted into
+#define TRACE_NAME_MAX 256   // longer names are cut short in the trace
+#define TRACE_EVENT_MAX 2048 // longest formatted event (a name of TRACE_NAME_MAX all escaped as \u00xx)
+
+// an event as recorded, formatted only when the buffer is written out
+typedef struct trace_record {
+   long ns;            // monotonic time since trace_open
+   const char *name;   // recipe or command name, valid in the process that recorded it
+   long id;            // pid of the step (steps only)
+   long arg;
+   int lane;
+   TRACE_KIND kind;
+} TRACE_RECORD;
+
+// how each kind of event is written
+static const struct {
+   const char *ph;     // phase of the event in the trace format
+   const char *cat;
+   const char *arg;    // name of arg in the event's args, or NULL
+} kinds[] = {
+   [TRACE_QUEUE] = { "i", "queue", NULL },
+   [TRACE_DISPATCH] = { "B", "recipe", NULL },
+   [TRACE_COMPLETE] = { "E", "recipe", "failed" },
+   [TRACE_TASK_BEGIN] = { "B", "task", "steps" },
+   [TRACE_TASK_END] = { "E", "task", "status" },
+   [TRACE_STEP_EXEC] = { "b", "step", "pid" },
+   [TRACE_STEP_EXIT] = { "e", "step", "status" },
+};
+
+static int trace_fd = -1;  // -1 while not tracing
+static long epoch_ns;
+static int cook_lane = TRACE_SCHEDULER; // lane of this process's events for TRACE_THIS_COOK
+
+static TRACE_RECORD records[TRACE_RECORDS];
+static int num_records = 0;
+
+static char text[TRACE_TEXT];
+static int text_len = 0;
+
+static char *lane_busy = NULL; // lane_busy[i] is set while cook lane i + 1 runs a recipe
+static int num_lanes = 0;
+
+
+static long monotonic_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+/*
+   the formatting below uses neither stdio nor malloc, so a buffer that fills
+   up can be written out from the SIGCHLD handler of the signal engine. the
+   main loop only records events while SIGCHLD is blocked, so the handler never
+   interrupts another recording.
+*/
+
+static void put(const char *s)
+{
+   while (*s != '\0')
+   {
+       text[text_len++] = *s++;
+   }
+}
+
+
+static void put_long(long value)
+{
+   char digits[24];
+   int n = 0;
+   unsigned long v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+   do
+   {
+       digits[n++] = '0' + v % 10;
+       v /= 10;
+   } while (v != 0);
+   if (value < 0)
+   {
+       text[text_len++] = '-';
+   }
+   while (n > 0)
+   {
+       text[text_len++] = digits[--n];
+   }
+}
+
+
+// s as a JSON string, cut short after TRACE_NAME_MAX characters
+static void put_name(const char *s)
+{
+   static const char hex[] = "0123456789abcdef";
+   text[text_len++] = '"';
+   for (int i = 0; s[i] != '\0' && i < TRACE_NAME_MAX; i++)
+   {
+       unsigned char c = s[i];
+       if (c == '"' || c == '\\')
+       {
+           text[text_len++] = '\\';
+           text[text_len++] = c;
+       }
+       else if (c < 0x20)
+       {
+           put("\\u00");
+           text[text_len++] = hex[c >> 4];
+           text[text_len++] = hex[c & 0xf];
+       }
+       else
+       {
+           text[text_len++] = c;
+       }
+   }
+   text[text_len++] = '"';
+}
+
+
+// the "pid" & "tid" of lane, whose events the viewers show as one swimlane
+static void put_lane(int lane)
+{
+   put(",\"pid\":");
+   put_long(lane);
+   put(",\"tid\":");
+   put_long(lane);
+}
+
+
+static void put_event(TRACE_RECORD *r)
+{
+   put("{\"name\":");
+   put_name(r->name);
+   put(",\"cat\":\"");
+   put(kinds[r->kind].cat);
+   put("\",\"ph\":\"");
+   put(kinds[r->kind].ph);
+   put("\",\"ts\":");
+   put_long(r->ns / 1000);
+   text[text_len++] = '.';
+   text[text_len++] = '0' + r->ns / 100 % 10;
+   text[text_len++] = '0' + r->ns / 10 % 10;
+   text[text_len++] = '0' + r->ns % 10;
+   put_lane(r->lane);
+   if (r->kind == TRACE_QUEUE)
+   {
+       put(",\"s\":\"t\"");
+   }
+   if (r->kind == TRACE_STEP_EXEC || r->kind == TRACE_STEP_EXIT)
+   {
+       put(",\"id\":");
+       put_long(r->id);
+   }
+   if (kinds[r->kind].arg != NULL)
+   {
+       put(",\"args\":{\"");
+       put(kinds[r->kind].arg);
+       put("\":");
+       put_long(r->arg);
+       text[text_len++] = '}';
+   }
+   put("},\n");
+}
+
+
+// write out the formatted text. a single write holds whole events only
+static void write_text()
+{
+   int off = 0;
+   while (off < text_len)
+   {
+       ssize_t n = write(trace_fd, text + off, text_len - off);
+       if (n == -1 && errno == EINTR)
+       {
+           continue;
+       }
+       if (n <= 0)
+       {
+           break; // the trace is incomplete, but the run goes on
+       }
+       off += n;
+   }
+   text_len = 0;
+}
+
+
+// format & write out every recorded event
+void trace_flush()
+{
+   if (trace_fd == -1)
+   {
+       return;
+   }
+   for (int i = 0; i < num_records; i++)
+   {
+       if (text_len > TRACE_TEXT - TRACE_EVENT_MAX)
+       {
+           write_text();
+       }
+       put_event(&records[i]);
+   }
+   write_text();
+   num_records = 0;
+}
+
+
+// start tracing to path. returns 0, or -1 if it could not be created
+int trace_open(const char *path)
+{
+   trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+   if (trace_fd == -1)
+   {
+       fprintf(stderr, "Error: Cannot open trace file '%s': %s\n", path, strerror(errno));
+       return -1;
+   }
+   epoch_ns = monotonic_ns();
+   put("[\n");
+   write_text();
+   return 0;
+}
+
+
+/*
+   write out the rest of the trace & close it. called by the scheduler once
+   every cook has exited (& written out its own events), so these are the last
+   events in the file. they name the lanes & close the JSON array.
+*/
+void trace_close()
+{
+   if (trace_fd == -1)
+   {
+       return;
+   }
+   trace_flush();
+   for (int lane = 0; lane <= num_lanes; lane++)
+   {
+       if (text_len > TRACE_TEXT - TRACE_EVENT_MAX)
+       {
+           write_text();
+       }
+       for (int thread = 0; thread < 2; thread++)
+       {
+           put(thread ? "{\"name\":\"thread_name\",\"ph\":\"M\",\"ts\":0" : "{\"name\":\"process_name\",\"ph\":\"M\",\"ts\":0");
+           put_lane(lane);
+           put(",\"args\":{\"name\":\"");
+           if (lane == TRACE_SCHEDULER)
+           {
+               put("scheduler");
+           }
+           else
+           {
+               put("cook ");
+               put_long(lane);
+           }
+           put(lane == num_lanes && thread ? "\"}}\n]\n" : "\"}},\n");
+       }
+   }
+   write_text();
+   close(trace_fd);
+   trace_fd = -1;
+   free(lane_busy);
+   lane_busy = NULL;
+   num_lanes = 0;
+}
+
+
+// record an event of kind on lane. name must stay valid until the buffer is written out
+void trace_event(TRACE_KIND kind, int lane, const char *name, long id, long arg)
+{
+   if (trace_fd == -1)
+   {
+       return;
+   }
+   if (num_records == TRACE_RECORDS)
+   {
+       trace_flush();
+   }
+   TRACE_RECORD *r = &records[num_records++];
+   r->ns = monotonic_ns() - epoch_ns;
+   r->name = name;
+   r->id = id;
+   r->arg = arg;
+   r->lane = (lane == TRACE_THIS_COOK) ? cook_lane : lane;
+   r->kind = kind;
+}
+
+
+/*
+   give recipe the lowest free cook lane & record its dispatch there. called
+   before the cook is forked, so the cook knows its lane. a new lane is only
+   allocated when every lane in use runs a recipe, i.e. at most once per slot
+   of -c. without the memory for it the recipe goes on the scheduler's lane.
+*/
+void trace_dispatch(RECIPE *recipe)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   if (trace_fd == -1)
+   {
+       return;
+   }
+   int i = 0;
+   while (i < num_lanes && lane_busy[i])
+   {
+       i++;
+   }
+   if (i == num_lanes)
+   {
+       char *grown = realloc(lane_busy, num_lanes + 1);
+       if (grown == NULL)
+       {
+           state->lane = TRACE_SCHEDULER;
+           trace_event(TRACE_DISPATCH, TRACE_SCHEDULER, recipe->name, 0, 0);
+           return;
+       }
+       lane_busy = grown;
+       num_lanes++;
+   }
+   lane_busy[i] = 1;
+   state->lane = i + 1;
+   trace_event(TRACE_DISPATCH, state->lane, recipe->name, 0, 0);
+}
+
+
+// record the end of a dispatched recipe & free its lane
+void trace_complete(RECIPE *recipe, int failed)
+{
+   RECIPE_STATE *state = (RECIPE_STATE *)recipe->state;
+   if (trace_fd == -1)
+   {
+       return;
+   }
+   trace_event(TRACE_COMPLETE, state->lane, recipe->name, 0, failed);
+   if (state->lane != TRACE_SCHEDULER)
+   {
+       lane_busy[state->lane - 1] = 0;
+   }
+}
+
+
+// record the exec of every step of task that was started (pids[i] is -1 for one that was not)
+void trace_steps_started(TASK *task, pid_t *pids, int lane)
+{
+   int i = 0;
+   for (STEP *step = task->steps; step != NULL; step = step->next, i++)
+   {
+       if (pids[i] != -1)
+       {
+           trace_event(TRACE_STEP_EXEC, lane, step->words[0], pids[i], pids[i]);
+       }
+   }
+}
+
+
+// record the exit of a step with wait status status, or -1 if it could not be waited for
+void trace_step_exit(STEP *step, pid_t pid, int status, int lane)
+{
+   long code = status;
+   if (status != -1)
+   {
+       code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+   }
+   trace_event(TRACE_STEP_EXIT, lane, step->words[0], pid, code);
+}
+
+
+// in a newly forked cook: drop the scheduler's events copied by fork & record on recipe's lane
+void trace_enter_cook(RECIPE *recipe)
+{
+   num_records = 0;
+   cook_lane = ((RECIPE_STATE *)recipe->state)->lane;
+}
+
+
+// in a newly forked process that records nothing: drop the scheduler's events & stop tracing
+void trace_detach()
+{
+   num_records = 0;
+   if (trace_fd != -1)
+   {
+       close(trace_fd);
+       trace_fd = -1;
+   }
+}
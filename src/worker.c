@@ -0,0 +1,486 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "cookbook.h"
+#include "cook_state.h"
+#include "worker.h"
+
+
+/*
+   worker side of --workers=N & the wire format shared with the coordinator
+   (see worker.h & coordinator.c).
+
+   a worker announces its capacity, then forks a cook for every RUN it is sent.
+   the cook decodes the tasks & runs them with execute_task, exactly like a
+   local cook does. the worker watches a pidfd per cook & answers with a DONE
+   when it exits. once the coordinator closes the connection, the worker waits
+   for its cooks & exits.
+*/
+
+
+#define CONN_MIN_READ 4096
+
+
+int conn_init(CONN *conn, int fd)
+{
+   conn->fd = fd;
+   conn->len = 0;
+   conn->off = 0;
+   conn->cap = 4 * CONN_MIN_READ;
+   conn->buf = malloc(conn->cap);
+   return conn->buf == NULL ? -1 : 0;
+}
+
+
+/*
+   read whatever is available on the connection. frames handed out by conn_next
+   are dropped first, so their bodies are only valid until the next call.
+   returns the # of bytes read, 0 on end of file or -1 on error.
+*/
+int conn_fill(CONN *conn)
+{
+   if (conn->off > 0)
+   {
+       memmove(conn->buf, conn->buf + conn->off, conn->len - conn->off);
+       conn->len -= conn->off;
+       conn->off = 0;
+   }
+   if (conn->cap - conn->len < CONN_MIN_READ)
+   {
+       char *buf = realloc(conn->buf, 2 * conn->cap);
+       if (buf == NULL)
+       {
+           return -1;
+       }
+       conn->buf = buf;
+       conn->cap *= 2;
+   }
+
+   ssize_t n;
+   while ((n = read(conn->fd, conn->buf + conn->len, conn->cap - conn->len)) == -1 && errno == EINTR)
+   {
+       // retry
+   }
+   if (n > 0)
+   {
+       conn->len += n;
+   }
+   return (int)n;
+}
+
+
+// hand out the next complete frame. returns 1 if there was one, 0 if not, or -1 if the peer is broken
+int conn_next(CONN *conn, int *type, char **body, size_t *len)
+{
+   uint32_t frame_len;
+   if (conn->len - conn->off < sizeof(frame_len))
+   {
+       return 0;
+   }
+   memcpy(&frame_len, conn->buf + conn->off, sizeof(frame_len));
+   frame_len = ntohl(frame_len);
+   if (frame_len < 1 || frame_len > MSG_MAX_LEN)
+   {
+       return -1;
+   }
+   if (conn->len - conn->off < sizeof(frame_len) + frame_len)
+   {
+       return 0;
+   }
+
+   char *frame = conn->buf + conn->off + sizeof(frame_len);
+   *type = (unsigned char)frame[0];
+   *body = frame + 1;
+   *len = frame_len - 1;
+   conn->off += sizeof(frame_len) + frame_len;
+   return 1;
+}
+
+
+void conn_free(CONN *conn)
+{
+   free(conn->buf);
+   conn->buf = NULL;
+}
+
+
+// write all of buf. MSG_NOSIGNAL turns a dead peer into EPIPE instead of a SIGPIPE
+static int send_all(int fd, const char *buf, size_t len, int flags)
+{
+   while (len > 0)
+   {
+       ssize_t n = send(fd, buf, len, flags | MSG_NOSIGNAL);
+       if (n == -1)
+       {
+           if (errno == EINTR)
+           {
+               continue;
+           }
+           return -1;
+       }
+       buf += n;
+       len -= n;
+   }
+   return 0;
+}
+
+
+// send one frame. returns 0, or -1 if the peer is gone
+int send_message(int fd, int type, const void *body, size_t len)
+{
+   char header[5];
+   uint32_t frame_len = htonl((uint32_t)len + 1);
+   memcpy(header, &frame_len, sizeof(frame_len));
+   header[4] = (char)type;
+   if (send_all(fd, header, sizeof(header), MSG_MORE) != 0 || send_all(fd, body, len, 0) != 0)
+   {
+       return -1;
+   }
+   return 0;
+}
+
+
+static void put_tagged(FILE *out, char tag, const char *s)
+{
+   fputc(tag, out);
+   fputs(s, out);
+   fputc('\0', out);
+}
+
+
+// serialize job & the tasks of recipe into a RUN body, which the caller frees. returns 0 or -1
+int encode_recipe(RECIPE *recipe, uint32_t job, char **body, size_t *len)
+{
+   FILE *out = open_memstream(body, len);
+   if (out == NULL)
+   {
+       return -1;
+   }
+
+   uint32_t net_job = htonl(job);
+   fwrite(&net_job, sizeof(net_job), 1, out);
+   for (TASK *task = recipe->tasks; task != NULL; task = task->next)
+   {
+       put_tagged(out, 'T', "");
+       for (STEP *step = task->steps; step != NULL; step = step->next)
+       {
+           put_tagged(out, 'S', "");
+           for (char **word = step->words; *word != NULL; word++)
+           {
+               put_tagged(out, 'W', *word);
+           }
+       }
+       if (task->input_file != NULL)
+       {
+           put_tagged(out, '<', task->input_file);
+       }
+       if (task->output_file != NULL)
+       {
+           put_tagged(out, '>', task->output_file);
+       }
+   }
+
+   if (ferror(out))
+   {
+       fclose(out);
+       free(*body);
+       return -1;
+   }
+   return fclose(out) == 0 ? 0 : -1;
+}
+
+
+// the job a RUN or DONE body is about. returns 0, or -1 if the body is too short
+int decode_job(const char *body, size_t len, uint32_t *job)
+{
+   if (len < sizeof(*job))
+   {
+       return -1;
+   }
+   memcpy(job, body, sizeof(*job));
+   *job = ntohl(*job);
+   return 0;
+}
+
+
+/*
+   rebuild the task list of a RUN body. the words & file names point into body,
+   the TASK & STEP structures & word arrays share one allocation, which starts
+   with the first task, so free(*tasks) releases it all (*tasks is NULL for a
+   recipe without tasks). returns 0, or -1 if the body is malformed.
+*/
+int decode_tasks(char *body, size_t len, TASK **tasks)
+{
+   int num_tasks = 0, num_steps = 0, num_words = 0;
+   int in_step = 0; // a word must follow a step of the same task
+   char *end = body + len;
+   if (len < sizeof(uint32_t))
+   {
+       return -1;
+   }
+
+   // first pass: check the structure & count everything
+   for (char *p = body + sizeof(uint32_t); p < end; )
+   {
+       char tag = *p++;
+       char *s = memchr(p, '\0', end - p);
+       if (s == NULL || (tag != 'T' && num_tasks == 0) || (tag == 'W' && !in_step))
+       {
+           return -1;
+       }
+       switch (tag)
+       {
+       case 'T': num_tasks++; in_step = 0; break;
+       case 'S': num_steps++; in_step = 1; break;
+       case 'W': num_words++; break;
+       case '<': case '>': break;
+       default: return -1;
+       }
+       p = s + 1;
+   }
+   *tasks = NULL;
+   if (num_tasks == 0)
+   {
+       return 0;
+   }
+
+   // one NULL per step terminates its words
+   char *block = calloc(1, num_tasks * sizeof(TASK) + num_steps * sizeof(STEP) + (num_words + num_steps) * sizeof(char *));
+   if (block == NULL)
+   {
+       return -1;
+   }
+   TASK *task = NULL;
+   STEP *step = NULL;
+   STEP *last_step = NULL;     // last step of the current task
+   TASK *next_task = (TASK *)block;
+   STEP *next_step = (STEP *)(block + num_tasks * sizeof(TASK));
+   char **word = (char **)(block + num_tasks * sizeof(TASK) + num_steps * sizeof(STEP));
+
+   // second pass: link the structures. calloc left a NULL after every step's words
+   for (char *p = body + sizeof(uint32_t); p < end; p += strlen(p) + 1)
+   {
+       char tag = *p++;
+       switch (tag)
+       {
+       case 'T':
+           if (task != NULL)
+           {
+               task->next = next_task;
+           }
+           task = next_task++;
+           last_step = NULL;
+           break;
+       case 'S':
+           if (step != NULL)
+           {
+               word++; // skip the NULL that ends the previous step
+           }
+           step = next_step++;
+           step->words = word;
+           if (last_step != NULL)
+           {
+               last_step->next = step;
+           }
+           else
+           {
+               task->steps = step;
+           }
+           last_step = step;
+           break;
+       case 'W':
+           *word++ = p;
+           break;
+       case '<':
+           task->input_file = p;
+           break;
+       case '>':
+           task->output_file = p;
+           break;
+       }
+   }
+   *tasks = (TASK *)block;
+   return 0;
+}
+
+
+// a cook running a RUN on this worker
+typedef struct worker_job
+{
+   uint32_t job;
+   pid_t pid;          // 0 marks a free slot
+   int pidfd;
+} WORKER_JOB;
+
+
+// cook process side: run the tasks of a RUN body in order & exit with the outcome
+static void run_job(int fd, int epfd, char *body, size_t len)
+{
+   TASK *tasks;
+   close(fd);
+   close(epfd);
+   if (decode_tasks(body, len, &tasks) != 0)
+   {
+       fprintf(stderr, "Error: malformed recipe from the coordinator\n");
+       exit(EXIT_FAILURE);
+   }
+   for (TASK *task = tasks; task != NULL; task = task->next)
+   {
+       if (execute_task(task) != 0)
+       {
+           exit(EXIT_FAILURE);
+       }
+   }
+   exit(EXIT_SUCCESS);
+}
+
+
+// report the outcome of job to the coordinator. returns 0, or -1 if it is gone
+static int send_done(int fd, uint32_t job, int failed)
+{
+   char body[5];
+   uint32_t net_job = htonl(job);
+   memcpy(body, &net_job, sizeof(net_job));
+   body[4] = (char)failed;
+   return send_message(fd, MSG_DONE, body, sizeof(body));
+}
+
+
+/*
+   fork a cook for a RUN body. a job that can't be started is reported as failed at once.
+   returns 1 if a cook was started, 0 if the job was answered, or -1 if the
+   body is malformed or the coordinator is gone.
+*/
+static int start_job(int fd, int epfd, WORKER_JOB *jobs, int capacity, char *body, size_t len)
+{
+   uint32_t job;
+   if (decode_job(body, len, &job) != 0)
+   {
+       return -1; // not even a job to report on
+   }
+
+   WORKER_JOB *slot = NULL;
+   for (int i = 0; i < capacity && slot == NULL; i++)
+   {
+       if (jobs[i].pid == 0)
+       {
+           slot = &jobs[i];
+       }
+   }
+   if (slot == NULL)
+   {
+       // the coordinator sent more than our capacity
+       return send_done(fd, job, 1) == 0 ? 0 : -1;
+   }
+
+   pid_t pid = fork();
+   if (pid == -1)
+   {
+       perror("fork");
+       return send_done(fd, job, 1) == 0 ? 0 : -1;
+   }
+   else if (pid == 0)
+   {
+       run_job(fd, epfd, body, len);
+   }
+   slot->job = job;
+   slot->pid = pid;
+   slot->pidfd = watch_process(epfd, pid, slot);
+   return 1;
+}
+
+
+/*
+   serve the coordinator on the connected stream socket fd, running up to
+   capacity recipes at once. returns the exit status of the worker.
+*/
+int worker_main(int fd, int capacity)
+{
+   CONN conn;
+   WORKER_JOB *jobs = calloc(capacity, sizeof(WORKER_JOB));
+   struct epoll_event *events = calloc(capacity + 1, sizeof(struct epoll_event));
+   int epfd = epoll_create1(EPOLL_CLOEXEC);
+   if (jobs == NULL || events == NULL || conn_init(&conn, fd) != 0 || epfd == -1)
+   {
+       perror("worker");
+       return EXIT_FAILURE;
+   }
+
+   // the connection is the only event without a job
+   struct epoll_event ev;
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   uint32_t net_capacity = htonl((uint32_t)capacity);
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1 || send_message(fd, MSG_HELLO, &net_capacity, sizeof(net_capacity)) != 0)
+   {
+       perror("worker");
+       return EXIT_FAILURE;
+   }
+
+   int running = 0;
+   int connected = 1;
+   while (connected || running > 0)
+   {
+       int n = epoll_wait(epfd, events, capacity + 1, -1);
+       if (n == -1)
+       {
+           if (errno == EINTR)
+           {
+               continue;
+           }
+           perror("epoll_wait");
+           break;
+       }
+       for (int i = 0; i < n; i++)
+       {
+           WORKER_JOB *slot = (WORKER_JOB *)events[i].data.ptr;
+           if (slot != NULL)
+           {
+               // a cook exited. answers to a coordinator that has gone away are dropped
+               int failed = process_failed(reap_process(epfd, slot->pid, slot->pidfd, NULL));
+               slot->pid = 0;
+               running--;
+               if (connected && send_done(fd, slot->job, failed) != 0)
+               {
+                   connected = 0;
+               }
+               continue;
+           }
+
+           if (conn_fill(&conn) <= 0)
+           {
+               connected = 0; // the coordinator is done with us, or gone
+               epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+               continue;
+           }
+           int type;
+           char *body;
+           size_t len;
+           int more;
+           while (connected && (more = conn_next(&conn, &type, &body, &len)) != 0)
+           {
+               int started = (more == 1 && type == MSG_RUN) ? start_job(fd, epfd, jobs, capacity, body, len) : -1;
+               if (started == -1)
+               {
+                   fprintf(stderr, "Error: worker lost its coordinator\n");
+                   connected = 0;
+                   epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+               }
+               running += (started == 1);
+           }
+       }
+   }
+
+   close(epfd);
+   close(fd);
+   conn_free(&conn);
+   free(jobs);
+   free(events);
+   return EXIT_SUCCESS;
+}
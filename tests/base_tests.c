@@ -1,8 +1,15 @@
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <string.h>
 #include <criterion/criterion.h>
 
+#include "cookbook.h"
+#include "cookbook_parser.h"
+#include "cook.h"
+#include "cook_state.h"
+
 void assert_success(int code) {
     cr_assert_eq(code, EXIT_SUCCESS,
                  "Program exited with %d instead of EXIT_SUCCESS",
@@ -37,3 +44,536 @@ Test(basecode_suite, hello_world_test, .timeout=20) {
     return_code = WEXITSTATUS(system(cmp));
     assert_output_matches(return_code);
 }
+
+Test(basecode_suite, result_cache_test, .timeout=30) {
+    // hello_world's compile & link steps redirect no output, so a second run
+    // with the cache must run them again rather than count them as hits.
+    char *cmd = "ulimit -t 10; bin/cook -c 1 -f rsrc/hello_world.ckb --cache=tmp/cache_test < /dev/null > tmp/hello_world.out 2>&1";
+    char *cmp = "grep -q 'Hello world!' tmp/hello_world.out && test ! -e tmp/main.o";
+
+    system("rm -rf tmp/cache_test");
+    for(int i = 0; i < 2; i++) {
+	int return_code = WEXITSTATUS(system(cmd));
+	assert_success(return_code);
+	return_code = WEXITSTATUS(system(cmp));
+	assert_output_matches(return_code);
+    }
+}
+
+Test(basecode_suite, result_cache_restore_test, .timeout=30) {
+    // the third run finds every output deleted & must restore both from the
+    // cache, byte for byte, without running a step. one name has a space.
+    char *cmd = "ulimit -t 10; bin/cook -c 1 -f tmp/cache_restore.ckb --cache=tmp/cache_restore < /dev/null > /dev/null 2> tmp/cache_restore.err";
+    char *hits = "grep -q 'cache: 2 hits, 0 misses' tmp/cache_restore.err && ! grep -q START tmp/cache_restore.err";
+    char *cmp = "cmp tmp/cache\\ part tmp/cache_part.expected && cmp tmp/cache_main tmp/cache_main.expected";
+
+    system("rm -rf tmp/cache_restore 'tmp/cache part' tmp/cache_main");
+    FILE *out = fopen("tmp/cache_restore.ckb", "w");
+    cr_assert_not_null(out);
+    fprintf(out, "main: part\n  cat tmp/cache\\ part | tr 0-9 a-j > tmp/cache_main\n\n");
+    fprintf(out, "part:\n  seq 1 5000 > tmp/cache\\ part\n");
+    fclose(out);
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    system("cp 'tmp/cache part' tmp/cache_part.expected && cp tmp/cache_main tmp/cache_main.expected");
+    return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(hits));
+    assert_output_matches(return_code);
+
+    system("rm -f 'tmp/cache part' tmp/cache_main");
+    return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(hits));
+    assert_output_matches(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, image_cycle_test, .timeout=30) {
+    // a cycle the main recipe doesn't need compiles & runs, as it does from
+    // the text. a run of a recipe on the cycle fails either way.
+    char *compile = "ulimit -t 10; bin/cook --compile tmp/image_cycle.ckb > /dev/null 2>&1";
+    char *cmd = "ulimit -t 10; bin/cook -f tmp/image_cycle.ckbc < /dev/null 2> /dev/null | cmp -s - tmp/image_cycle.expected";
+    char *cycle = "ulimit -t 10; bin/cook -f tmp/image_cycle.ckbc x < /dev/null > /dev/null 2>&1";
+
+    FILE *out = fopen("tmp/image_cycle.ckb", "w");
+    cr_assert_not_null(out);
+    fprintf(out, "main: a\n  echo main\n\na:\n  echo a\n\nx: y\n  echo x\n\ny: x\n  echo y\n");
+    fclose(out);
+    system("printf 'a\\nmain\\n' > tmp/image_cycle.expected; rm -f tmp/image_cycle.ckbc");
+
+    int return_code = WEXITSTATUS(system(compile));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmd));
+    assert_output_matches(return_code);
+    return_code = WEXITSTATUS(system(cycle));
+    assert_failure(return_code);
+}
+
+static char *unparse_to_string(COOKBOOK *cbp, size_t *lenp) {
+    char *text;
+    FILE *out = open_memstream(&text, lenp);
+    unparse_cookbook(cbp, out);
+    fclose(out);
+    return text;
+}
+
+Test(basecode_suite, command_install_test, .timeout=30) {
+    // main runs a command that isn't in util/ until install has run, so it
+    // must be looked up again when its step starts, with either engine.
+    char *cmd = "ulimit -t 10; bin/cook -f tmp/command_install.ckb < /dev/null 2> /dev/null | grep -qx installed";
+    char *direct = "ulimit -t 10; bin/cook -f tmp/command_install.ckb --engine=epoll --exec=direct < /dev/null 2> /dev/null | grep -qx installed";
+
+    FILE *out = fopen("tmp/command_install.ckb", "w");
+    cr_assert_not_null(out);
+    fprintf(out, "main: install\n  cook_installed_test\n\n");
+    fprintf(out, "install:\n  mkdir -p util\n  cp tmp/cook_installed_test util/cook_installed_test\n");
+    fclose(out);
+    system("printf '#!/bin/sh\\necho installed\\n' > tmp/cook_installed_test && chmod +x tmp/cook_installed_test");
+
+    system("rm -f util/cook_installed_test; rmdir util 2> /dev/null");
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    system("rm -f util/cook_installed_test; rmdir util 2> /dev/null");
+    return_code = WEXITSTATUS(system(direct));
+    assert_success(return_code);
+    system("rm -f util/cook_installed_test; rmdir util 2> /dev/null");
+}
+
+Test(basecode_suite, buffer_parser_test, .timeout=20) {
+    char *files[] = { "rsrc/cookbook.ckb", "rsrc/eggs_benedict.ckb", "rsrc/hello_world.ckb" };
+
+    for(int i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+	// The cookbook parsed in place must unparse the same as the one read from a stream.
+	char *expected, *actual;
+	size_t expected_len, actual_len;
+	int err;
+	FILE *in = fopen(files[i], "r");
+	cr_assert_not_null(in, "Can't open %s", files[i]);
+	COOKBOOK *cbp = parse_cookbook(in, &err);
+	fclose(in);
+	cr_assert_eq(err, 0, "Error parsing %s", files[i]);
+	expected = unparse_to_string(cbp, &expected_len);
+	free_cookbook(cbp);
+
+	ARENA arena;
+	arena_init(&arena);
+	cbp = parse_cookbook_file(files[i], &arena, &err);
+	cr_assert_not_null(cbp, "Can't map %s", files[i]);
+	cr_assert_eq(err, 0, "Error parsing %s in place", files[i]);
+	actual = unparse_to_string(cbp, &actual_len);
+	arena_free(&arena);
+
+	cr_assert(actual_len == expected_len && !memcmp(actual, expected, actual_len),
+		  "%s unparses differently when parsed in place", files[i]);
+	free(expected);
+	free(actual);
+    }
+}
+
+#define PARSE_THREADS 8
+#define PARSE_ROUNDS 20
+
+struct parse_job {
+    char path[32];
+    char *expected;             // Unparsed by a serial parse.
+    size_t expected_len;
+    int mismatches;
+};
+
+static void *parse_job(void *arg) {
+    struct parse_job *job = arg;
+    ARENA arena;
+    arena_init(&arena);
+    for(int i = 0; i < PARSE_ROUNDS; i++) {
+	// Alternate between parsing in place & reading from a stream.
+	COOKBOOK *cbp;
+	int err;
+	if(i % 2 == 0) {
+	    cbp = parse_cookbook_file(job->path, &arena, &err);
+	} else {
+	    FILE *in = fopen(job->path, "r");
+	    COOKBOOK_PARSER p;
+	    cookbook_parser_init_stream(&p, in);
+	    cbp = cookbook_parser_parse(&p, &err);
+	    fclose(in);
+	}
+	size_t len;
+	char *text = unparse_to_string(cbp, &len);
+	if(err || len != job->expected_len || memcmp(text, job->expected, len))
+	    job->mismatches++;
+	free(text);
+	free_cookbook(cbp);
+    }
+    arena_free(&arena);
+    return NULL;
+}
+
+Test(basecode_suite, parallel_parser_test, .timeout=60) {
+    // A different cookbook for each thread, with escapes & redirections
+    // so that both of the buffer parser's token scanners are exercised.
+    struct parse_job jobs[PARSE_THREADS];
+    for(int t = 0; t < PARSE_THREADS; t++) {
+	struct parse_job *job = &jobs[t];
+	snprintf(job->path, sizeof(job->path), "tmp/parallel%d.ckb", t);
+	FILE *out = fopen(job->path, "w");
+	cr_assert_not_null(out, "Can't create %s", job->path);
+	for(int i = 0; i < 500 * (t + 1); i++) {
+	    fprintf(out, "t%d_r%d:", t, i);
+	    for(int j = i - 1 - t % 3; j < i; j++)
+		if(j >= 0)
+		    fprintf(out, " t%d_r%d", t, j);
+	    fprintf(out, "\n  echo a\\ b\\|%d | tr a z > out%d\n", i, t);
+	    if(i % 3 == 0)
+		fprintf(out, "  cat < in\\ %d\n", i);
+	    fprintf(out, "\n");
+	}
+	fclose(out);
+
+	FILE *in = fopen(job->path, "r");
+	int err;
+	COOKBOOK *cbp = parse_cookbook(in, &err);
+	fclose(in);
+	cr_assert_eq(err, 0, "Error parsing %s", job->path);
+	job->expected = unparse_to_string(cbp, &job->expected_len);
+	job->mismatches = 0;
+	free_cookbook(cbp);
+    }
+
+    pthread_t threads[PARSE_THREADS];
+    for(int t = 0; t < PARSE_THREADS; t++)
+	cr_assert_eq(pthread_create(&threads[t], NULL, parse_job, &jobs[t]), 0,
+		     "Can't create thread %d", t);
+    for(int t = 0; t < PARSE_THREADS; t++)
+	pthread_join(threads[t], NULL);
+
+    for(int t = 0; t < PARSE_THREADS; t++) {
+	cr_assert_eq(jobs[t].mismatches, 0, "%d of %d concurrent parses of %s differ from a serial parse",
+		     jobs[t].mismatches, PARSE_ROUNDS, jobs[t].path);
+	free(jobs[t].expected);
+    }
+}
+
+#define SPLIT_FILES 10
+
+Test(basecode_suite, multi_file_parser_test, .timeout=30) {
+    // One cookbook, & the same one dealt out to several files, each of
+    // whose recipes depend on recipes in the files before it.
+    char *whole = "tmp/split.ckb";
+    char parts[SPLIT_FILES + 1][32];
+    char *paths[SPLIT_FILES + 1];
+    FILE *all = fopen(whole, "w");
+    cr_assert_not_null(all, "Can't create %s", whole);
+    for(int f = 0; f < SPLIT_FILES; f++) {
+	snprintf(parts[f], sizeof(parts[f]), "tmp/split%d.ckb", f);
+	paths[f] = parts[f];
+	FILE *out = fopen(parts[f], "w");
+	cr_assert_not_null(out, "Can't create %s", parts[f]);
+	for(int i = f * 300; i < (f + 1) * 300; i++) {
+	    FILE *both[] = { all, out };
+	    for(int j = 0; j < 2; j++) {
+		fprintf(both[j], "r%d:", i);
+		if(i >= 300)
+		    fprintf(both[j], " r%d r%d", i - 300, i % 300);
+		fprintf(both[j], "\n  echo recipe\\ %d | cat > /dev/null\n\n", i);
+	    }
+	}
+	fclose(out);
+    }
+    fclose(all);
+
+    int err;
+    FILE *in = fopen(whole, "r");
+    COOKBOOK *cbp = parse_cookbook(in, &err);
+    fclose(in);
+    cr_assert_eq(err, 0, "Error parsing %s", whole);
+    size_t expected_len, actual_len;
+    char *expected = unparse_to_string(cbp, &expected_len);
+    free_cookbook(cbp);
+
+    ARENA arena;
+    arena_init(&arena);
+    cbp = parse_cookbook_files(paths, SPLIT_FILES, 4, &arena, &err);
+    cr_assert_not_null(cbp, "Can't load the files of %s", whole);
+    cr_assert_eq(err, 0, "Error parsing the files of %s", whole);
+    char *actual = unparse_to_string(cbp, &actual_len);
+    cr_assert(actual_len == expected_len && !memcmp(actual, expected, actual_len),
+	      "%s unparses differently when split across files", whole);
+    cr_assert_eq(find_recipe_by_name(cbp, "r2999")->this_depends_on->recipe,
+		 find_recipe_by_name(cbp, "r2699"),
+		 "Dependency across files not linked");
+    free_cookbook(cbp);
+    free(expected);
+    free(actual);
+
+    // A recipe defined in two of the files is an error.
+    snprintf(parts[SPLIT_FILES], sizeof(parts[SPLIT_FILES]), "tmp/split_dup.ckb");
+    paths[SPLIT_FILES] = parts[SPLIT_FILES];
+    FILE *out = fopen(paths[SPLIT_FILES], "w");
+    fprintf(out, "r42:\n  echo again\n");
+    fclose(out);
+    cbp = parse_cookbook_files(paths, SPLIT_FILES + 1, 4, &arena, &err);
+    cr_assert_not_null(cbp, "Can't load the files of %s", whole);
+    cr_assert_neq(err, 0, "Duplicate recipe across files not reported");
+    arena_free(&arena);
+}
+
+Test(basecode_suite, dependency_analysis_test, .timeout=60) {
+    // A chain a million recipes deep, each also depending on a recipe that
+    // the one before it depends on as well, making diamonds all the way down.
+    int n = 1000000;
+    char *path = "tmp/chain.ckb";
+    FILE *out = fopen(path, "w");
+    cr_assert_not_null(out, "Can't create %s", path);
+    fprintf(out, "top: c%d\n\nc0:\n\nc1: c0\n\n", n - 1);
+    for(int i = 2; i < n; i++)
+	fprintf(out, "c%d: c%d c%d\n\n", i, i - 1, i - 2);
+    fclose(out);
+
+    ARENA arena;
+    arena_init(&arena);
+    COOKBOOK *cbp = load_cookbook(path, &arena);
+    cr_assert_not_null(cbp, "Can't load %s", path);
+    cr_assert_eq(perform_dependency_analysis(cbp, "top"), 0, "Analysis of %s failed", path);
+    cr_assert_eq(num_required_recipes, n + 1, "%d of %d recipes required", num_required_recipes, n + 1);
+
+    // Every recipe must come after all of its sub-recipes.
+    int misplaced = 0;
+    for(int i = 0; i < num_required_recipes; i++) {
+	RECIPE *rp = required_order[i];
+	for(RECIPE_LINK *link = rp->this_depends_on; link != NULL; link = link->next)
+	    if(!((RECIPE_STATE *)link->recipe->state)->completed)
+		misplaced++;
+	((RECIPE_STATE *)rp->state)->completed = 1;
+    }
+    cr_assert_eq(misplaced, 0, "%d recipes precede a sub-recipe of theirs", misplaced);
+    cleanup(cbp);
+
+    // A cycle among the required recipes fails the analysis.
+    path = "tmp/cycle.ckb";
+    out = fopen(path, "w");
+    fprintf(out, "main: a\n  echo main\n\na: b c\n  echo a\n\nb:\n  echo b\n\nc: a\n  echo c\n");
+    fclose(out);
+    cbp = load_cookbook(path, &arena);
+    cr_assert_not_null(cbp, "Can't load %s", path);
+    cr_assert_eq(perform_dependency_analysis(cbp, "main"), -1, "Cycle in %s not detected", path);
+    cleanup(cbp);
+    arena_free(&arena);
+}
+
+#define LAYERS 40
+#define LAYER_WIDTH 5000
+
+Test(basecode_suite, parallel_analysis_test, .timeout=60) {
+    // Layers of recipes each depending on three of the layer below, wide
+    // enough for the levels of the parallel analysis to be split up.
+    char *path = "tmp/layers.ckb";
+    FILE *out = fopen(path, "w");
+    cr_assert_not_null(out, "Can't create %s", path);
+    fprintf(out, "top:");
+    for(int j = 0; j < LAYER_WIDTH; j += 2)
+	fprintf(out, " l%d_%d", LAYERS - 1, j);
+    fprintf(out, "\n\n");
+    unsigned seed = 1;
+    for(int l = 0; l < LAYERS; l++) {
+	for(int j = 0; j < LAYER_WIDTH; j++) {
+	    fprintf(out, "l%d_%d:", l, j);
+	    for(int k = 0; l > 0 && k < 3; k++) {
+		seed = seed * 1103515245 + 12345;
+		fprintf(out, " l%d_%u", l - 1, (seed >> 8) % LAYER_WIDTH);
+	    }
+	    fprintf(out, "\n%s\n", j % 7 == 0 ? "  true | true\n" : "");
+	}
+    }
+    fclose(out);
+
+    ARENA arena;
+    arena_init(&arena);
+    COOKBOOK *cbp = load_cookbook(path, &arena);
+    cr_assert_not_null(cbp, "Can't load %s", path);
+    int n = 0;
+    for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next)
+	n++;
+
+    // Everything the rest of the run goes by must come out the same: the
+    // flags, pending_deps & priorities, & the queue. required_order only has
+    // to be topological, as the parallel analysis sorts by levels & the
+    // serial one in depth-first postorder.
+    long *serial = calloc(3 * n, sizeof(long));
+    RECIPE **serial_queue = calloc(n, sizeof(RECIPE *));
+    int serial_required = 0, serial_queued = 0;
+    for(int threads = 1; threads <= 16; threads *= 2) {
+	analysis_threads_global = threads;
+	init_work_queue(SCHEDULE_CRITICAL_PATH);
+	cr_assert_eq(perform_dependency_analysis(cbp, "top"), 0, "Analysis on %d threads failed", threads);
+	int i = 0, mismatches = 0;
+	for(RECIPE *rp = cbp->recipes; rp != NULL; rp = rp->next, i++) {
+	    RECIPE_STATE *state = rp->state;
+	    long found[3] = { state->required, state->pending_deps, state->priority };
+	    if(threads == 1)
+		memcpy(&serial[3 * i], found, sizeof(found));
+	    else
+		mismatches += memcmp(&serial[3 * i], found, sizeof(found)) != 0;
+	    state->completed = 0;
+	}
+	cr_assert_eq(mismatches, 0, "%d recipes differ on %d threads", mismatches, threads);
+
+	// The order must be topological, & the same recipes must be queued in the same order.
+	for(i = 0; i < num_required_recipes; i++) {
+	    RECIPE *rp = required_order[i];
+	    for(RECIPE_LINK *link = rp->this_depends_on; link != NULL; link = link->next)
+		mismatches += !((RECIPE_STATE *)link->recipe->state)->completed;
+	    ((RECIPE_STATE *)rp->state)->completed = 1;
+	}
+	cr_assert_eq(mismatches, 0, "Order on %d threads is not topological", threads);
+	RECIPE *rp;
+	for(i = 0; (rp = dequeue_recipe()) != NULL; i++) {
+	    if(threads == 1)
+		serial_queue[i] = rp;
+	    else
+		mismatches += i >= serial_queued || serial_queue[i] != rp;
+	}
+	if(threads == 1) {
+	    serial_required = num_required_recipes;
+	    serial_queued = i;
+	}
+	cr_assert(mismatches == 0 && i == serial_queued && num_required_recipes == serial_required,
+		  "Queue or required set differs on %d threads", threads);
+    }
+    analysis_threads_global = 1;
+    free(serial);
+    free(serial_queue);
+    cleanup(cbp);
+    arena_free(&arena);
+}
+
+static long resident_pages(void) {
+    long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if(f != NULL) {
+	if(fscanf(f, "%ld %ld", &size, &resident) != 2)
+	    resident = 0;
+	fclose(f);
+    }
+    return resident;
+}
+
+Test(basecode_suite, cookbook_reload_test, .timeout=60) {
+    // A cookbook of 5000 recipes, each depending on the two before it.
+    char *path = "tmp/reload.ckb";
+    FILE *out = fopen(path, "w");
+    cr_assert_not_null(out, "Can't create %s", path);
+    for(int i = 0; i < 5000; i++) {
+	fprintf(out, "r%d:", i);
+	for(int j = i - 2; j < i; j++)
+	    if(j >= 0)
+		fprintf(out, " r%d", j);
+	fprintf(out, "\n  echo recipe\\ %d | cat > /dev/null\n\n", i);
+    }
+    fclose(out);
+
+    // Loading & discarding it again & again must not grow the process.
+    ARENA arena;
+    arena_init(&arena);
+    long resident = 0;
+    for(int i = 0; i < 1000; i++) {
+	COOKBOOK *cbp = load_cookbook(path, &arena);
+	cr_assert_not_null(cbp, "Can't load %s", path);
+	cr_assert_eq(reset_recipe_states(cbp), 0, "Can't allocate the recipe states");
+	cleanup(cbp);
+	if(i % 100 == 0) {
+	    // The same, with a cookbook that is freed node by node.
+	    int err;
+	    FILE *in = fopen(path, "r");
+	    cbp = parse_cookbook(in, &err);
+	    fclose(in);
+	    cr_assert_eq(err, 0, "Error parsing %s", path);
+	    cleanup(cbp);
+	}
+	if(i == 10)
+	    resident = resident_pages();
+    }
+    arena_free(&arena);
+    cr_assert(resident_pages() - resident < 256,
+	      "Resident set grew from %ld to %ld pages", resident, resident_pages());
+}
+
+Test(basecode_suite, trace_test, .timeout=30) {
+    // Every engine must leave a complete JSON trace, in which the recipe &
+    // task slices of each cook lane nest properly.
+    char *modes[] = { "", "--engine=epoll", "--engine=epoll --exec=direct" };
+    char *check = "python3 -c \"import json, sys\n"
+	"events = sorted(json.load(open('tmp/trace.json')), key=lambda e: e['ts'])\n"
+	"lanes = {}\n"
+	"for e in events:\n"
+	"    if e['ph'] == 'B': lanes.setdefault(e['pid'], []).append(e['name'])\n"
+	"    if e['ph'] == 'E': assert lanes[e['pid']].pop() == e['name']\n"
+	"assert lanes and not any(lanes.values())\n"
+	"assert sum(e['ph'] == 'b' for e in events) == sum(e['ph'] == 'e' for e in events) > 0\"";
+    for(int i = 0; i < 3; i++) {
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "ulimit -t 10; bin/cook -c 2 -f rsrc/eggs_benedict.ckb %s --trace=tmp/trace.json < /dev/null > /dev/null", modes[i]);
+	int return_code = WEXITSTATUS(system(cmd));
+	assert_success(return_code);
+	return_code = WEXITSTATUS(system(check));
+	cr_assert_eq(return_code, 0, "Bad trace with '%s'", modes[i]);
+    }
+}
+
+Test(basecode_suite, stats_test, .timeout=30) {
+    // Every recipe of eggs_benedict has steps, so each one that ran must have
+    // a CSV row counting them, with a CPU time & wall time in it.
+    char *modes[] = { "", "--engine=epoll", "--engine=epoll --exec=direct" };
+    for(int i = 0; i < 3; i++) {
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "ulimit -t 10; bin/cook -c 2 -f rsrc/eggs_benedict.ckb %s --stats=tmp/stats.csv < /dev/null > /dev/null 2>&1", modes[i]);
+	int return_code = WEXITSTATUS(system(cmd));
+	assert_success(return_code);
+
+	FILE *csv = fopen("tmp/stats.csv", "r");
+	cr_assert_not_null(csv, "No stats written with '%s'", modes[i]);
+	char line[512];
+	cr_assert_not_null(fgets(line, sizeof(line), csv), "Empty stats with '%s'", modes[i]);
+	int rows = 0;
+	while(fgets(line, sizeof(line), csv) != NULL) {
+	    long steps, wall, user, sys;
+	    char *fields = strrchr(line, '"');
+	    cr_assert_not_null(fields, "Bad row '%s'", line);
+	    cr_assert_eq(sscanf(fields, "\",%ld,%ld,%ld,%ld", &steps, &wall, &user, &sys), 4, "Bad row '%s'", line);
+	    cr_assert(steps > 0 && wall > 0 && user >= 0 && sys >= 0, "Bad row '%s'", line);
+	    rows++;
+	}
+	fclose(csv);
+	cr_assert(rows > 1, "Only %d recipes in the stats with '%s'", rows, modes[i]);
+    }
+}
+
+Test(basecode_suite, latency_report_test, .timeout=30) {
+    // Every recipe of eggs_benedict is forked, execs steps & is reaped, so
+    // all four latencies must have been recorded, in increasing percentiles.
+    char *cmd = "ulimit -t 10; bin/cook -c 2 -f rsrc/eggs_benedict.ckb --latency-report < /dev/null > /dev/null 2> tmp/latency.out";
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+
+    char *names[] = { "ready->dispatch", "fork->exec", "exit->reap", "reap->enqueue" };
+    FILE *in = fopen("tmp/latency.out", "r");
+    cr_assert_not_null(in, "No latency report");
+    char line[512];
+    int found = 0;
+    while(fgets(line, sizeof(line), in) != NULL) {
+	for(int i = 0; i < 4; i++) {
+	    if(strncmp(line, names[i], strlen(names[i])) != 0 || line[strlen(names[i])] != ' ')
+		continue;
+	    long count;
+	    double mean, p50, p90, p99, p999, max;
+	    cr_assert_eq(sscanf(line + strlen(names[i]), "%ld %lf %lf %lf %lf %lf %lf", &count, &mean, &p50, &p90, &p99, &p999, &max), 7,
+			 "Bad line '%s'", line);
+	    cr_assert(count > 0 && p50 <= p90 && p90 <= p99 && p99 <= p999 && p999 <= max, "Bad line '%s'", line);
+	    found |= 1 << i;
+	}
+    }
+    fclose(in);
+    cr_assert_eq(found, 15, "Missing latencies in the report");
+}